@@ -0,0 +1,514 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include "alsadrv.h"
+
+Alsapcm::Alsapcm(void) : _pcm(0),
+                         _format(SND_PCM_FORMAT_UNKNOWN),
+                         _dest(0),
+                         _evid(0),
+                         _stop(false),
+                         _running(false),
+                         _fsamp(0),
+                         _fsize(0),
+                         _nfrag(0),
+                         _nchan(0),
+                         _ninstr(0)
+{
+    memset(_buff, 0, MAXCHAN * sizeof(float *));
+}
+
+Alsapcm::~Alsapcm(void)
+{
+    int i;
+
+    stop();
+    if (_pcm)
+        snd_pcm_close(_pcm);
+    for (i = 0; i < MAXCHAN; i++)
+        delete[] _buff[i];
+}
+
+// Opens the device for nchan channels at least. The sample rate,
+// period size and number of periods must be supported as given.
+//
+int Alsapcm::open(const char *device, int fsamp, int fsize, int nfrag, int nchan)
+{
+    int i, err;
+
+    if ((err = snd_pcm_open(&_pcm, device, SND_PCM_STREAM_PLAYBACK, 0)) < 0)
+    {
+        fprintf(stderr, "Error: can't open ALSA device '%s': %s.\n", device, snd_strerror(err));
+        _pcm = 0;
+        return 1;
+    }
+    if (set_hwpar(fsamp, fsize, nfrag, nchan) || set_swpar())
+        return 1;
+    for (i = 0; i < _nchan; i++)
+    {
+        _buff[i] = new float[_fsize];
+        memset(_buff[i], 0, _fsize * sizeof(float));
+    }
+    return 0;
+}
+
+// Selects the first format the device supports, in order of
+// preference.
+//
+static int set_format(snd_pcm_t *pcm, snd_pcm_hw_params_t *H, snd_pcm_format_t *format)
+{
+    static const snd_pcm_format_t formats[3] = {
+        SND_PCM_FORMAT_FLOAT_LE,
+        SND_PCM_FORMAT_S32_LE,
+        SND_PCM_FORMAT_S16_LE};
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (snd_pcm_hw_params_set_format(pcm, H, formats[i]) == 0)
+        {
+            *format = formats[i];
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int Alsapcm::set_hwpar(int fsamp, int fsize, int nfrag, int nchan)
+{
+    snd_pcm_hw_params_t *H;
+    const char *what;
+    unsigned int n;
+
+    snd_pcm_hw_params_malloc(&H);
+    what = 0;
+    n = nchan;
+    if (snd_pcm_hw_params_any(_pcm, H) < 0)
+        what = "configuration";
+    else if (snd_pcm_hw_params_set_access(_pcm, H, SND_PCM_ACCESS_MMAP_NONINTERLEAVED) < 0 &&
+             snd_pcm_hw_params_set_access(_pcm, H, SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0)
+        what = "mmap access";
+    else if (set_format(_pcm, H, &_format))
+        what = "sample format";
+    else if (snd_pcm_hw_params_set_channels_min(_pcm, H, &n) < 0 ||
+             snd_pcm_hw_params_set_channels_first(_pcm, H, &n) < 0 || n > MAXCHAN)
+        what = "number of channels";
+    else if (snd_pcm_hw_params_set_rate(_pcm, H, fsamp, 0) < 0)
+        what = "sample rate";
+    else if (snd_pcm_hw_params_set_period_size(_pcm, H, fsize, 0) < 0)
+        what = "period size";
+    else if (snd_pcm_hw_params_set_periods(_pcm, H, nfrag, 0) < 0)
+        what = "number of periods";
+    else if (snd_pcm_hw_params(_pcm, H) < 0)
+        what = "parameters";
+    snd_pcm_hw_params_free(H);
+    if (what)
+    {
+        fprintf(stderr, "Error: can't set the ALSA %s.\n", what);
+        return 1;
+    }
+    _fsamp = fsamp;
+    _fsize = fsize;
+    _nfrag = nfrag;
+    _nchan = n;
+    return 0;
+}
+
+// The device is started by the thread once the buffer is filled,
+// and stops when it runs empty.
+//
+int Alsapcm::set_swpar(void)
+{
+    snd_pcm_sw_params_t *S;
+    snd_pcm_uframes_t b;
+    int err;
+
+    snd_pcm_sw_params_malloc(&S);
+    snd_pcm_sw_params_current(_pcm, S);
+    snd_pcm_sw_params_get_boundary(S, &b);
+    err = snd_pcm_sw_params_set_start_threshold(_pcm, S, b) < 0 ||
+          snd_pcm_sw_params_set_stop_threshold(_pcm, S, _fsize * _nfrag) < 0 ||
+          snd_pcm_sw_params_set_avail_min(_pcm, S, _fsize) < 0 ||
+          snd_pcm_sw_params(_pcm, S) < 0;
+    snd_pcm_sw_params_free(S);
+    if (err)
+    {
+        fprintf(stderr, "Error: can't set the ALSA software parameters.\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Adds an instrument, initialised by Audio::init_host(), before
+// the thread is started.
+//
+void Alsapcm::add(Audio *audio, Lfq_u8 *qmidi)
+{
+    if (_ninstr < NINSTR)
+    {
+        _audio[_ninstr] = audio;
+        _qmidi[_ninstr++] = qmidi;
+    }
+}
+
+// Starts the thread with the given policy and priority if possible.
+// Event evid is sent to dest if the device fails.
+//
+int Alsapcm::start(int policy, int relpri, Edest *dest, int evid)
+{
+    _dest = dest;
+    _evid = evid;
+    if (thr_start(policy, relpri, 0))
+    {
+        fprintf(stderr, "Warning: can't run ALSA thread in RT mode.\n");
+        if (thr_start(SCHED_OTHER, 0, 0))
+            return 1;
+    }
+    _running = true;
+    return 0;
+}
+
+void Alsapcm::stop(void)
+{
+    if (!_running)
+        return;
+    _stop = true;
+    _done.wait();
+    _running = false;
+}
+
+void Alsapcm::thr_main(void)
+{
+    snd_pcm_sframes_t n;
+    int err;
+
+    err = recover(0);
+    while (!err && !_stop)
+    {
+        n = snd_pcm_wait(_pcm, 1000);
+        if (n >= 0)
+            n = snd_pcm_avail_update(_pcm);
+        while ((n >= _fsize) && !_stop)
+        {
+            play();
+            n = snd_pcm_avail_update(_pcm);
+        }
+        if (n < 0)
+            err = recover(n);
+    }
+    snd_pcm_drop(_pcm);
+    if (err && _dest)
+        _dest->put_event(_evid, 1);
+    _done.post();
+}
+
+// Restarts the device after an xrun or a suspend, or starts it if
+// err is 0. The buffer is filled with silence first. Returns non
+// zero if the device can't be used anymore.
+//
+int Alsapcm::recover(int err)
+{
+    const snd_pcm_channel_area_t *A;
+    snd_pcm_uframes_t offs, frames;
+    snd_pcm_sframes_t n;
+
+    if (err)
+    {
+        if ((err != -EPIPE) && (err != -ESTRPIPE))
+        {
+            fprintf(stderr, "Error: ALSA device failed: %s.\n", snd_strerror(err));
+            return 1;
+        }
+        if ((err = snd_pcm_recover(_pcm, err, 1)) < 0)
+        {
+            fprintf(stderr, "Error: can't restart ALSA device: %s.\n", snd_strerror(err));
+            return 1;
+        }
+    }
+    if (snd_pcm_state(_pcm) != SND_PCM_STATE_PREPARED)
+        return 0;
+    n = snd_pcm_avail_update(_pcm);
+    while (n > 0)
+    {
+        frames = n;
+        if (snd_pcm_mmap_begin(_pcm, &A, &offs, &frames) < 0)
+            break;
+        snd_pcm_areas_silence(A, offs, _nchan, frames, _format);
+        snd_pcm_mmap_commit(_pcm, offs, frames);
+        n -= frames;
+    }
+    if ((err = snd_pcm_start(_pcm)) < 0)
+    {
+        fprintf(stderr, "Error: can't start ALSA device: %s.\n", snd_strerror(err));
+        return 1;
+    }
+    return 0;
+}
+
+// Renders one period of all instruments and writes it to the
+// device buffer.
+//
+void Alsapcm::play(void)
+{
+    int c, k, n;
+
+    for (c = k = 0; k < _ninstr; k++)
+    {
+        n = get_midi(_qmidi[k]);
+        _audio[k]->process(_fsize, _midi, n, _buff + c);
+        c += _audio[k]->nout();
+    }
+    write(_fsize);
+}
+
+void Alsapcm::write(int nframes)
+{
+    const snd_pcm_channel_area_t *A;
+    snd_pcm_uframes_t offs, frames;
+    int c, i, j, k, d;
+    char *p;
+    const float *q;
+    float v;
+
+    for (j = 0; j < nframes; j += k)
+    {
+        frames = nframes - j;
+        if (snd_pcm_mmap_begin(_pcm, &A, &offs, &frames) < 0)
+            return;
+        k = frames;
+        for (c = 0; c < _nchan; c++)
+        {
+            p = (char *)(A[c].addr) + (A[c].first + offs * A[c].step) / 8;
+            d = A[c].step / 8;
+            q = _buff[c] + j;
+            switch (_format)
+            {
+            case SND_PCM_FORMAT_FLOAT_LE:
+                for (i = 0; i < k; i++, p += d)
+                    *((float *)p) = q[i];
+                break;
+            case SND_PCM_FORMAT_S32_LE:
+                for (i = 0; i < k; i++, p += d)
+                {
+                    v = q[i];
+                    v = (v > 1.0f) ? 1.0f : ((v < -1.0f) ? -1.0f : v);
+                    *((int32_t *)p) = (int32_t)(v * 2147483392.0f);
+                }
+                break;
+            default:
+                for (i = 0; i < k; i++, p += d)
+                {
+                    v = q[i];
+                    v = (v > 1.0f) ? 1.0f : ((v < -1.0f) ? -1.0f : v);
+                    *((int16_t *)p) = (int16_t)(v * 32767.0f);
+                }
+            }
+        }
+        if (snd_pcm_mmap_commit(_pcm, offs, frames) != (snd_pcm_sframes_t)frames)
+            return;
+    }
+}
+
+// Takes the MIDI events written by Alsamidi since the last period.
+// They are applied at the start of the period.
+//
+int Alsapcm::get_midi(Lfq_u8 *Q)
+{
+    int i, n, s;
+
+    if (!Q)
+        return 0;
+    for (n = 0; (n < 64) && Q->read_avail(); n++)
+    {
+        s = Q->read(0);
+        for (i = 0; i < s; i++)
+            _mdata[n][i] = Q->read(i + 1);
+        Q->read_commit(s + 1);
+        _midi[n]._time = 0;
+        _midi[n]._size = s;
+        _midi[n]._data = _mdata[n];
+    }
+    return n;
+}
+
+Alsamidi::Alsamidi(void) : _seq(0),
+                           _raw(0),
+                           _encoder(0),
+                           _decoder(0),
+                           _stop(false),
+                           _running(false),
+                           _nport(0)
+{
+    snd_midi_event_new(16, &_encoder);
+    snd_midi_event_new(16, &_decoder);
+    snd_midi_event_no_status(_decoder, 1);
+}
+
+Alsamidi::~Alsamidi(void)
+{
+    stop();
+    if (_seq)
+        snd_seq_close(_seq);
+    if (_raw)
+        snd_rawmidi_close(_raw);
+    snd_midi_event_free(_encoder);
+    snd_midi_event_free(_decoder);
+}
+
+// Creates a sequencer client with nport input ports, the events
+// received on ports[k] are written to queues[k].
+//
+int Alsamidi::open_seq(const char *client, int nport, const char **ports, Lfq_u8 **queues)
+{
+    int k;
+
+    if (snd_seq_open(&_seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0)
+    {
+        fprintf(stderr, "Error: can't open ALSA sequencer.\n");
+        _seq = 0;
+        return 1;
+    }
+    snd_seq_set_client_name(_seq, client);
+    for (k = 0; (k < nport) && (k < Alsapcm::NINSTR); k++)
+    {
+        _ports[k] = snd_seq_create_simple_port(_seq, ports[k],
+                                               SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+                                               SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+        if (_ports[k] < 0)
+        {
+            fprintf(stderr, "Error: can't create the '%s' ALSA sequencer port.\n", ports[k]);
+            return 1;
+        }
+        _queues[k] = queues[k];
+    }
+    _nport = k;
+    return 0;
+}
+
+int Alsamidi::open_raw(const char *device, Lfq_u8 *queue)
+{
+    if (snd_rawmidi_open(&_raw, 0, device, SND_RAWMIDI_NONBLOCK) < 0)
+    {
+        fprintf(stderr, "Error: can't open ALSA MIDI device '%s'.\n", device);
+        _raw = 0;
+        return 1;
+    }
+    _queues[0] = queue;
+    _nport = 1;
+    return 0;
+}
+
+int Alsamidi::start(int policy, int relpri)
+{
+    if (thr_start(policy, relpri, 0))
+    {
+        fprintf(stderr, "Warning: can't run ALSA MIDI thread in RT mode.\n");
+        if (thr_start(SCHED_OTHER, 0, 0))
+            return 1;
+    }
+    _running = true;
+    return 0;
+}
+
+void Alsamidi::stop(void)
+{
+    if (!_running)
+        return;
+    _stop = true;
+    _done.wait();
+    _running = false;
+}
+
+void Alsamidi::thr_main(void)
+{
+    struct pollfd pfd[8];
+    int n;
+
+    if (_seq)
+        n = snd_seq_poll_descriptors(_seq, pfd, 8, POLLIN);
+    else
+        n = snd_rawmidi_poll_descriptors(_raw, pfd, 8);
+    // The timeout is only used to check for stop().
+    while (!_stop)
+    {
+        if (poll(pfd, n, 100) > 0)
+        {
+            if (_seq)
+                proc_seq();
+            else
+                proc_raw();
+        }
+    }
+    _done.post();
+}
+
+void Alsamidi::proc_seq(void)
+{
+    snd_seq_event_t *E;
+    int k;
+
+    while (snd_seq_event_input(_seq, &E) >= 0)
+    {
+        for (k = 0; k < _nport; k++)
+        {
+            if (E->dest.port == _ports[k])
+            {
+                send(k, E);
+                break;
+            }
+        }
+    }
+}
+
+void Alsamidi::proc_raw(void)
+{
+    unsigned char d[256];
+    snd_seq_event_t E;
+    int i, n;
+
+    while ((n = snd_rawmidi_read(_raw, d, 256)) > 0)
+    {
+        for (i = 0; i < n; i++)
+        {
+            if (snd_midi_event_encode_byte(_encoder, d[i], &E) == 1)
+                send(0, &E);
+        }
+    }
+}
+
+void Alsamidi::send(int k, snd_seq_event_t *E)
+{
+    unsigned char d[16];
+    Lfq_u8 *Q = _queues[k];
+    int i, n;
+
+    n = snd_midi_event_decode(_decoder, d, 16, E);
+    if ((n < 1) || (n > 3) || (d[0] >= 0xF0))
+        return;
+    if (Q->write_avail() < n + 1)
+        return;
+    Q->write(0, n);
+    for (i = 0; i < n; i++)
+        Q->write(i + 1, d[i]);
+    Q->write_commit(n + 1);
+}
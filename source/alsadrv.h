@@ -0,0 +1,114 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __ALSADRV_H
+#define __ALSADRV_H
+
+#include <clthreads.h>
+#include <alsa/asoundlib.h>
+#include "audio.h"
+#include "lfqueue.h"
+
+// Runs instruments on an ALSA PCM device without JACK. The device
+// is used in mmap mode from a thread of its own, which calls the
+// process() of each Audio once per period. Each instrument gets
+// the next nout() output channels. MIDI is read from the queue
+// given with the Audio, as written by an Alsamidi.
+//
+class Alsapcm : public P_thread
+{
+public:
+    enum { NINSTR = 8, MAXCHAN = 32 };
+
+    Alsapcm(void);
+    virtual ~Alsapcm(void);
+
+    int open(const char *device, int fsamp, int fsize, int nfrag, int nchan);
+    void add(Audio *audio, Lfq_u8 *qmidi);
+    int start(int policy, int relpri, Edest *dest, int evid);
+    void stop(void);
+    int fsamp(void) const { return _fsamp; }
+
+private:
+    virtual void thr_main(void);
+
+    int set_hwpar(int fsamp, int fsize, int nfrag, int nchan);
+    int set_swpar(void);
+    int recover(int err);
+    void play(void);
+    void write(int nframes);
+    int get_midi(Lfq_u8 *Q);
+
+    snd_pcm_t *_pcm;
+    snd_pcm_format_t _format;
+    Edest *_dest;
+    int _evid;
+    volatile bool _stop;
+    bool _running;
+    P_sema _done;
+    int _fsamp;
+    int _fsize;
+    int _nfrag;
+    int _nchan;
+    int _ninstr;
+    Audio *_audio[NINSTR];
+    Lfq_u8 *_qmidi[NINSTR];
+    float *_buff[MAXCHAN];
+    Midiev _midi[64];
+    uint8_t _mdata[64][3];
+};
+
+// Reads MIDI input from the ALSA sequencer, with a port for each
+// instrument, or from a raw MIDI device, that feeds instrument 0.
+// The events are passed to the PCM thread through lock-free queues,
+// each as a size byte followed by at most 3 bytes of data. Running
+// status and system messages are removed.
+//
+class Alsamidi : public P_thread
+{
+public:
+    Alsamidi(void);
+    virtual ~Alsamidi(void);
+
+    int open_seq(const char *client, int nport, const char **ports, Lfq_u8 **queues);
+    int open_raw(const char *device, Lfq_u8 *queue);
+    int start(int policy, int relpri);
+    void stop(void);
+
+private:
+    virtual void thr_main(void);
+
+    void proc_seq(void);
+    void proc_raw(void);
+    void send(int k, snd_seq_event_t *E);
+
+    snd_seq_t *_seq;
+    snd_rawmidi_t *_raw;
+    snd_midi_event_t *_encoder;
+    snd_midi_event_t *_decoder;
+    volatile bool _stop;
+    bool _running;
+    P_sema _done;
+    int _nport;
+    int _ports[Alsapcm::NINSTR];
+    Lfq_u8 *_queues[Alsapcm::NINSTR];
+};
+
+#endif
@@ -41,6 +41,41 @@ void Diffuser::fini(void)
     delete[] _data;
 }
 
+void Diffuser::reset(void)
+{
+    memset(_data, 0, _size * sizeof(float));
+}
+
+// Process n samples in place. Since n never exceeds the size
+// of the delay line, the samples read in this call are never
+// written by it, and each segment between wraparounds of the
+// index can be computed as an independent vector operation.
+//
+void Diffuser::process(int n, float *x)
+{
+    int i, k;
+    float w, *d;
+
+    while (n)
+    {
+        k = _size - _i;
+        if (k > n)
+            k = n;
+        d = _data + _i;
+        for (i = 0; i < k; i++)
+        {
+            w = x[i] - _c * d[i];
+            x[i] = d[i] + _c * w;
+            d[i] = w;
+        }
+        x += k;
+        n -= k;
+        _i += k;
+        if (_i == _size)
+            _i = 0;
+    }
+}
+
 float Asection::_refl[16] =
     {
         0.250f, 0.440f, 0.615f, 0.940f,
@@ -54,11 +89,15 @@ Asection::Asection(float fsam) : _fsam(fsam)
     memset(_base, 0, NCHANN * N * sizeof(float));
 
     _offs0 = 0;
+    _hold = 0;
+    _tail = 0;
+    _idle = true;
     _sw = _sx = _sy = 0.0f;
     _dif0.init((int)(fsam * 0.017f), 0.5f);
     _dif1.init((int)(fsam * 0.029f), 0.5f);
     _dif2.init((int)(fsam * 0.023f), 0.5f);
     _dif3.init((int)(fsam * 0.013f), 0.5f);
+    _ntail = _dif1.size() / PERIOD + 2;
 
     _apar[AZIMUTH]._val = 0.0f;
     _apar[AZIMUTH]._min = -0.5f;
@@ -102,13 +141,47 @@ void Asection::set_size(float time)
     }
 }
 
-void Asection::process(float vol, float *W, float *X, float *Y, float *R)
+// A section is bypassed when it is idle: no division has mixed
+// into it for MIXLEN periods, so the mixing buffer is all zeros,
+// and the diffusers and filters have decayed to a silent level.
+// Their state is then cleared, so that the output when the
+// section becomes active again is the same as without bypass.
+//
+void Asection::process(float vol, float *W, float *X, float *Y, float *R, float *D)
 {
     int i;
-    float s, d, g, gw, gr, gx1, gy1, gx2, gy2;
-    float *p, t0, t1, t2, t3;
-    float x[PERIOD];
-    float y[PERIOD];
+    float s, d, g, gw, gv, gr, gx1, gy1, gx2, gy2, ca, sa;
+    float sw, sx, sy, x, y;
+    float *p, *q[16], t0, t1, t2, t3;
+    float r0[PERIOD];
+    float r1[PERIOD];
+    float r2[PERIOD];
+    float r3[PERIOD];
+
+    if (_idle)
+    {
+        if (D)
+            memset(D, 0, PERIOD * sizeof(float));
+        return;
+    }
+
+    // Early reflections. The taps are multiples of PERIOD
+    // so each one is a contiguous block, and the diffusers
+    // are longer than PERIOD, so they can process the whole
+    // block at once.
+    for (i = 0; i < 16; i++)
+        q[i] = _base + _offs[i];
+    for (i = 0; i < PERIOD; i++)
+    {
+        r0[i] = q[1][i] + q[5][i] + q[11][i] + q[15][i];
+        r1[i] = q[0][i] + q[4][i] + q[10][i] + q[14][i];
+        r2[i] = q[2][i] + q[6][i] + q[8][i] + q[12][i];
+        r3[i] = q[3][i] + q[7][i] + q[9][i] + q[13][i];
+    }
+    _dif0.process(PERIOD, r0);
+    _dif1.process(PERIOD, r1);
+    _dif2.process(PERIOD, r2);
+    _dif3.process(PERIOD, r3);
 
     gw = vol * _apar[DIRECT]._val;
     g = 0.45f * _apar[STWIDTH]._val;
@@ -121,8 +194,17 @@ void Asection::process(float vol, float *W, float *X, float *Y, float *R)
     d = g - 0.5f;
     gx2 = gw * (s - d);
     gy2 = gw * (s + d);
+    gv = 0.5f * _apar[REVERB]._val;
+    gr = vol * _apar[REFLECT]._val;
+    g = 6.283184f * _apar[AZIMUTH]._val;
+    ca = cosf(g);
+    sa = sinf(g);
+
+    // Direct sound, reflections and rotation in a single pass.
+    sw = _sw;
+    sx = _sx;
+    sy = _sy;
     p = _base + _offs0;
-    gr = 0.5f * _apar[REVERB]._val;
     for (i = 0; i < PERIOD; i++)
     {
         t0 = p[0 * N];
@@ -131,37 +213,36 @@ void Asection::process(float vol, float *W, float *X, float *Y, float *R)
         t3 = p[3 * N];
         p++;
         s = t0 + t1 + t2 + t3;
-        R[i] += gr * s;
+        R[i] += gv * s;
         W[i] += gw * s;
-        x[i] = gx1 * (t3 + t0) + gx2 * (t2 + t1);
-        y[i] = gy1 * (t3 - t0) + gy2 * (t2 - t1);
-    }
+        x = gx1 * (t3 + t0) + gx2 * (t2 + t1);
+        y = gy1 * (t3 - t0) + gy2 * (t2 - t1);
 
-    gr = vol * _apar[REFLECT]._val;
-    p = _base;
-    for (i = 0; i < PERIOD; i++)
-    {
-        t0 = _dif0.process(p[_offs[1]] + p[_offs[5]] + p[_offs[11]] + p[_offs[15]] + 1e-20f);
-        t1 = _dif1.process(p[_offs[0]] + p[_offs[4]] + p[_offs[10]] + p[_offs[14]] + 1e-20f);
-        t2 = _dif2.process(p[_offs[2]] + p[_offs[6]] + p[_offs[8]] + p[_offs[12]] + 2e-20f);
-        t3 = _dif3.process(p[_offs[3]] + p[_offs[7]] + p[_offs[9]] + p[_offs[13]] + 2e-20f);
-        p++;
+        t0 = r0[i];
+        t1 = r1[i];
+        t2 = r2[i];
+        t3 = r3[i];
         s = t0 + t1 + t2 + t3;
-        _sw += 0.5f * (s - _sw);
-        _sx += 0.5f * (0.4f * (t0 + t3) + 0.6f * (t2 + t1) - _sx);
-        _sy += 0.5f * (0.9f * (t0 - t3) + 0.8f * (t2 - t1) - _sy);
-        W[i] += gr * _sw;
-        x[i] += gr * _sx;
-        y[i] += gr * _sy;
+        sw += 0.5f * (s - sw);
+        sx += 0.5f * (0.4f * (t0 + t3) + 0.6f * (t2 + t1) - sx);
+        sy += 0.5f * (0.9f * (t0 - t3) + 0.8f * (t2 - t1) - sy);
+        W[i] += gr * sw;
+        x += gr * sx;
+        y += gr * sy;
+
+        X[i] += ca * x + sa * y;
+        Y[i] += ca * y - sa * x;
     }
+    _sw = sw;
+    _sx = sx;
+    _sy = sy;
 
-    g = 6.283184f * _apar[AZIMUTH]._val;
-    gx1 = cosf(g);
-    gy1 = sinf(g);
-    for (i = 0; i < PERIOD; i++)
+    // Dry output, the sum of the divisions using this section.
+    if (D)
     {
-        X[i] += gx1 * x[i] + gy1 * y[i];
-        Y[i] += gx1 * y[i] - gy1 * x[i];
+        p = _base + _offs0;
+        for (i = 0; i < PERIOD; i++)
+            D[i] = vol * (p[i] + p[i + N] + p[i + 2 * N] + p[i + 3 * N]);
     }
 
     _offs0 = (_offs0 + PERIOD) & (N - 1);
@@ -172,4 +253,42 @@ void Asection::process(float vol, float *W, float *X, float *Y, float *R)
     memset(p + 1 * N, 0, PERIOD * sizeof(float));
     memset(p + 2 * N, 0, PERIOD * sizeof(float));
     memset(p + 3 * N, 0, PERIOD * sizeof(float));
+
+    if (_hold)
+        _hold--;
+    else
+        detect(r0, r1, r2, r3);
+}
+
+// Called once the mixing buffer is clear. The diffuser outputs
+// and the filters must stay below SILENT for the length of the
+// longest diffuser, after which all their state is below it.
+//
+void Asection::detect(const float *r0, const float *r1, const float *r2, const float *r3)
+{
+    int i;
+    float m;
+
+    m = fabsf(_sw) + fabsf(_sx) + fabsf(_sy);
+    for (i = 0; i < PERIOD; i++)
+    {
+        m = fmaxf(m, fabsf(r0[i]));
+        m = fmaxf(m, fabsf(r1[i]));
+        m = fmaxf(m, fabsf(r2[i]));
+        m = fmaxf(m, fabsf(r3[i]));
+    }
+    if (m > SILENT)
+    {
+        _tail = 0;
+        return;
+    }
+    if (++_tail < _ntail)
+        return;
+    _dif0.reset();
+    _dif1.reset();
+    _dif2.reset();
+    _dif3.reset();
+    _sw = _sx = _sy = 0.0f;
+    _tail = 0;
+    _idle = true;
 }
@@ -27,23 +27,18 @@
 #define MIXLEN 64
 #define NCHANN 4
 
+// Signals below this level, about -140 dB, are taken to be silent
+// when deciding to bypass a section or the reverb.
+#define SILENT 1e-7f
+
 class Diffuser
 {
 public:
     void init(int size, float c);
     void fini(void);
     int size(void) { return _size; }
-    float process(float x)
-    {
-        float w;
-
-        w = x - _c * _data[_i];
-        x = _data[_i] + _c * w;
-        _data[_i] = w;
-        if (++_i == _size)
-            _i = 0;
-        return x;
-    }
+    void process(int n, float *x);
+    void reset(void);
 
 private:
     float *_data;
@@ -60,9 +55,18 @@ public:
 
     float *get_wptr(void) { return _base + _offs0; }
     Fparm *get_apar(void) { return _apar; }
+    bool active(void) const { return !_idle; }
+
+    // Called by a division that mixes into the current period.
+    void touch(void)
+    {
+        _hold = MIXLEN;
+        _tail = 0;
+        _idle = false;
+    }
 
     void set_size(float size);
-    void process(float vol, float *W, float *X, float *Y, float *R);
+    void process(float vol, float *W, float *X, float *Y, float *R, float *D = 0);
 
     static float _refl[16];
 
@@ -76,8 +80,14 @@ private:
         REVERB
     };
 
+    void detect(const float *r0, const float *r1, const float *r2, const float *r3);
+
     int _offs0;
     int _offs[16];
+    int _hold;
+    int _tail;
+    int _ntail;
+    bool _idle;
     float _fsam;
     float *_base;
     float _sw;
@@ -21,23 +21,37 @@
 #include <math.h>
 #include <jack/midiport.h>
 #include "audio.h"
+#include "denormal.h"
 #include "messages.h"
 
-Audio::Audio(const char *name, Lfq_u32 *qnote, Lfq_u32 *qcomm) : A_thread("Audio"),
-                                                                 _appname(name),
-                                                                 _qnote(qnote),
-                                                                 _qcomm(qcomm),
-                                                                 _qmidi(0),
-                                                                 _running(false),
-                                                                 _jack_handle(0),
-                                                                 _abspri(0),
-                                                                 _relpri(0),
-                                                                 _bform(0),
-                                                                 _nplay(0),
-                                                                 _fsamp(0),
-                                                                 _fsize(0),
-                                                                 _nasect(0),
-                                                                 _ndivis(0)
+Audio::Audio(const char *name, Lfq_u32 *qnote, Lfq_u32 *qcomm, Lfq_u32 *qstop) : A_thread("Audio"),
+                                                                                 _appname(name),
+                                                                                 _qnote(qnote),
+                                                                                 _qcomm(qcomm),
+                                                                                 _qstop(qstop),
+                                                                                 _qmidi(0),
+                                                                                 _wmidi(0),
+                                                                                 _running(false),
+                                                                                 _jack_handle(0),
+                                                                                 _next(0),
+                                                                                 _abspri(0),
+                                                                                 _relpri(0),
+                                                                                 _bform(0),
+                                                                                 _nplay(0),
+                                                                                 _ndout(0),
+                                                                                 _norev(false),
+                                                                                 _fsamp(0),
+                                                                                 _fsize(0),
+                                                                                 _nasect(0),
+                                                                                 _ndivis(0),
+                                                                                 _revproc(&_reverb),
+                                                                                 _revthr(0),
+                                                                                 _actions(0),
+                                                                                 _hfill(0),
+                                                                                 _dspload(0),
+                                                                                 _revidle(true),
+                                                                                 _revact(false),
+                                                                                 _revquiet(0)
 {
 }
 
@@ -47,6 +61,14 @@ Audio::~Audio(void)
 
     if (_jack_handle)
         close_jack();
+    if (_revthr)
+    {
+        _revthr->stop();
+        delete _revthr;
+    }
+    if (_revproc != &_reverb)
+        delete _revproc;
+    delete _actions;
     for (i = 0; i < _nasect; i++)
         delete _asectp[i];
     for (i = 0; i < _ndivis; i++)
@@ -59,6 +81,7 @@ void Audio::init_audio(void)
     int i;
 
     _jmidi_pdata = 0;
+    _hmidi = 0;
     _audiopar[VOLUME]._val = 0.32f;
     _audiopar[VOLUME]._min = 0.00f;
     _audiopar[VOLUME]._max = 1.00f;
@@ -72,6 +95,8 @@ void Audio::init_audio(void)
     _audiopar[STPOSIT]._min = -1.0f;
     _audiopar[STPOSIT]._max = 1.0f;
 
+    if (!Denormal::test())
+        fprintf(stderr, "Warning: denormals are not flushed to zero, the DSP load may be high.\n");
     _reverb.init(_fsamp);
     _reverb.set_t60mf(_revtime);
     _reverb.set_t60lo(_revtime * 1.50f, 250.0f);
@@ -94,6 +119,9 @@ void Audio::start(void)
     M->_nasect = _nasect;
     M->_fsamp = _fsamp;
     M->_fsize = _fsize;
+    M->_policy = _policy;
+    M->_relpri = _relpri;
+    M->_revlat = _revthr ? _fsize : 0;
     M->_instrpar = _audiopar;
     for (i = 0; i < _nasect; i++)
         M->_asectpar[i] = _asectp[i]->get_apar();
@@ -111,16 +139,25 @@ void Audio::thr_main(void)
     put_event(EV_EXIT);
 }
 
-void Audio::init_jack(const char *server, bool bform, Lfq_u8 *qmidi)
+// Adds a dry output for each Asection, with the sum of the
+// divisions using it, and/or turns off the reverb. To be used
+// before init_jack(), init_shared() or init_host().
+//
+void Audio::set_direct(bool dout, bool norev)
+{
+    _ndout = dout ? NASECT : 0;
+    _norev = norev;
+}
+
+void Audio::init_jack(const char *server, bool bform, Lfq_u8 *qmidi, Wakeup *wmidi, int revcpu)
 {
-    int i;
     int opts;
     jack_status_t stat;
     struct sched_param spar;
-    const char **p;
 
     _bform = bform;
     _qmidi = qmidi;
+    _wmidi = wmidi;
 
     opts = JackNoStartServer;
     if (server)
@@ -136,56 +173,94 @@ void Audio::init_jack(const char *server, bool bform, Lfq_u8 *qmidi)
     jack_set_process_callback(_jack_handle, jack_static_callback, (void *)this);
     jack_on_shutdown(_jack_handle, jack_static_shutdown, (void *)this);
 
-    if (_bform)
+    _nplay = _bform ? 4 : 2;
+    jack_ports(_jack_handle, 0);
+
+    _fsamp = jack_get_sample_rate(_jack_handle);
+    _fsize = jack_get_buffer_size(_jack_handle);
+    init_audio();
+
+    if (jack_activate(_jack_handle))
     {
-        _nplay = 4;
-        p = _ports_ambis1;
+        fprintf(stderr, "Error: can't activate JACK.");
+        exit(1);
     }
-    else
+
+    pthread_getschedparam(jack_client_thread_id(_jack_handle), &_policy, &spar);
+    _abspri = spar.sched_priority;
+    _relpri = spar.sched_priority - sched_get_priority_max(_policy);
+
+    if ((revcpu >= 0) && !_norev)
     {
-        _nplay = 2;
-        p = _ports_stereo;
+        // Run the reverb on its own thread, at the same priority
+        // as the JACK callback. Only used from the next callback.
+        Revthread *R = new Revthread(_revproc, _fsize, revcpu);
+        if (R->thr_start(_policy, _relpri, 0))
+        {
+            fprintf(stderr, "Warning: can't run reverb thread in RT mode.\n");
+            delete R;
+        }
+        else
+            __atomic_store_n(&_revthr, R, __ATOMIC_RELEASE);
     }
+}
+
+// Gets the name of output i, or of the MIDI input if i is nout().
+//
+void Audio::port_name(int i, const char *prefix, char *s, int size) const
+{
+    char t[16];
+    const char *p;
 
-    for (i = 0; i < _nplay; i++)
+    if (i < _nplay)
+        p = _bform ? _ports_ambis1[i] : _ports_stereo[i];
+    else if (i < nout())
     {
-        _jack_opport[i] = jack_port_register(_jack_handle, p[i], JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        snprintf(t, 16, "sect.%d", i - _nplay + 1);
+        p = t;
+    }
+    else
+        p = "midi_in";
+    if (prefix)
+        snprintf(s, size, "%s/%s", prefix, p);
+    else
+        snprintf(s, size, "%s", p);
+}
+
+// Registers the output ports, and the MIDI input if used.
+//
+void Audio::jack_ports(jack_client_t *client, const char *prefix)
+{
+    int i;
+    char s[256];
+
+    for (i = 0; i < nout(); i++)
+    {
+        port_name(i, prefix, s, 256);
+        _jack_opport[i] = jack_port_register(client, s, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
         if (!_jack_opport[i])
         {
-            fprintf(stderr, "Error: can't create the '%s' jack port\n", p[i]);
+            fprintf(stderr, "Error: can't create the '%s' jack port\n", s);
             exit(1);
         }
     }
 
     if (_qmidi)
     {
-        _jack_midipt = jack_port_register(_jack_handle, "midi_in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+        port_name(i, prefix, s, 256);
+        _jack_midipt = jack_port_register(client, s, JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
         if (!_jack_midipt)
         {
-            fprintf(stderr, "Error: can't create the 'midi_in' jack port\n");
+            fprintf(stderr, "Error: can't create the '%s' jack port\n", s);
             exit(1);
         }
     }
-
-    _fsamp = jack_get_sample_rate(_jack_handle);
-    _fsize = jack_get_buffer_size(_jack_handle);
-    init_audio();
-
-    if (jack_activate(_jack_handle))
-    {
-        fprintf(stderr, "Error: can't activate JACK.");
-        exit(1);
-    }
-
-    pthread_getschedparam(jack_client_thread_id(_jack_handle), &_policy, &spar);
-    _abspri = spar.sched_priority;
-    _relpri = spar.sched_priority - sched_get_priority_max(_policy);
 }
 
 void Audio::close_jack()
 {
     jack_deactivate(_jack_handle);
-    for (int i = 0; i < _nplay; i++)
+    for (int i = 0; i < nout(); i++)
         jack_port_unregister(_jack_handle, _jack_opport[i]);
     jack_client_close(_jack_handle);
 }
@@ -206,37 +281,228 @@ int Audio::jack_static_callback(jack_nframes_t nframes, void *arg)
     return ((Audio *)arg)->jack_callback(nframes);
 }
 
+// Renders this instrument and the ones sharing its JACK client.
+// The load is that of all of them.
+//
 int Audio::jack_callback(jack_nframes_t nframes)
 {
+    Denormal D;
+    struct timespec t0;
+    Audio *A;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (A = this; A; A = __atomic_load_n(&A->_next, __ATOMIC_ACQUIRE))
+        A->jack_render(nframes);
+    set_load(&t0, nframes);
+    return 0;
+}
+
+// A server that changes the period size, as PipeWire does when
+// it runs JACK clients, may use one that is not a multiple of
+// PERIOD. Then the synth output is buffered as for a host. When
+// the size is a multiple again the frames left in the buffer are
+// crossfaded into the start of the cycle, which removes the extra
+// latency and lets the reverb thread be used again.
+//
+void Audio::jack_render(jack_nframes_t nframes)
+{
+    float *outputs[4 + NASECT];
+    float *p, g;
+    int i, j;
+
     proc_queue(_qnote);
     proc_queue(_qcomm);
+    if (_qstop)
+        proc_queue(_qstop);
     proc_stops(); //!@todo Should this only be called when stops change?
-    for (int i = 0; i < _nplay; i++)
-        _outbuf[i] = (float *)(jack_port_get_buffer(_jack_opport[i], nframes));
+    for (i = 0; i < nout(); i++)
+        outputs[i] = (float *)(jack_port_get_buffer(_jack_opport[i], nframes));
     _jmidi_pdata = jack_port_get_buffer(_jack_midipt, nframes);
     _jmidi_count = jack_midi_get_event_count(_jmidi_pdata);
     _jmidi_index = 0;
-    proc_synth(nframes);
+    if (nframes % PERIOD)
+        proc_block(nframes, outputs);
+    else
+    {
+        for (i = 0; i < nout(); i++)
+            _outbuf[i] = outputs[i];
+        proc_synth(nframes, true);
+        for (i = 0; i < nout(); i++)
+        {
+            p = _hbuf[i] + PERIOD - _hfill;
+            for (j = 0; j < _hfill; j++)
+            {
+                g = (j + 1.0f) / (_hfill + 1);
+                outputs[i][j] = g * outputs[i][j] + (1 - g) * p[j];
+            }
+        }
+        _hfill = 0;
+    }
     proc_mesg();
-    return 0;
+}
+
+// Adds an instrument to the JACK client of host, which must have
+// been initialised by init_jack(). The ports are named after this
+// instrument, and it is rendered by the host's callback, so there
+// is no extra thread or context switch. It must be deleted after
+// the host, which closes the client.
+//
+void Audio::init_shared(Audio *host, bool bform, Lfq_u8 *qmidi, Wakeup *wmidi)
+{
+    Audio *A;
+
+    _bform = bform;
+    _qmidi = qmidi;
+    _wmidi = wmidi;
+    _nplay = _bform ? 4 : 2;
+    jack_ports(host->_jack_handle, _appname);
+
+    _fsamp = host->_fsamp;
+    _fsize = host->_fsize;
+    _policy = host->_policy;
+    _abspri = host->_abspri;
+    _relpri = host->_relpri;
+    init_audio();
+
+    for (A = host; A->_next; A = A->_next)
+        ;
+    __atomic_store_n(&A->_next, this, __ATOMIC_RELEASE);
+}
+
+// Prepares for calls to process() by a host instead of JACK.
+// Unless the policy and priority of the host's audio thread are
+// given, the threads started for the model get normal priority.
+//
+void Audio::init_host(unsigned int fsamp, bool bform, Lfq_u8 *qmidi, Wakeup *wmidi, int policy, int relpri)
+{
+    _bform = bform;
+    _qmidi = qmidi;
+    _wmidi = wmidi;
+    _nplay = _bform ? 4 : 2;
+    _fsamp = fsamp;
+    _fsize = PERIOD;
+    _policy = policy;
+    _relpri = relpri;
+    _abspri = (policy == SCHED_OTHER) ? 0 : sched_get_priority_max(policy) + relpri;
+    init_audio();
+}
+
+// Does the work of the JACK callback for a host. The synth runs
+// in periods of PERIOD frames, nframes can be any number: frames
+// left over from the last period are output first, at the cost
+// of up to PERIOD frames of latency if nframes is not a multiple
+// of it. The MIDI events are sorted by time, and are applied at
+// the start of the first period rendered at or after them.
+//
+void Audio::process(int nframes, const Midiev *midi, int nmidi, float **outputs)
+{
+    Denormal D;
+    struct timespec t0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    proc_queue(_qnote);
+    proc_queue(_qcomm);
+    if (_qstop)
+        proc_queue(_qstop);
+    proc_stops();
+    _hmidi = midi;
+    _jmidi_count = nmidi;
+    _jmidi_index = 0;
+    proc_block(nframes, outputs);
+    _hmidi = 0;
+    proc_mesg();
+    set_load(&t0, nframes);
+}
+
+// Renders nframes, any number, in periods of PERIOD frames that
+// are buffered in _hbuf.
+//
+void Audio::proc_block(int nframes, float **outputs)
+{
+    int i, j, k;
+
+    for (i = 0; i < nframes; i += k)
+    {
+        if (!_hfill)
+        {
+            if (_qmidi && proc_jmidi(i + PERIOD))
+                proc_keys();
+            for (j = 0; j < nout(); j++)
+                _outbuf[j] = _hbuf[j];
+            proc_synth(PERIOD);
+            _hfill = PERIOD;
+        }
+        k = (_hfill < nframes - i) ? _hfill : nframes - i;
+        for (j = 0; j < nout(); j++)
+            memcpy(outputs[j] + i, _hbuf[j] + PERIOD - _hfill, k * sizeof(float));
+        _hfill -= k;
+    }
+    // Events after the start of the last period rendered, and all
+    // of a cycle that was served from _hbuf, are applied before the
+    // next one.
+    if (_qmidi && proc_jmidi(nframes))
+        proc_keys();
+}
+
+// Updates the fraction of the period used by the callback, with
+// a fast attack and a slow decay.
+//
+void Audio::set_load(const struct timespec *t0, int nframes)
+{
+    struct timespec t1;
+    float load;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    load = ((t1.tv_sec - t0->tv_sec) + 1e-9f * (t1.tv_nsec - t0->tv_nsec)) * _fsamp / nframes;
+    if (load > _dspload)
+        _dspload = load;
+    else
+        _dspload += 0.01f * (load - _dspload);
+}
+
+// Gets the next MIDI event, from the host or the JACK port.
+//
+bool Audio::midi_event(Midiev *E)
+{
+    jack_midi_event_t J;
+
+    if (_hmidi)
+    {
+        if (_jmidi_index >= _jmidi_count)
+            return false;
+        *E = _hmidi[_jmidi_index];
+        return true;
+    }
+    if (jack_midi_event_get(&J, _jmidi_pdata, _jmidi_index))
+        return false;
+    E->_time = J.time;
+    E->_size = J.size;
+    E->_data = J.buffer;
+    return true;
 }
 
 bool Audio::proc_jmidi(int tmax)
 {
     uint8_t cmd, val1, val2, chan, ctrl_flags;
-    jack_midi_event_t E;
+    Midiev E;
     bool keys_dirty = false;
+    bool wake = false;
 
-    // Read and process MIDI commands from the JACK port.
+    // Read and process MIDI commands from the JACK port or host.
     // Events related to keyboard state are dealt with
     // locally. All the rest is sent as raw MIDI to the
-    // model thread via qmidi.
+    // model thread via qmidi, which is then woken up.
 
-    while ((jack_midi_event_get(&E, _jmidi_pdata, _jmidi_index) == 0) && (E.time < (jack_nframes_t)tmax))
+    while (midi_event(&E) && (E._time < (uint32_t)tmax))
     {
-        cmd = E.buffer[0];
-        val1 = E.buffer[1];
-        val2 = E.buffer[2];
+        if (!E._size)
+        {
+            _jmidi_index++;
+            continue;
+        }
+        cmd = E._data[0];
+        val1 = (E._size > 1) ? E._data[1] : 0;
+        val2 = (E._size > 2) ? E._data[2] : 0;
         chan = cmd & 0x0F;
         ctrl_flags = (_midimap[chan] >> 12) & 7; // Control enabled if (f & 4)
         
@@ -261,6 +527,7 @@ bool Audio::proc_jmidi(int tmax)
                             _qmidi->write(1, val1);
                             _qmidi->write(2, val2);
                             _qmidi->write_commit(3);
+                            wake = true;
                         }
                     }
                 }
@@ -335,6 +602,7 @@ bool Audio::proc_jmidi(int tmax)
                         _qmidi->write(1, val1);
                         _qmidi->write(2, val2);
                         _qmidi->write_commit(3);
+                        wake = true;
                     }
                 }
             case MIDICTL_SWELL:
@@ -349,6 +617,7 @@ bool Audio::proc_jmidi(int tmax)
                         _qmidi->write(1, val1);
                         _qmidi->write(2, val2);
                         _qmidi->write_commit(3);
+                        wake = true;
                     }
                 }
                 break;
@@ -371,6 +640,7 @@ bool Audio::proc_jmidi(int tmax)
                         _qmidi->write(1, val1);
                         _qmidi->write(2, val2);
                         _qmidi->write_commit(3);
+                        wake = true;
                     }
                 }
                 break;
@@ -388,12 +658,15 @@ bool Audio::proc_jmidi(int tmax)
                     _qmidi->write(1, val1);
                     _qmidi->write(2, 0);
                     _qmidi->write_commit(3);
+                    wake = true;
                 }
             }
             break;
         }
         _jmidi_index++;
     }
+    if (wake && _wmidi)
+        _wmidi->post();
     return keys_dirty;
 }
 
@@ -408,7 +681,8 @@ void Audio::proc_queue(Lfq_u32 *Q)
     } u;
 
     // Execute commands from the model thread (qcomm),
-    // or from the midi thread (qnote).
+    // from the midi thread (qnote), or stop changes
+    // from the OSC thread (qstop).
 
     int n = Q->read_avail();
     while (n > 0)
@@ -434,29 +708,11 @@ void Audio::proc_queue(Lfq_u32 *Q)
             break;
 
         case 4:
-            // Clear bits in division mask.
-            _divisp[val2]->clr_div_mask(val3);
-            Q->read_commit(1);
-            proc_stops();
-            break;
-
         case 5:
-            // Set bit in division mask.
-            _divisp[val2]->set_div_mask(val3);
-            Q->read_commit(1);
-            proc_stops();
-            break;
-
         case 6:
-            // Clear bit in rank mask.
-            _divisp[val2]->clr_rank_mask(val1, val3);
-            Q->read_commit(1);
-            proc_stops();
-            break;
-
         case 7:
-            // Set bit in rank mask.
-            _divisp[val2]->set_rank_mask(val1, val3);
+            // Division or rank mask change.
+            proc_action(event);
             Q->read_commit(1);
             proc_stops();
             break;
@@ -475,10 +731,7 @@ void Audio::proc_queue(Lfq_u32 *Q)
 
         case 16:
             // Tremulant on/off.
-            if (val3)
-                _divisp[val2]->trem_on();
-            else
-                _divisp[val2]->trem_off();
+            proc_action(event);
             Q->read_commit(1);
             break;
 
@@ -502,6 +755,41 @@ void Audio::proc_queue(Lfq_u32 *Q)
             }
             break;
 
+        case 18:
+        {
+            // Registration snapshot, followed by the bitset of
+            // all stops, and if bit 0 of val1 is set by the bitset
+            // of the stops that change. The size is in the low 16
+            // bits. Wait for all of it, and for the action words
+            // of the generation in the other bits of val1, which
+            // come as a message. A snapshot for an older table,
+            // made before a reload, is dropped.
+            int w = event & 0xFFFF;
+            int m = (val1 & 1) ? 2 * w : w;
+            int g = ((val1 >> 1) - (_actions ? _actions->_gen : 0)) & 127;
+
+            if ((n < m + 1) || !_actions || ((g > 0) && (g < 64)))
+                return;
+            if (!g)
+                proc_regist(Q, w, val1 & 1);
+            Q->read_commit(m + 1);
+            proc_stops();
+            break;
+        }
+
+        case 19:
+            // Reset a division for a reloaded instrument, the
+            // second word has the number of ranks and the
+            // keyboard. Sent through qcomm so it comes after
+            // any stop changes made before.
+            if (n < 2)
+                return;
+            u.i = Q->read(1);
+            Q->read_commit(2);
+            _divisp[val2]->reset(_asectp[val3], (int16_t)(u.i & 0xFFFF), u.i >> 16);
+            proc_stops();
+            break;
+
         default:
             Q->read_commit(1);
         }
@@ -509,6 +797,75 @@ void Audio::proc_queue(Lfq_u32 *Q)
     }
 }
 
+// Executes a stop action word.
+//
+void Audio::proc_action(uint32_t event)
+{
+    int val1 = (event >> 16) & 255;
+    int val2 = (event >> 8) & 255;
+    int val3 = event & 255;
+
+    switch (event >> 24)
+    {
+    case 4:
+        // Clear bits in division mask.
+        _divisp[val2]->clr_div_mask(val3);
+        break;
+
+    case 5:
+        // Set bits in division mask.
+        _divisp[val2]->set_div_mask(val3);
+        break;
+
+    case 6:
+        // Clear bits in rank mask.
+        _divisp[val2]->clr_rank_mask(val1, val3);
+        break;
+
+    case 7:
+        // Set bits in rank mask.
+        _divisp[val2]->set_rank_mask(val1, val3);
+        break;
+
+    case 16:
+        // Tremulant on/off.
+        if (val3)
+            _divisp[val2]->trem_on();
+        else
+            _divisp[val2]->trem_off();
+        break;
+    }
+}
+
+// Sets the state of all stops from the nword words of a snapshot
+// in Q, or if diff is set only that of the stops in the second
+// set of nword words. The actions of the stops that are off are
+// done first, so on a full snapshot a mask bit shared by several
+// stops ends up set if any of them is on. Unused bits have no
+// actions.
+//
+void Audio::proc_regist(Lfq_u32 *Q, int nword, bool diff)
+{
+    int i, k, n, s;
+    uint32_t d, m;
+
+    n = (nword < _actions->_nword) ? nword : _actions->_nword;
+    for (s = 0; s < 2; s++)
+    {
+        for (k = 0; k < n; k++)
+        {
+            d = Q->read(k + 1);
+            m = diff ? Q->read(nword + k + 1) : ~0u;
+            m &= s ? d : ~d;
+            for (i = 0; m; i++, m >>= 1)
+            {
+                if (m & 1)
+                    proc_action(_actions->_action[32 * k + i][s]);
+            }
+        }
+    }
+}
+
 void Audio::proc_keys(void)
 {
     for (int key = 0; key < NNOTES; ++key)
@@ -537,15 +894,18 @@ void Audio::proc_stops(void)
     }
 }
 
-void Audio::proc_synth(int nframes)
+void Audio::proc_synth(int nframes, bool midi)
 {
     int j, k;
+    bool act, rin, trig;
     float W[PERIOD];
     float X[PERIOD];
     float Y[PERIOD];
     float Z[PERIOD];
     float R[PERIOD];
     float *out[8];
+    const float *rev[4];
+    Revthread *T;
 
     if (fabsf(_revsize - _audiopar[REVSIZE]._val) > 0.001f)
     {
@@ -562,13 +922,35 @@ void Audio::proc_synth(int nframes)
         _reverb.set_t60hi(_revtime * 0.50f, 3e3f);
     }
 
-    for (j = 0; j < _nplay; j++)
+    // If the reverb runs on its own thread, start it on the
+    // input collected in the previous cycle, unless it is idle.
+    // The thread is only used for whole cycles of the JACK
+    // callback, which are rendered with midi set. In the block
+    // mode used for hosts and odd cycle sizes its latency of one
+    // cycle would be wrong, and the reverb is run here.
+    T = _norev ? 0 : __atomic_load_n(&_revthr, __ATOMIC_ACQUIRE);
+    if (T && (!midi || (nframes > T->size())))
+    {
+        T->bypass();
+        T = 0;
+    }
+    rin = _revact;
+    trig = false;
+    _revact = false;
+    if (T)
+    {
+        if (_revidle)
+            T->skip(nframes);
+        else
+            trig = T->trigger(nframes, _audiopar[VOLUME]._val);
+    }
+
+    for (j = 0; j < nout(); j++)
         out[j] = _outbuf[j];
     for (k = 0; k < nframes; k += PERIOD)
     {
-        if (_jmidi_pdata)
-            if (proc_jmidi(k + PERIOD))
-                proc_keys();
+        if (midi && proc_jmidi(k + PERIOD))
+            proc_keys();
 
         memset(W, 0, PERIOD * sizeof(float));
         memset(X, 0, PERIOD * sizeof(float));
@@ -576,11 +958,29 @@ void Audio::proc_synth(int nframes)
         memset(Z, 0, PERIOD * sizeof(float));
         memset(R, 0, PERIOD * sizeof(float));
 
+        // Idle sections add nothing, if all of them are idle the
+        // reverb input is zero.
+        act = false;
         for (j = 0; j < _ndivis; j++)
             _divisp[j]->process();
         for (j = 0; j < _nasect; j++)
-            _asectp[j]->process(_audiopar[VOLUME]._val, W, X, Y, R);
-        _reverb.process(PERIOD, _audiopar[VOLUME]._val, R, W, X, Y, Z);
+        {
+            if (_asectp[j]->active())
+                act = true;
+            _asectp[j]->process(_audiopar[VOLUME]._val, W, X, Y, R, _ndout ? out[_nplay + j] : 0);
+        }
+        if (act)
+        {
+            _revidle = false;
+            _revact = true;
+        }
+        if (T)
+            memcpy(T->send() + k, R, PERIOD * sizeof(float));
+        else if (!_norev && !_revidle)
+        {
+            _revproc->process(PERIOD, _audiopar[VOLUME]._val, R, W, X, Y, Z);
+            rev_check(PERIOD, act, W, X, Y, Z);
+        }
 
         if (_bform)
         {
@@ -600,9 +1000,73 @@ void Audio::proc_synth(int nframes)
                 out[1][j] = W[j] + _audiopar[STPOSIT]._val * X[j] - Y[j];
             }
         }
-        for (j = 0; j < _nplay; j++)
+        for (j = 0; j < nout(); j++)
             out[j] += PERIOD;
     }
+
+    if (trig)
+    {
+        // Add the reverb output for the previous cycle.
+        T->wait();
+        for (j = 0; j < 4; j++)
+            rev[j] = T->output(j);
+        rev_check(nframes, rin, rev[0], rev[1], rev[2], rev[3]);
+        if (_bform)
+        {
+            for (j = 0; j < nframes; j++)
+            {
+                _outbuf[0][j] += rev[0][j];
+                _outbuf[1][j] += 1.41 * rev[1][j];
+                _outbuf[2][j] += 1.41 * rev[2][j];
+                _outbuf[3][j] += 1.41 * rev[3][j];
+            }
+        }
+        else
+        {
+            for (j = 0; j < nframes; j++)
+            {
+                _outbuf[0][j] += rev[0][j] + _audiopar[STPOSIT]._val * rev[1][j] + rev[2][j];
+                _outbuf[1][j] += rev[0][j] + _audiopar[STPOSIT]._val * rev[1][j] - rev[2][j];
+            }
+        }
+    }
+}
+
+// Called after the reverb has processed n samples, which are
+// the only content of W, X, Y and Z if there was no input. Once
+// the input has been zero and the output silent for the tail
+// of the reverb it is reset and bypassed.
+//
+void Audio::rev_check(int n, bool input, const float *W, const float *X, const float *Y, const float *Z)
+{
+    int i;
+    float m;
+
+    if (input)
+    {
+        _revquiet = 0;
+        return;
+    }
+    m = 0;
+    for (i = 0; i < n; i++)
+    {
+        m = fmaxf(m, fabsf(W[i]));
+        m = fmaxf(m, fabsf(X[i]));
+        m = fmaxf(m, fabsf(Y[i]));
+        m = fmaxf(m, fabsf(Z[i]));
+    }
+    if (m > SILENT)
+    {
+        _revquiet = 0;
+        return;
+    }
+    _revquiet += n;
+    if (_revquiet >= _revproc->tail())
+    {
+        _revproc->reset();
+        _revquiet = 0;
+        _revidle = true;
+    }
 }
 
 void Audio::proc_mesg(void)
@@ -638,10 +1102,33 @@ void Audio::proc_mesg(void)
             M = 0;
             break;
         }
+        case MT_LOAD_IR:
+        {
+            // Switch reverb engines. The old one is returned
+            // to the model thread to be deleted there. If the
+            // reverb thread is used it is idle at this point.
+            M_load_ir *X = (M_load_ir *)M;
+            X->_old = (_revproc != &_reverb) ? _revproc : 0;
+            _revproc = X->_revproc ? X->_revproc : &_reverb;
+            if (_revthr)
+                _revthr->set_reverb(_revproc);
+            _revidle = false;
+            _revquiet = 0;
+            send_event(TO_MODEL, M);
+            M = 0;
+            break;
+        }
         case MT_AUDIO_SYNC:
             send_event(TO_MODEL, M);
             M = 0;
             break;
+        case MT_IFC_ACTIONS:
+            // The old table, if any, is deleted by the model.
+            if (_actions)
+                send_event(TO_MODEL, _actions);
+            _actions = (M_ifc_actions *)M;
+            M = 0;
+            break;
         }
         if (M)
             M->recover();
@@ -28,21 +28,33 @@
 #include "division.h"
 #include "lfqueue.h"
 #include "reverb.h"
+#include "revthread.h"
+#include "wakeup.h"
 #include "global.h"
 
+class M_ifc_actions;
+
 class Audio : public A_thread
 {
 public:
-    Audio(const char *jname, Lfq_u32 *qnote, Lfq_u32 *qcomm);
+    Audio(const char *jname, Lfq_u32 *qnote, Lfq_u32 *qcomm, Lfq_u32 *qstop = 0);
     virtual ~Audio(void);
-    void init_jack(const char *server, bool bform, Lfq_u8 *qmidi);
+    void set_direct(bool dout, bool norev);
+    void init_jack(const char *server, bool bform, Lfq_u8 *qmidi, Wakeup *wmidi = 0, int revcpu = -1);
+    void init_host(unsigned int fsamp, bool bform, Lfq_u8 *qmidi, Wakeup *wmidi = 0, int policy = SCHED_OTHER, int relpri = 0);
+    void init_shared(Audio *host, bool bform, Lfq_u8 *qmidi, Wakeup *wmidi = 0);
     void start(void);
+    void process(int nframes, const Midiev *midi, int nmidi, float **outputs);
 
     const char *appname(void) const { return _appname; }
     uint16_t *midimap(void) const { return (uint16_t *)_midimap; }
     int policy(void) const { return _policy; }
     int abspri(void) const { return _abspri; }
     int relpri(void) const { return _relpri; }
+    const float *dspload(void) const { return &_dspload; }
+    int nplay(void) const { return _nplay; }
+    int nout(void) const { return _nplay + _ndout; }
+    void port_name(int i, const char *prefix, char *s, int size) const;
 
 private:
     enum
@@ -55,15 +67,23 @@ private:
 
     void init_audio(void);
     void close_jack(void);
+    void jack_ports(jack_client_t *client, const char *prefix);
     virtual void thr_main(void);
     void jack_shutdown(void);
     int jack_callback(jack_nframes_t);
+    void jack_render(jack_nframes_t);
+    bool midi_event(Midiev *E);
     bool proc_jmidi(int);
     void proc_queue(Lfq_u32 *);
-    void proc_synth(int);
+    void proc_action(uint32_t);
+    void proc_regist(Lfq_u32 *Q, int nword, bool diff);
+    void proc_synth(int, bool midi = false);
+    void proc_block(int nframes, float **outputs);
+    void rev_check(int n, bool input, const float *W, const float *X, const float *Y, const float *Z);
     void proc_keys(void);
     void proc_stops(void);
     void proc_mesg(void);
+    void set_load(const struct timespec *t0, int nframes);
 
     /* _keymap is 16-bit flag for each keyboard key:
             bit 0..13 asserted if key pressed on corresponding manual
@@ -123,10 +143,13 @@ private:
     uint16_t _midimap[16];
     Lfq_u32 *_qnote;
     Lfq_u32 *_qcomm;
+    Lfq_u32 *_qstop;
     Lfq_u8 *_qmidi;
+    Wakeup *_wmidi;
     volatile bool _running;
     jack_client_t *_jack_handle;
-    jack_port_t *_jack_opport[8];
+    Audio *_next; // instruments sharing the JACK client
+    jack_port_t *_jack_opport[4 + NASECT];
     jack_port_t *_jack_midipt;
     int _policy;
     int _abspri;
@@ -134,9 +157,12 @@ private:
     int _jmidi_count;
     int _jmidi_index;
     void *_jmidi_pdata;
+    const Midiev *_hmidi;
     bool _hold = false;
     bool _bform;
     int _nplay;
+    int _ndout; // direct outputs, one per Asection
+    bool _norev;
     unsigned int _fsamp;
     unsigned int _fsize;
     int _nasect;
@@ -144,11 +170,20 @@ private:
     Asection *_asectp[NASECT];
     Division *_divisp[NDIVIS];
     Reverb _reverb;
-    float *_outbuf[8];
+    Revproc *_revproc;
+    Revthread *_revthr;
+    M_ifc_actions *_actions;
+    float *_outbuf[4 + NASECT];
+    float _hbuf[4 + NASECT][PERIOD];
+    int _hfill;
     uint16_t _keymap[NNOTES];
     Fparm _audiopar[4];
     float _revsize;
     float _revtime;
+    float _dspload;
+    bool _revidle; // reverb is reset and bypassed
+    bool _revact;  // reverb input in this cycle
+    int _revquiet; // samples of silent reverb output
 
     static const char *_ports_stereo[2];
     static const char *_ports_ambis1[4];
@@ -102,7 +102,8 @@ void Audiowin::setup(M_ifc_init *M)
         S->_label[0] = 0;
         for (j = 0; j < M->_ndivis; j++)
         {
-            if (M->_divisd[j]._asect == i)
+            // Labels that do not fit are left out.
+            if ((M->_divisd[j]._asect == i) && (strlen(S->_label) + strlen(M->_divisd[j]._label) + 4 < sizeof(S->_label)))
             {
                 if (S->_label[0])
                     strcat(S->_label, " + ");
@@ -0,0 +1,661 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include "convrev.h"
+#include "denormal.h"
+
+Fftreal::Fftreal(int n) : _n(n),
+                          _h(n / 2)
+{
+    int i, j, k, m;
+
+    _brev = new int[_h];
+    _cs = new float[_h / 2 + 1];
+    _sn = new float[_h / 2 + 1];
+    _sb = new float[_h / 2 + 1];
+    _wr = new float[_h + 1];
+    _wi = new float[_h + 1];
+    _tr = new float[_h];
+    _ti = new float[_h];
+
+    for (m = 0; (1 << m) < _h; m++)
+        ;
+    for (i = 0; i < _h; i++)
+    {
+        for (j = k = 0; j < m; j++)
+            if (i & (1 << j))
+                k |= 1 << (m - 1 - j);
+        _brev[i] = k;
+    }
+    for (i = 0; i <= _h / 2; i++)
+    {
+        _cs[i] = cos(2 * M_PI * i / _h);
+        _sn[i] = -sin(2 * M_PI * i / _h);
+        _sb[i] = -_sn[i];
+    }
+    for (i = 0; i <= _h; i++)
+    {
+        _wr[i] = cos(2 * M_PI * i / _n);
+        _wi[i] = -sin(2 * M_PI * i / _n);
+    }
+}
+
+Fftreal::~Fftreal(void)
+{
+    delete[] _brev;
+    delete[] _cs;
+    delete[] _sn;
+    delete[] _sb;
+    delete[] _wr;
+    delete[] _wi;
+    delete[] _tr;
+    delete[] _ti;
+}
+
+// Radix-2 complex FFT of size _h, in place on bit-reversed
+// input. The sign of the exponent is given by the sine table.
+//
+void Fftreal::cfft(float *re, float *im, const float *sn)
+{
+    int i, j, k, m, s;
+    float c, d, ar, ai, br, bi;
+
+    for (m = 1; m < _h; m *= 2)
+    {
+        s = _h / (2 * m);
+        for (j = 0; j < m; j++)
+        {
+            c = _cs[j * s];
+            d = sn[j * s];
+            for (i = j; i < _h; i += 2 * m)
+            {
+                k = i + m;
+                ar = re[k] * c - im[k] * d;
+                ai = re[k] * d + im[k] * c;
+                br = re[i];
+                bi = im[i];
+                re[i] = br + ar;
+                im[i] = bi + ai;
+                re[k] = br - ar;
+                im[k] = bi - ai;
+            }
+        }
+    }
+}
+
+void Fftreal::forw(const float *x, float *re, float *im)
+{
+    int i, k;
+    float ar, ai, br, bi;
+
+    for (i = 0; i < _h; i++)
+    {
+        k = _brev[i];
+        _tr[k] = x[2 * i];
+        _ti[k] = x[2 * i + 1];
+    }
+    cfft(_tr, _ti, _sn);
+    re[0] = _tr[0] + _ti[0];
+    im[0] = 0;
+    re[_h] = _tr[0] - _ti[0];
+    im[_h] = 0;
+    for (i = 1; i < _h; i++)
+    {
+        // Even and odd parts, times two.
+        ar = _tr[i] + _tr[_h - i];
+        ai = _ti[i] - _ti[_h - i];
+        br = _ti[i] + _ti[_h - i];
+        bi = _tr[_h - i] - _tr[i];
+        re[i] = 0.5f * (ar + br * _wr[i] - bi * _wi[i]);
+        im[i] = 0.5f * (ai + br * _wi[i] + bi * _wr[i]);
+    }
+}
+
+void Fftreal::back(const float *re, const float *im, float *x)
+{
+    int i, k;
+    float ar, ai, br, bi, cr, ci;
+
+    for (i = 0; i < _h; i++)
+    {
+        ar = re[i] + re[_h - i];
+        ai = im[i] - im[_h - i];
+        br = re[i] - re[_h - i];
+        bi = im[i] + im[_h - i];
+        // Odd part, times the conjugate twiddle factor.
+        cr = br * _wr[i] + bi * _wi[i];
+        ci = bi * _wr[i] - br * _wi[i];
+        k = _brev[i];
+        _tr[k] = ar - ci;
+        _ti[k] = ai + cr;
+    }
+    cfft(_tr, _ti, _sb);
+    for (i = 0; i < _h; i++)
+    {
+        x[2 * i] = _tr[i];
+        x[2 * i + 1] = _ti[i];
+    }
+}
+
+Convlevel::Convlevel(int size, int offs, int npart, int nchan, float **ir, int irlen, bool sync) : _fft(2 * size),
+                                                                                                 _size(size),
+                                                                                                 _nchan(nchan),
+                                                                                                 _npart(npart),
+                                                                                                 _ifdl(0),
+                                                                                                 _ird(0),
+                                                                                                 _sync(sync),
+                                                                                                 _busy(false),
+                                                                                                 _mute(false),
+                                                                                                 _ndrop(0),
+                                                                                                 _nlate(0),
+                                                                                                 _stop(false)
+{
+    int c, i, j, k, n;
+    float g;
+
+    n = size + 1;
+    _inp = new float[2 * size];
+    _inq = new float[size];
+    _tmp = new float[2 * size];
+    _xre = new float[n];
+    _xim = new float[n];
+    _zero = new float[size];
+    memset(_zero, 0, size * sizeof(float));
+    _fre = new float *[npart];
+    _fim = new float *[npart];
+    _hre = new float *[nchan * npart];
+    _him = new float *[nchan * npart];
+    memset(_inp, 0, 2 * size * sizeof(float));
+    memset(_inq, 0, size * sizeof(float));
+    for (i = 0; i < npart; i++)
+    {
+        _fre[i] = new float[n];
+        _fim[i] = new float[n];
+        memset(_fre[i], 0, n * sizeof(float));
+        memset(_fim[i], 0, n * sizeof(float));
+    }
+    for (i = 0; i < 2; i++)
+    {
+        for (c = 0; c < 4; c++)
+        {
+            _out[i][c] = new float[size];
+            memset(_out[i][c], 0, size * sizeof(float));
+        }
+    }
+
+    // Transform the IR partitions, including the
+    // normalisation of the inverse FFT.
+    g = 0.5f / size;
+    for (c = 0; c < nchan; c++)
+    {
+        for (i = 0; i < npart; i++)
+        {
+            memset(_tmp, 0, 2 * size * sizeof(float));
+            k = offs + i * size;
+            for (j = 0; (j < size) && (k + j < irlen); j++)
+                _tmp[j] = g * ir[c][k + j];
+            _hre[c * npart + i] = new float[n];
+            _him[c * npart + i] = new float[n];
+            _fft.forw(_tmp, _hre[c * npart + i], _him[c * npart + i]);
+        }
+    }
+}
+
+Convlevel::~Convlevel(void)
+{
+    int i, c;
+
+    for (i = 0; i < _npart; i++)
+    {
+        delete[] _fre[i];
+        delete[] _fim[i];
+    }
+    for (i = 0; i < _nchan * _npart; i++)
+    {
+        delete[] _hre[i];
+        delete[] _him[i];
+    }
+    for (i = 0; i < 2; i++)
+        for (c = 0; c < 4; c++)
+            delete[] _out[i][c];
+    delete[] _fre;
+    delete[] _fim;
+    delete[] _hre;
+    delete[] _him;
+    delete[] _inp;
+    delete[] _inq;
+    delete[] _tmp;
+    delete[] _xre;
+    delete[] _xim;
+    delete[] _zero;
+}
+
+// Called by the owner when _size new input samples have been
+// written. A synchronous level computes its output immediately,
+// a threaded one makes the result of the previous cycle readable
+// and starts on the new input. If its thread is still busy the
+// new input is dropped and the output muted for this cycle. Once
+// the thread is done, the dropped partitions enter the delay line
+// as silence, so the later ones keep their place in the IR, and
+// the result, which is for an older partition, is not used.
+//
+void Convlevel::cycle(void)
+{
+    int i;
+
+    if (_busy)
+    {
+        if (_done.trywait())
+        {
+            _nlate++;
+            _mute = true;
+            if (_ndrop < _npart)
+                _ndrop++;
+            return;
+        }
+        _busy = false;
+    }
+    if (!_sync)
+    {
+        _ird ^= 1;
+        _mute = (_ndrop > 0);
+    }
+    if (_ndrop)
+    {
+        memset(_inp, 0, _size * sizeof(float));
+        for (i = 0; i < _ndrop; i++)
+        {
+            memset(_fre[_ifdl], 0, (_size + 1) * sizeof(float));
+            memset(_fim[_ifdl], 0, (_size + 1) * sizeof(float));
+            if (++_ifdl == _npart)
+                _ifdl = 0;
+        }
+        _ndrop = 0;
+    }
+    memcpy(_inp + _size, _inq, _size * sizeof(float));
+    if (_sync)
+    {
+        process();
+        _ird ^= 1;
+    }
+    else
+    {
+        _busy = true;
+        _trig.post();
+    }
+}
+
+void Convlevel::process(void)
+{
+    int c, i, j, k, n;
+    float *fr, *fi, *hr, *hi, **out;
+
+    n = _size + 1;
+    _fft.forw(_inp, _fre[_ifdl], _fim[_ifdl]);
+    memcpy(_inp, _inp + _size, _size * sizeof(float));
+    out = _out[_ird ^ 1];
+    for (c = 0; c < _nchan; c++)
+    {
+        memset(_xre, 0, n * sizeof(float));
+        memset(_xim, 0, n * sizeof(float));
+        k = _ifdl;
+        for (i = 0; i < _npart; i++)
+        {
+            fr = _fre[k];
+            fi = _fim[k];
+            hr = _hre[c * _npart + i];
+            hi = _him[c * _npart + i];
+            for (j = 0; j < n; j++)
+            {
+                _xre[j] += fr[j] * hr[j] - fi[j] * hi[j];
+                _xim[j] += fr[j] * hi[j] + fi[j] * hr[j];
+            }
+            if (--k < 0)
+                k += _npart;
+        }
+        _fft.back(_xre, _xim, _tmp);
+        memcpy(out[c], _tmp + _size, _size * sizeof(float));
+    }
+    if (++_ifdl == _npart)
+        _ifdl = 0;
+}
+
+// Called when the level is no longer used by the audio thread.
+//
+void Convlevel::stop(void)
+{
+    if (_busy)
+        _done.wait();
+    _stop = true;
+    _trig.post();
+    _done.wait();
+}
+
+void Convlevel::thr_main(void)
+{
+    Denormal D;
+
+    while (true)
+    {
+        _trig.wait();
+        if (_stop)
+            break;
+        process();
+        _done.post();
+    }
+    _done.post();
+}
+
+// Reads a RIFF/WAVE file with 16, 24 or 32 bit integer or 32 bit
+// float samples. Returns the interleaved samples in *data.
+//
+static int read_wav(const char *path, int *nchan, int *nfram, int *rate, float **data)
+{
+    FILE *F;
+    uint8_t h[40], *d;
+    uint32_t size;
+    int i, n, form, bits, bps;
+    float *p;
+
+    if (!(F = fopen(path, "r")))
+    {
+        fprintf(stderr, "Can't open '%s' for reading\n", path);
+        return 1;
+    }
+    if ((fread(h, 1, 12, F) != 12) || memcmp(h, "RIFF", 4) || memcmp(h + 8, "WAVE", 4))
+    {
+        fprintf(stderr, "File '%s' is not a WAVE file\n", path);
+        fclose(F);
+        return 1;
+    }
+    form = bits = 0;
+    while (fread(h, 1, 8, F) == 8)
+    {
+        size = h[4] | (h[5] << 8) | (h[6] << 16) | ((uint32_t)h[7] << 24);
+        if (!memcmp(h, "fmt ", 4) && (size >= 16) && (size <= 40))
+        {
+            if (fread(h, 1, size, F) != size)
+                break;
+            form = h[0] | (h[1] << 8);
+            if (form == 0xFFFE && size >= 26)
+                form = h[24] | (h[25] << 8);
+            *nchan = h[2] | (h[3] << 8);
+            *rate = h[4] | (h[5] << 8) | (h[6] << 16) | (h[7] << 24);
+            bits = h[14] | (h[15] << 8);
+            if (size & 1)
+                fseek(F, 1, SEEK_CUR);
+        }
+        else if (!memcmp(h, "data", 4) && bits)
+        {
+            if (!((form == 1 && (bits == 16 || bits == 24 || bits == 32)) || (form == 3 && bits == 32)) || (*nchan < 1))
+            {
+                fprintf(stderr, "File '%s' has an unsupported sample format\n", path);
+                fclose(F);
+                return 1;
+            }
+            bps = bits / 8;
+            n = size / (bps * *nchan);
+            d = new uint8_t[n * *nchan * bps];
+            n = fread(d, bps * *nchan, n, F);
+            fclose(F);
+            *nfram = n;
+            *data = p = new float[n * *nchan];
+            for (i = 0; i < n * *nchan; i++)
+            {
+                const uint8_t *q = d + i * bps;
+                if (form == 3)
+                    memcpy(p + i, q, 4);
+                else if (bits == 16)
+                    p[i] = (int16_t)(q[0] | (q[1] << 8)) / 32768.0f;
+                else if (bits == 24)
+                    p[i] = (int32_t)((q[0] << 8) | (q[1] << 16) | ((uint32_t)q[2] << 24)) / 2147483648.0f;
+                else
+                    p[i] = (int32_t)(q[0] | (q[1] << 8) | (q[2] << 16) | ((uint32_t)q[3] << 24)) / 2147483648.0f;
+            }
+            delete[] d;
+            return 0;
+        }
+        else
+            fseek(F, size + (size & 1), SEEK_CUR);
+    }
+    fprintf(stderr, "File '%s' has no audio data\n", path);
+    fclose(F);
+    return 1;
+}
+
+Convrev::Convrev(void) : _ilat(0),
+                         _trim(0),
+                         _delay(0),
+                         _dmask(0),
+                         _dwr(0),
+                         _dbuf(0),
+                         _nchan(0),
+                         _nlev(0),
+                         _nrun(1),
+                         _k(0),
+                         _tail(0)
+{
+}
+
+Convrev::~Convrev(void)
+{
+    int i, n;
+
+    for (i = n = 0; i < _nlev; i++)
+    {
+        if (i && (i < _nrun))
+            _levs[i]->stop();
+        n += _levs[i]->nlate();
+        delete _levs[i];
+    }
+    if (n)
+        fprintf(stderr, "Warning: convolution threads were late %d times.\n", n);
+    delete[] _dbuf;
+}
+
+// Sets the latency of the thread the reverb runs on, which the
+// input delay makes up for as far as there is leading silence.
+// Called with the reverb idle.
+//
+void Convrev::set_latency(int lat)
+{
+    _ilat = lat;
+    _delay = (_trim > _ilat) ? _trim - _ilat : 0;
+}
+
+// Loads the IR and prepares all partitions. The first level uses
+// partitions of one period and covers the IR up to twice the size
+// of the second one, which is at least one JACK period. Each next
+// level has eight times larger partitions. Up to MAXTRIM samples
+// of leading silence are removed, and replaced by the input delay.
+//
+int Convrev::load(const char *path, float rate, int fsize)
+{
+    int i, c, k, n, nch, nfr, fs, size, offs, next, npart;
+    float *data, *ir[4], p, e;
+
+    if (read_wav(path, &nch, &nfr, &fs, &data))
+        return 1;
+    if (fs != (int)rate)
+    {
+        fprintf(stderr, "Sample rate of '%s' is %d, expected %d\n", path, fs, (int)rate);
+        delete[] data;
+        return 1;
+    }
+    if ((nch != 1) && (nch != 2) && (nch != 4))
+    {
+        fprintf(stderr, "File '%s' has %d channels, expected 1, 2 or 4\n", path, nch);
+        delete[] data;
+        return 1;
+    }
+    if (nfr > 20 * fs)
+        nfr = 20 * fs;
+
+    // Find the leading silence.
+    p = 0;
+    for (i = 0; i < nfr * nch; i++)
+        if (fabsf(data[i]) > p)
+            p = fabsf(data[i]);
+    for (k = 0; (k < MAXTRIM) && (k < nfr); k++)
+    {
+        for (c = 0; c < nch; c++)
+            if (fabsf(data[k * nch + c]) > 1e-3f * p)
+                break;
+        if (c < nch)
+            break;
+    }
+    n = nfr - k;
+    if (n <= 0)
+    {
+        fprintf(stderr, "File '%s' is silent\n", path);
+        delete[] data;
+        return 1;
+    }
+
+    // Convert to B-format channels.
+    _nchan = (nch == 2) ? 2 : nch;
+    for (c = 0; c < _nchan; c++)
+        ir[c] = new float[n];
+    for (i = 0; i < n; i++)
+    {
+        const float *q = data + (i + k) * nch;
+        if (nch == 2)
+        {
+            ir[0][i] = 0.5f * (q[0] + q[1]);
+            ir[1][i] = 0.5f * (q[0] - q[1]);
+        }
+        else
+        {
+            for (c = 0; c < nch; c++)
+                ir[c][i] = q[c];
+        }
+    }
+    delete[] data;
+    if (nch == 2)
+    {
+        _chmap[0] = 0;
+        _chmap[1] = 2;
+    }
+    else
+    {
+        for (c = 0; c < 4; c++)
+            _chmap[c] = c;
+    }
+
+    // Normalise to unit energy.
+    e = 0;
+    for (c = 0; c < _nchan; c++)
+        for (i = 0; i < n; i++)
+            e += ir[c][i] * ir[c][i];
+    if (e > 0)
+    {
+        e = 1 / sqrtf(e);
+        for (c = 0; c < _nchan; c++)
+            for (i = 0; i < n; i++)
+                ir[c][i] *= e;
+    }
+
+    for (size = 512; size < fsize; size *= 2)
+        ;
+    next = (2 * size < n) ? 2 * size : n;
+    _levs[0] = new Convlevel(PERIOD, 0, (next + PERIOD - 1) / PERIOD, _nchan, ir, n, true);
+    _nlev = 1;
+    offs = next;
+    while (offs < n)
+    {
+        next = ((_nlev < MAXLEV - 1) && (size < 16384)) ? 16 * size : n;
+        if (next > n)
+            next = n;
+        npart = (next - offs + size - 1) / size;
+        _levs[_nlev++] = new Convlevel(size, offs, npart, _nchan, ir, n, false);
+        offs = next;
+        size *= 8;
+    }
+    // The input delay, with room for a period.
+    _trim = k;
+    for (i = PERIOD; i < _trim + PERIOD; i *= 2)
+        ;
+    _dmask = i - 1;
+    _dbuf = new float[i];
+    memset(_dbuf, 0, i * sizeof(float));
+    set_latency(_ilat);
+    // With zero input the output is exactly zero once the input
+    // has passed through the delay, the IR and the largest level's
+    // buffers.
+    _tail = _trim + n + 2 * _levs[_nlev - 1]->size();
+    for (c = 0; c < _nchan; c++)
+        delete[] ir[c];
+    printf("Loaded '%s', %d channels, %.2lf seconds, %d levels\n", path, nch, n / rate, _nlev);
+    return 0;
+}
+
+// Starts the threads of the larger levels, at decreasing
+// priorities below that of the audio thread.
+//
+int Convrev::start(int policy, int relpri)
+{
+    for (_nrun = 1; _nrun < _nlev; _nrun++)
+    {
+        if (_levs[_nrun]->thr_start(policy, relpri - _nrun, 0))
+        {
+            fprintf(stderr, "Warning: can't run convolution thread in RT mode.\n");
+            if (_levs[_nrun]->thr_start(SCHED_OTHER, 0, 0))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+void Convrev::process(int n, float gain, float *R, float *W, float *X, float *Y, float *Z)
+{
+    int c, i, j, k, p;
+    float *out[4] = {W, X, Y, Z};
+    float *q;
+    const float *y;
+    Convlevel *L;
+
+    for (k = 0; k < n; k += PERIOD)
+    {
+        memcpy(_dbuf + _dwr, R + k, PERIOD * sizeof(float));
+        for (j = 0; j < PERIOD; j++)
+            _dinp[j] = _dbuf[(_dwr + j - _delay) & _dmask];
+        _dwr = (_dwr + PERIOD) & _dmask;
+        for (i = 0; i < _nlev; i++)
+        {
+            L = _levs[i];
+            p = _k & (L->size() - 1);
+            L->input(p, _dinp);
+            if (L->sync())
+                L->cycle();
+            for (c = 0; c < _nchan; c++)
+            {
+                q = out[_chmap[c]] + k;
+                y = L->output(c) + p;
+                for (j = 0; j < PERIOD; j++)
+                    q[j] += gain * y[j];
+            }
+            if (!L->sync() && (p + PERIOD == L->size()))
+                L->cycle();
+        }
+        _k += PERIOD;
+    }
+}
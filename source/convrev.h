@@ -0,0 +1,154 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+#ifndef __CONVREV_H
+#define __CONVREV_H
+
+#include <string.h>
+#include <clthreads.h>
+#include "reverb.h"
+#include "asection.h"
+
+// Real FFT of size n (a power of two), computed as a complex FFT
+// of size n / 2. Spectra are stored as n / 2 + 1 bins, with real
+// and imaginary parts in separate arrays. The inverse transform
+// is not normalised, it returns n times the original signal.
+//
+class Fftreal
+{
+public:
+    Fftreal(int n);
+    ~Fftreal(void);
+
+    void forw(const float *x, float *re, float *im);
+    void back(const float *re, const float *im, float *x);
+
+private:
+    void cfft(float *re, float *im, const float *sn);
+
+    int _n;
+    int _h;
+    int *_brev;
+    float *_cs;
+    float *_sn;
+    float *_sb;
+    float *_wr;
+    float *_wi;
+    float *_tr;
+    float *_ti;
+};
+
+// One partition size of the convolution. The impulse response
+// segment starting at _offs is split into _npart partitions of
+// _size samples, using overlap-save with an FFT of twice that size.
+// The smallest level runs in the audio thread. Larger ones run
+// on their own thread and have their result ready two partitions
+// later, which is compensated for by their offset in the IR. The
+// audio thread never waits for them: if one is late its input is
+// replaced by silence and its output is muted until it catches up.
+//
+class Convlevel : public P_thread
+{
+public:
+    Convlevel(int size, int offs, int npart, int nchan, float **ir, int irlen, bool sync);
+    virtual ~Convlevel(void);
+
+    int size(void) const { return _size; }
+    bool sync(void) const { return _sync; }
+    void input(int k, const float *x) { memcpy(_inq + k, x, PERIOD * sizeof(float)); }
+    const float *output(int c) const { return _mute ? _zero : _out[_ird][c]; }
+    int nlate(void) const { return _nlate; }
+    void process(void);
+    void cycle(void);
+    void stop(void);
+
+private:
+    virtual void thr_main(void);
+
+    Fftreal _fft;
+    int _size;
+    int _nchan;
+    int _npart;
+    int _ifdl;
+    int _ird;
+    bool _sync;
+    bool _busy;
+    bool _mute;
+    int _ndrop;
+    int _nlate;
+    volatile bool _stop;
+    P_sema _trig;
+    P_sema _done;
+    float *_inp;
+    float *_inq;
+    float *_tmp;
+    float *_xre;
+    float *_xim;
+    float *_zero;
+    float **_fre;
+    float **_fim;
+    float **_hre;
+    float **_him;
+    float *_out[2][4];
+};
+
+// Convolution reverb using a measured impulse response, which
+// can replace the FDN reverb. A mono IR is used for W only, a
+// stereo one is converted to W and Y, and a four channel one is
+// taken to be B-format (W, X, Y, Z). Leading silence is removed
+// from the IR and replaced by a delay of the input, which is made
+// shorter by the latency of the thread the reverb runs on, if any.
+//
+class Convrev : public Revproc
+{
+public:
+    Convrev(void);
+    virtual ~Convrev(void);
+
+    int load(const char *path, float rate, int fsize);
+    int start(int policy, int relpri);
+
+    virtual void process(int n, float gain, float *R, float *W, float *X, float *Y, float *Z);
+    virtual void set_latency(int lat);
+    virtual int tail(void) const { return _tail; }
+
+    enum
+    {
+        MAXLEV = 5,
+        MAXTRIM = 8192
+    };
+
+private:
+    int _ilat;
+    int _trim;
+    int _delay;
+    int _dmask;
+    int _dwr;
+    float *_dbuf;
+    float _dinp[PERIOD];
+    int _nchan;
+    int _chmap[4];
+    int _nlev;
+    int _nrun;
+    int _k;
+    int _tail;
+    Convlevel *_levs[MAXLEV];
+};
+
+#endif
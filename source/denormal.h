@@ -0,0 +1,95 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __DENORMAL_H
+#define __DENORMAL_H
+
+#include <stdint.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+// Sets the FPU of the calling thread to flush denormal results
+// and inputs to zero for the lifetime of the object, and restores
+// the previous mode when it is destroyed. A decaying signal in
+// the feedback loops of the reverb and diffusers would otherwise
+// end up as denormals, which are very slow on most CPUs. Used on
+// entry of the audio callbacks and in the reverb threads.
+//
+class Denormal
+{
+public:
+    Denormal(void) : _save(get()) { set(_save | FLAGS); }
+    ~Denormal(void) { set(_save); }
+
+    // Returns true if denormals are flushed on this CPU.
+    static bool test(void)
+    {
+        Denormal D;
+        volatile float a = 1e-30f;
+        volatile float b = 1e-40f;
+        volatile float x = a * 1e-10f;
+        volatile float y = b * 1e10f;
+        return (x == 0.0f) && (y == 0.0f);
+    }
+
+private:
+#if defined(__SSE__)
+    // MXCSR flush to zero and denormals are zero.
+    typedef uint32_t csr_t;
+    enum { FLAGS = 0x8040 };
+    static csr_t get(void) { return _mm_getcsr(); }
+    static void set(csr_t v) { _mm_setcsr(v); }
+#elif defined(__aarch64__)
+    // FPCR flush to zero, for inputs and results.
+    typedef uint64_t csr_t;
+    enum { FLAGS = 1 << 24 };
+    static csr_t get(void)
+    {
+        csr_t v;
+        __asm__ __volatile__("mrs %0, fpcr" : "=r"(v));
+        return v;
+    }
+    static void set(csr_t v) { __asm__ __volatile__("msr fpcr, %0" : : "r"(v)); }
+#elif defined(__arm__) && defined(__ARM_FP)
+    // FPSCR flush to zero, for inputs and results.
+    typedef uint32_t csr_t;
+    enum { FLAGS = 1 << 24 };
+    static csr_t get(void)
+    {
+        csr_t v;
+        __asm__ __volatile__("vmrs %0, fpscr" : "=r"(v));
+        return v;
+    }
+    static void set(csr_t v) { __asm__ __volatile__("vmsr fpscr, %0" : : "r"(v)); }
+#else
+    typedef uint32_t csr_t;
+    enum { FLAGS = 0 };
+    static csr_t get(void) { return 0; }
+    static void set(csr_t) {}
+#endif
+
+    Denormal(const Denormal &);
+    Denormal &operator=(const Denormal &);
+
+    csr_t _save;
+};
+
+#endif
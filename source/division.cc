@@ -45,12 +45,24 @@ Division::~Division(void)
 void Division::process(void)
 {
     int i;
+    bool act;
     float d, g, t;
     float *p, *q;
 
-    memset(_buff, 0, NCHANN * PERIOD * sizeof(float));
+    // Only ranks with sounding pipes are played. If there are
+    // none the buffer would be all zeros, and the mixing into
+    // the section is skipped, but the gain is still updated.
+    act = false;
     for (i = 0; i < _nrank; i++)
-        _ranks[i]->play(1);
+    {
+        if (_ranks[i]->active())
+        {
+            if (!act)
+                memset(_buff, 0, NCHANN * PERIOD * sizeof(float));
+            act = true;
+            _ranks[i]->play(1);
+        }
+    }
 
     g = _swel;
     if (_trem)
@@ -78,8 +90,18 @@ void Division::process(void)
 
     d = (g - _gain) / PERIOD;
     g = _gain;
+    if (!act)
+    {
+        // Same rounding as in the mixing loop.
+        for (i = 0; i < PERIOD; i++)
+            g += d;
+        _gain = g;
+        return;
+    }
+
     p = _buff;
     q = _asect->get_wptr();
+    _asect->touch();
 
     for (i = 0; i < PERIOD; i++)
     {
@@ -208,6 +230,8 @@ void Division::set_rank_mask(int ind, int bit)
 {
     uint16_t b = 1 << bit;
     Rankwave *W = _ranks[ind];
+    if (!W)
+        return;
     if (bit == NKEYBD) {
         b |= _dmask;
         W->_nmask |= 128;
@@ -220,6 +244,8 @@ void Division::clr_rank_mask(int ind, int bit)
 {
     uint16_t b = 1 << bit;
     Rankwave *W = _ranks[ind];
+    if (!W)
+        return;
     if (bit == NKEYBD) {
         b |= _dmask;
         W->_nmask &= ~128;
@@ -231,3 +257,28 @@ void Division::clr_rank_mask(int ind, int bit)
     else
         W->_nmask &= ~128;
 }
+
+// Prepare the division for a reloaded instrument definition.
+// All stops are cleared and the ranks from nrank on deleted,
+// the others are kept until they are replaced by set_rank().
+//
+void Division::reset(Asection *asect, int keybd, int nrank)
+{
+    int r;
+
+    _asect = asect;
+    while (_nrank > nrank)
+    {
+        _nrank--;
+        delete _ranks[_nrank];
+        _ranks[_nrank] = 0;
+    }
+    for (r = 0; r < _nrank; r++)
+    {
+        if (_ranks[r])
+            _ranks[r]->_nmask = KMAP_SET;
+    }
+    _dmask = (keybd >= 0) ? (1 << keybd) : 0;
+    if (_trem)
+        _trem = 2;
+}
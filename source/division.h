@@ -41,6 +41,7 @@ public:
     void trem_on(void) { _trem = 1; }
     void trem_off(void) { _trem = 2; }
     void set_reverb(float val);
+    void reset(Asection *asect, int keybd, int nrank);
 
     void process(void);
     void update_keys(uint8_t key, uint8_t flags);
@@ -0,0 +1,225 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include "engine.h"
+#include "audio.h"
+#include "model.h"
+#include "slave.h"
+#include "wakeup.h"
+#include "iface.h"
+
+Engine::Engine(const char *name, const char *stops, const char *instr, const char *waves, bool uhome, const char *irfile, bool prmem) : _name(name),
+                                                                                                                                      _stops(stops),
+                                                                                                                                      _instr(instr),
+                                                                                                                                      _waves(waves),
+                                                                                                                                      _uhome(uhome),
+                                                                                                                                      _irfile(irfile),
+                                                                                                                                      _prmem(prmem),
+                                                                                                                                      _nthr(0),
+                                                                                                                                      _qnote(256),
+                                                                                                                                      _qcomm(4096),
+                                                                                                                                      _qmidi(1024),
+                                                                                                                                      _audio(0),
+                                                                                                                                      _model(0),
+                                                                                                                                      _slave(0),
+                                                                                                                                      _wmidi(0),
+                                                                                                                                      _iface(0)
+{
+}
+
+Engine::~Engine(void)
+{
+    stop();
+}
+
+// Creates the synth for sample rate fsamp and starts the model,
+// which loads the instrument. Until it is ready process() only
+// outputs silence.
+//
+int Engine::start(unsigned int fsamp, bool bform, Iface *iface, bool work)
+{
+    if (_audio)
+        return 1;
+
+    _audio = new Audio(_name, &_qnote, &_qcomm);
+    _wmidi = new Wakeup();
+    _audio->init_host(fsamp, bform, &_qmidi, _wmidi);
+    _model = new Model(&_qcomm, &_qmidi, _audio->midimap(), _audio->appname(), _stops, _instr, _waves, _uhome, _irfile, _prmem);
+    _slave = new Slave();
+    _iface = iface;
+
+    ITC_ctrl::connect(_audio, TO_MODEL, _model, FM_AUDIO);
+    ITC_ctrl::connect(_model, EV_EXIT, this, EV_EXIT);
+    ITC_ctrl::connect(_model, TO_AUDIO, _audio, FM_MODEL);
+    ITC_ctrl::connect(_slave, TO_AUDIO, _audio, FM_SLAVE);
+    ITC_ctrl::connect(_slave, TO_MODEL, _model, FM_SLAVE);
+    ITC_ctrl::connect(this, TO_MODEL, _model, FM_IFACE);
+    _nthr = 1;
+    if (work)
+        ITC_ctrl::connect(_model, TO_SLAVE, this, FM_MODEL);
+    else
+    {
+        ITC_ctrl::connect(_model, TO_SLAVE, _slave, FM_MODEL);
+        ITC_ctrl::connect(_slave, EV_EXIT, this, EV_EXIT);
+        _nthr++;
+    }
+    if (_iface)
+    {
+        ITC_ctrl::connect(_model, TO_IFACE, _iface, FM_MODEL);
+        ITC_ctrl::connect(_iface, EV_EXIT, this, EV_EXIT);
+        ITC_ctrl::connect(_iface, TO_MODEL, _model, FM_IFACE);
+        _nthr++;
+    }
+
+    _audio->start();
+    _model->thr_start(SCHED_OTHER, 0, 0);
+    _wmidi->start(_model, EV_QMIDI, SCHED_OTHER, 0);
+    if (!work)
+        _slave->thr_start(SCHED_OTHER, 0, 0);
+    if (_iface)
+        _iface->thr_start(SCHED_OTHER, 0, 0);
+    return 0;
+}
+
+// Stops the threads and deletes the synth. The host must no
+// longer call process(). The Iface, if any, is stopped but not
+// deleted.
+//
+void Engine::stop(void)
+{
+    if (!_audio)
+        return;
+
+    _model->terminate();
+    _slave->terminate();
+    if (_iface)
+        _iface->terminate();
+    while (_nthr--)
+        get_event(1 << EV_EXIT);
+
+    _wmidi->stop();
+    delete _audio;
+    delete _model;
+    delete _slave;
+    delete _wmidi;
+    _audio = 0;
+    _model = 0;
+    _slave = 0;
+    _wmidi = 0;
+    _iface = 0;
+    _nthr = 0;
+}
+
+// Runs the synth for nframes frames, from the audio thread of the
+// host. There are noutput() output buffers. The MIDI events must
+// be sorted by time.
+//
+void Engine::process(int nframes, const Midiev *midi, int nmidi, float **outputs)
+{
+    _audio->process(nframes, midi, nmidi, outputs);
+}
+
+// Returns the next job for work(), or 0. Called from the audio
+// thread, as it takes the message in the same way as Audio.
+//
+ITC_mesg *Engine::get_work(void)
+{
+    if (get_event_nowait(1 << FM_MODEL) == EV_TIME)
+        return 0;
+    return get_message();
+}
+
+void Engine::work(ITC_mesg *M)
+{
+    _slave->proc_mesg(M);
+}
+
+void Engine::set_stop(int group, int ifelm, bool state)
+{
+    send_event(TO_MODEL, new M_ifc_ifelm(state ? MT_IFC_ELSET : MT_IFC_ELCLR, group, ifelm));
+}
+
+void Engine::clr_group(int group)
+{
+    send_event(TO_MODEL, new M_ifc_ifelm(MT_IFC_GRCLR, group, 0));
+}
+
+void Engine::recall(int bank, int pres)
+{
+    send_event(TO_MODEL, new M_ifc_preset(MT_IFC_PRRCL, bank, pres, 0));
+}
+
+void Engine::store(int bank, int pres)
+{
+    send_event(TO_MODEL, new M_ifc_preset(MT_IFC_PRSTO, bank, pres, 0));
+}
+
+// Sets a parameter of audio section asect, or of the instrument
+// if asect is -1.
+//
+void Engine::set_aupar(int asect, int parid, float value)
+{
+    send_event(TO_MODEL, new M_ifc_aupar(0, asect, parid, value));
+}
+
+void Engine::set_dipar(int divis, int parid, float value)
+{
+    send_event(TO_MODEL, new M_ifc_dipar(0, divis, parid, value));
+}
+
+void Engine::retune(float freq, int temp)
+{
+    send_event(TO_MODEL, new M_ifc_retune(freq, temp));
+}
+
+void Engine::all_off(void)
+{
+    send_event(TO_MODEL, new ITC_mesg(MT_IFC_ANOFF));
+}
+
+void Engine::save(void)
+{
+    send_event(TO_MODEL, new ITC_mesg(MT_IFC_SAVE));
+}
+
+// Replaces the presets by the contents of a presets file.
+//
+void Engine::load_presets(const void *data, int size)
+{
+    send_event(TO_MODEL, new M_ifc_prload(data, size));
+}
+
+// The preset store, a file that the model keeps open. Each change
+// is written to it at once, so it can be read at any time.
+//
+int Engine::presets_fd(void) const
+{
+    return _model ? _model->presets_fd() : -1;
+}
+
+int Engine::noutput(void) const
+{
+    return _audio ? _audio->nout() : 0;
+}
+
+const float *Engine::dspload(void) const
+{
+    return _audio ? _audio->dspload() : 0;
+}
@@ -0,0 +1,92 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __ENGINE_H
+#define __ENGINE_H
+
+#include <clthreads.h>
+#include "global.h"
+
+class Audio;
+class Model;
+class Slave;
+class Wakeup;
+class Iface;
+
+// The synth without JACK, to run inside the audio engine of
+// another program. The host calls process() from its audio
+// thread for each period. The model and wavetable threads run
+// as in the aeolus program, and the other functions send the
+// same commands as a user interface to the model. They must
+// not be called from the audio thread. An Iface may be given
+// to start() to follow the state of the instrument. With work
+// set, the wavetables are not made by a thread of the engine:
+// the host gets the jobs with get_work() in the audio thread,
+// and passes them to work() in a thread of its own. With prmem
+// set the presets are kept in memory, starting from those in
+// the presets file, which is not changed.
+//
+class Engine : public ITC_ctrl
+{
+public:
+    Engine(const char *name, const char *stops, const char *instr, const char *waves, bool uhome = false, const char *irfile = 0, bool prmem = false);
+    virtual ~Engine(void);
+
+    int start(unsigned int fsamp, bool bform = false, Iface *iface = 0, bool work = false);
+    void stop(void);
+    void process(int nframes, const Midiev *midi, int nmidi, float **outputs);
+    ITC_mesg *get_work(void);
+    void work(ITC_mesg *M);
+
+    void set_stop(int group, int ifelm, bool state);
+    void clr_group(int group);
+    void recall(int bank, int pres);
+    void store(int bank, int pres);
+    void set_aupar(int asect, int parid, float value);
+    void set_dipar(int divis, int parid, float value);
+    void retune(float freq, int temp);
+    void all_off(void);
+    void save(void);
+    void load_presets(const void *data, int size);
+    int presets_fd(void) const;
+
+    int noutput(void) const;
+    const float *dspload(void) const;
+
+private:
+    const char *_name;
+    const char *_stops;
+    const char *_instr;
+    const char *_waves;
+    bool _uhome;
+    const char *_irfile;
+    bool _prmem;
+    int _nthr;
+    Lfq_u32 _qnote;
+    Lfq_u32 _qcomm;
+    Lfq_u8 _qmidi;
+    Audio *_audio;
+    Model *_model;
+    Slave *_slave;
+    Wakeup *_wmidi;
+    Iface *_iface;
+};
+
+#endif
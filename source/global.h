@@ -62,16 +62,22 @@
 
 #include "lfqueue.h"
 
+// Divisions, ranks, groups and stops are allocated as needed.
+// NDIVIS and NRANKS are the limits of the 8 bit indices in the
+// commands to the audio thread, NGROUP makes sure a registration
+// snapshot fits in the command queue.
+//
 enum // GLOBAL LIMITS
 {
     NASECT = 4,
-    NDIVIS = 8,
+    NDIVIS = 256,
     NKEYBD = 8,
-    NGROUP = 8,
-    NRANKS = 32,
+    NGROUP = 128,
+    NRANKS = 256,
     NNOTES = 61,
-    NBANK = 32,
-    NPRES = 32
+    NBANK = 128,
+    NPRES = 32,
+    NSTEP = 128
 };
 
 #define MIDICTL_SWELL 7
@@ -147,4 +153,15 @@ public:
     float _max;
 };
 
+// A MIDI event given to Audio::process(), at frame _time
+// of the period.
+//
+class Midiev
+{
+public:
+    uint32_t _time;
+    uint32_t _size;
+    const uint8_t *_data;
+};
+
 #endif
@@ -25,7 +25,9 @@
 Instrwin::Instrwin(X_window *parent, X_callback *callb, int xp, int yp, X_resman *xresm) : X_window(parent, xp, yp, XSIZE, YSIZE, Colors.main_bg),
                                                                                            _callb(callb),
                                                                                            _xresm(xresm),
-                                                                                           _xp(xp), _yp(yp)
+                                                                                           _xp(xp), _yp(yp),
+                                                                                           _ndivis(0),
+                                                                                           _divisd(0)
 {
     _atom = XInternAtom(dpy(), "WM_DELETE_WINDOW", True);
     XSetWMProtocols(dpy(), win(), &_atom, 1);
@@ -34,6 +36,7 @@ Instrwin::Instrwin(X_window *parent, X_callback *callb, int xp, int yp, X_resman
 
 Instrwin::~Instrwin(void)
 {
+    delete[] _divisd;
 }
 
 void Instrwin::handle_event(XEvent *E)
@@ -136,7 +139,8 @@ void Instrwin::setup(M_ifc_init *M)
     x1 = 310;
     x2 = n1 ? 640 : x1;
     y = 40;
-    D = _divisd;
+    _ndivis = M->_ndivis;
+    D = _divisd = new Divis[_ndivis];
     for (i = 0; i < M->_ndivis; i++)
     {
         k = DIVIS_STEP * (i + 1);
@@ -197,7 +201,7 @@ void Instrwin::set_dipar(M_ifc_dipar *M)
 {
     X_slider *S;
 
-    if ((M->_divis >= 0) && (M->_divis < NDIVIS))
+    if ((M->_divis >= 0) && (M->_divis < _ndivis))
     {
         if ((M->_parid >= 0) && (M->_parid < 3))
         {
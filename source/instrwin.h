@@ -62,7 +62,6 @@ private:
         FREQ_INC,
         TUNE_EXE,
         TUNE_CAN,
-        NDIVIS = 8,
         DIVIS_BIT0 = 8,
         DIVIS_STEP = (1 << DIVIS_BIT0),
         DIVIS_MASK = (DIVIS_STEP - 1),
@@ -94,7 +93,8 @@ private:
     X_slider *_trem0_ampl;
     X_slider *_trem1_freq;
     X_slider *_trem1_ampl;
-    Divis _divisd[NDIVIS];
+    int _ndivis;
+    Divis *_divisd;
     int _divis;
     int _parid;
     float _value;
@@ -81,6 +81,10 @@ public:
     void read_commit(int n) { _nrd += n; }
     uint32_t read(int i) { return _data[(_nrd + i) & _mask]; }
 
+    // Number of words committed so far.
+    int nwr(void) const { return _nwr; }
+    int nrd(void) const { return _nrd; }
+
 private:
     uint32_t *_data;
     int _size;
@@ -0,0 +1,356 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <lv2/core/lv2.h>
+#include <lv2/atom/atom.h>
+#include <lv2/atom/util.h>
+#include <lv2/midi/midi.h>
+#include <lv2/urid/urid.h>
+#include <lv2/worker/worker.h>
+#include <lv2/state/state.h>
+#include "engine.h"
+
+#define AEOLUS_URI "http://zynthian.org/plugins/aeolus"
+#define AEOLUS_PRESETS AEOLUS_URI "#presets"
+
+// The synth as an LV2 plugin. It runs the same engine as the aeolus
+// program, with MIDI from an atom port. The wavetables are computed
+// by the host's worker thread instead of a thread of the engine.
+// The state is the contents of the preset store, which each instance
+// keeps in memory: it starts from the presets file, and neither
+// changes nor state restore ever write to that. The instrument is
+// selected by the -S, -I, -W and -u options in the same files as
+// used by the program.
+//
+class Lv2plugin
+{
+public:
+    Lv2plugin(void);
+    ~Lv2plugin(void);
+
+    int init(double rate, const LV2_Feature *const *features);
+    void connect(uint32_t port, void *data);
+    void run(uint32_t nframes);
+    LV2_Worker_Status work(uint32_t size, const void *data);
+    LV2_State_Status save(LV2_State_Store_Function store, LV2_State_Handle handle);
+    LV2_State_Status restore(LV2_State_Retrieve_Function retrieve, LV2_State_Handle handle);
+
+    enum
+    {
+        P_CONTROL,
+        P_OUT_L,
+        P_OUT_R,
+        NPORT
+    };
+
+    enum
+    {
+        NMIDI = 256
+    };
+
+private:
+    int readconfig(const char *path);
+
+    Engine *_engine;
+    LV2_URID_Map *_map;
+    LV2_Worker_Schedule *_sched;
+    LV2_URID _midi_event;
+    LV2_URID _atom_chunk;
+    LV2_URID _presets;
+    const LV2_Atom_Sequence *_control;
+    float *_out[2];
+    ITC_mesg *_pend;
+    Midiev _midi[NMIDI];
+    char _stops[1024];
+    char _instr[1024];
+    char _waves[1024];
+    bool _uhome;
+};
+
+Lv2plugin::Lv2plugin(void) : _engine(0),
+                             _map(0),
+                             _sched(0),
+                             _control(0),
+                             _pend(0),
+                             _uhome(false)
+{
+    _out[0] = _out[1] = 0;
+    strcpy(_stops, "stops");
+    strcpy(_instr, "Aeolus");
+    strcpy(_waves, "waves");
+}
+
+Lv2plugin::~Lv2plugin(void)
+{
+    delete _engine;
+    if (_pend)
+        _pend->recover();
+}
+
+int Lv2plugin::init(double rate, const LV2_Feature *const *features)
+{
+    char s[1024];
+    const char *p;
+
+    for (int i = 0; features[i]; i++)
+    {
+        if (!strcmp(features[i]->URI, LV2_URID__map))
+            _map = (LV2_URID_Map *)features[i]->data;
+        else if (!strcmp(features[i]->URI, LV2_WORKER__schedule))
+            _sched = (LV2_Worker_Schedule *)features[i]->data;
+    }
+    if (!_map || !_sched)
+    {
+        fprintf(stderr, "Error: the host does not support urid:map and work:schedule\n");
+        return 1;
+    }
+    _midi_event = _map->map(_map->handle, LV2_MIDI__MidiEvent);
+    _atom_chunk = _map->map(_map->handle, LV2_ATOM__Chunk);
+    _presets = _map->map(_map->handle, AEOLUS_PRESETS);
+
+    p = getenv("HOME");
+    if (p)
+        snprintf(s, sizeof(s), "%s/.aeolusrc", p);
+    else
+        strcpy(s, ".aeolusrc");
+    if (readconfig(s))
+        readconfig("/etc/aeolus.conf");
+
+    _engine = new Engine("aeolus", _stops, _instr, _waves, _uhome, 0, true);
+    return _engine->start((unsigned int)rate, false, 0, true);
+}
+
+// Takes the options that select the instrument from a config file.
+// The others are for the program, but the ones with an argument
+// must be known to skip it, as in the options of main().
+//
+int Lv2plugin::readconfig(const char *path)
+{
+    FILE *F;
+    char line[1024];
+    char *p, *q, *arg;
+    char c;
+
+    if (!(F = fopen(path, "r")))
+        return 1;
+    while (fgets(line, sizeof(line), F))
+    {
+        p = strtok(line, " \t\n");
+        if (!p || (*p == '#'))
+            continue;
+        while (p)
+        {
+            q = (*p == '-') ? p + 1 : 0;
+            p = strtok(0, " \t\n");
+            while (q && (c = *q++))
+            {
+                if (!strchr("MNSIWsoORCPDrpn", c))
+                {
+                    if (c == 'u')
+                        _uhome = true;
+                    continue;
+                }
+                // The argument is the rest of the word or the next one.
+                arg = *q ? q : p;
+                if (arg == p)
+                    p = strtok(0, " \t\n");
+                if (arg)
+                {
+                    if (c == 'S')
+                        snprintf(_stops, sizeof(_stops), "%s", arg);
+                    else if (c == 'I')
+                        snprintf(_instr, sizeof(_instr), "%s", arg);
+                    else if (c == 'W')
+                        snprintf(_waves, sizeof(_waves), "%s", arg);
+                }
+                q = 0;
+            }
+        }
+        break;
+    }
+    fclose(F);
+    return 0;
+}
+
+void Lv2plugin::connect(uint32_t port, void *data)
+{
+    switch (port)
+    {
+    case P_CONTROL:
+        _control = (const LV2_Atom_Sequence *)data;
+        break;
+    case P_OUT_L:
+    case P_OUT_R:
+        _out[port - P_OUT_L] = (float *)data;
+        break;
+    }
+}
+
+void Lv2plugin::run(uint32_t nframes)
+{
+    int n = 0;
+
+    // Jobs for the wavetable thread go to the host's worker.
+    // One that does not fit is kept for the next period.
+    while (_pend || (_pend = _engine->get_work()))
+    {
+        if (_sched->schedule_work(_sched->handle, sizeof(_pend), &_pend) != LV2_WORKER_SUCCESS)
+            break;
+        _pend = 0;
+    }
+
+    if (_control)
+    {
+        LV2_ATOM_SEQUENCE_FOREACH(_control, ev)
+        {
+            if ((ev->body.type == _midi_event) && (n < NMIDI))
+            {
+                _midi[n]._time = ev->time.frames;
+                _midi[n]._size = ev->body.size;
+                _midi[n]._data = (const uint8_t *)(ev + 1);
+                n++;
+            }
+        }
+    }
+    _engine->process(nframes, _midi, n, _out);
+}
+
+LV2_Worker_Status Lv2plugin::work(uint32_t size, const void *data)
+{
+    if (size != sizeof(ITC_mesg *))
+        return LV2_WORKER_ERR_UNKNOWN;
+    _engine->work(*(ITC_mesg *const *)data);
+    return LV2_WORKER_SUCCESS;
+}
+
+// Saves the preset store. It is complete at any time, as every
+// change is written to it at once.
+//
+LV2_State_Status Lv2plugin::save(LV2_State_Store_Function store, LV2_State_Handle handle)
+{
+    int fd;
+    struct stat st;
+    unsigned char *data;
+    LV2_State_Status r;
+
+    if (((fd = _engine->presets_fd()) < 0) || fstat(fd, &st))
+        return LV2_STATE_ERR_UNKNOWN;
+    data = new unsigned char[st.st_size];
+    if (pread(fd, data, st.st_size, 0) != st.st_size)
+        r = LV2_STATE_ERR_UNKNOWN;
+    else
+        r = store(handle, _presets, data, st.st_size, _atom_chunk, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+    delete[] data;
+    return r;
+}
+
+LV2_State_Status Lv2plugin::restore(LV2_State_Retrieve_Function retrieve, LV2_State_Handle handle)
+{
+    size_t size;
+    uint32_t type, flags;
+    const void *data;
+
+    data = retrieve(handle, _presets, &size, &type, &flags);
+    if (!data)
+        return LV2_STATE_ERR_NO_PROPERTY;
+    if (type != _atom_chunk)
+        return LV2_STATE_ERR_BAD_TYPE;
+    _engine->load_presets(data, size);
+    return LV2_STATE_SUCCESS;
+}
+
+static LV2_Handle instantiate(const LV2_Descriptor *, double rate, const char *, const LV2_Feature *const *features)
+{
+    Lv2plugin *P = new Lv2plugin();
+
+    if (P->init(rate, features))
+    {
+        delete P;
+        return 0;
+    }
+    return P;
+}
+
+static void connect_port(LV2_Handle h, uint32_t port, void *data)
+{
+    ((Lv2plugin *)h)->connect(port, data);
+}
+
+static void run(LV2_Handle h, uint32_t nframes)
+{
+    ((Lv2plugin *)h)->run(nframes);
+}
+
+static void cleanup(LV2_Handle h)
+{
+    delete (Lv2plugin *)h;
+}
+
+static LV2_Worker_Status work(LV2_Handle h, LV2_Worker_Respond_Function, LV2_Worker_Respond_Handle, uint32_t size, const void *data)
+{
+    return ((Lv2plugin *)h)->work(size, data);
+}
+
+static LV2_Worker_Status work_response(LV2_Handle, uint32_t, const void *)
+{
+    return LV2_WORKER_SUCCESS;
+}
+
+static LV2_State_Status save(LV2_Handle h, LV2_State_Store_Function store, LV2_State_Handle handle, uint32_t, const LV2_Feature *const *)
+{
+    return ((Lv2plugin *)h)->save(store, handle);
+}
+
+static LV2_State_Status restore(LV2_Handle h, LV2_State_Retrieve_Function retrieve, LV2_State_Handle handle, uint32_t, const LV2_Feature *const *)
+{
+    return ((Lv2plugin *)h)->restore(retrieve, handle);
+}
+
+static const void *extension_data(const char *uri)
+{
+    static const LV2_Worker_Interface worker = {work, work_response, 0};
+    static const LV2_State_Interface state = {save, restore};
+
+    if (!strcmp(uri, LV2_WORKER__interface))
+        return &worker;
+    if (!strcmp(uri, LV2_STATE__interface))
+        return &state;
+    return 0;
+}
+
+static const LV2_Descriptor descriptor = {
+    AEOLUS_URI,
+    instantiate,
+    connect_port,
+    0,
+    run,
+    0,
+    cleanup,
+    extension_data};
+
+LV2_SYMBOL_EXPORT const LV2_Descriptor *lv2_descriptor(uint32_t index)
+{
+    return index ? 0 : &descriptor;
+}
@@ -32,23 +32,80 @@
 #include "slave.h"
 #include "osc.h"
 #include "iface.h"
+#include "alsadrv.h"
+#ifdef PIPEWIRE
+#include "pwdrv.h"
+#endif
 
-static const char *options = "htuBM:N:S:I:W:s:o:O:";
+static const char *options = "hctudBAJwxXM:N:S:I:W:s:o:O:R:C:P:D:r:p:n:";
 static char optline[1024];
+static bool c_opt = false;
 static bool t_opt = false;
 static bool u_opt = false;
+static bool d_opt = false;
 static bool B_opt = false;
+static bool A_opt = false;
+static bool w_opt = false;
+static bool x_opt = false;
+static bool X_opt = false;
 static int o_val = 0;
+static int R_val = -1;
 static const char *N_val = "aeolus";
 static const char *S_val = "stops";
 static const char *I_val = "Aeolus";
 static const char *W_val = "waves";
 static const char *O_val = NULL;
 static const char *s_val = 0;
-static Lfq_u32 note_queue(256);
-static Lfq_u32 comm_queue(256);
-static Lfq_u8 midi_queue(1024);
-static Iface *iface;
+static const char *C_val = 0;
+static const char *P_val = 0;
+static const char *D_val = "default";
+static const char *M_val = 0;
+static int r_val = 48000;
+static int p_val = 1024;
+static int n_val = 2;
+static Wakeup sig_wakeup;
+static Iface *iface = 0;
+
+// An instrument hosted by this process. They all share the JACK
+// client, the slave thread and the wavetables of identical ranks.
+//
+class Instr
+{
+public:
+    Instr(void) : _note_queue(256),
+                  _comm_queue(4096), // room for a registration snapshot
+                  _stop_queue(256),
+                  _midi_queue(1024),
+                  _alsa_queue(1024),
+                  _audio(0),
+                  _model(0),
+                  _osc(0)
+    {
+    }
+
+    const char *_name;
+    Lfq_u32 _note_queue;
+    Lfq_u32 _comm_queue;
+    Lfq_u32 _stop_queue;
+    Lfq_u8 _midi_queue;
+    Lfq_u8 _alsa_queue; // MIDI input from Alsamidi
+    Wakeup _midi_wakeup;
+    Audio *_audio;
+    Model *_model;
+    Osc *_osc;
+};
+
+static char I_list[1024];
+static Instr *instr[Slave::NINSTR];
+static int ninstr = 0;
+static Alsapcm *alsapcm = 0;
+static Alsamidi *alsamidi = 0;
+#ifdef PIPEWIRE
+static Pwfilter *pwfilter = 0;
+#endif
+
+// Priority of the ALSA or PipeWire thread, relative to the maximum.
+static const int HOST_RELPRI = -20;
 
 static void help(void)
 {
@@ -57,17 +114,36 @@ static void help(void)
     fprintf(stderr, "      2022-2024 riban  <riban@zynthian.org>\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -h                 Display this text\n");
+    fprintf(stderr, "  -c                 Compile the instrument image and exit\n");
     fprintf(stderr, "  -t                 Text mode user interface\n");
     fprintf(stderr, "  -u                 Use presets file in user's home dir\n");
+    fprintf(stderr, "  -d                 Run as a daemon, without user interface\n");
+    fprintf(stderr, "  -P <file>          Write the process id to file in daemon mode\n");
     fprintf(stderr, "  -o <port>          Enable OSC interface on UDP port\n");
     fprintf(stderr, "  -O <uri>           URI to send OSC notifications\n");
     fprintf(stderr, "    uri: ip address:port/path port and path are optional \n");
+    fprintf(stderr, "    instrument k uses the OSC and notification ports plus k,\n");
+    fprintf(stderr, "    notifications go after the OSC ports by default\n");
     fprintf(stderr, "  -N <name>          Name to use as JACK client [aeolus]\n");
     fprintf(stderr, "  -S <stops>         Name of stops directory [stops]\n");
     fprintf(stderr, "  -I <instr>         Name of instrument directory [Aeolus]\n");
+    fprintf(stderr, "    a comma separated list runs several instruments\n");
     fprintf(stderr, "  -W <waves>         Name of waves directory [waves]\n");
+    fprintf(stderr, "  -J                 Use JACK (default)\n");
     fprintf(stderr, "  -s                 Select JACK server\n");
+    fprintf(stderr, "  -A                 Use ALSA, with options:\n");
+    fprintf(stderr, "    -D <device>        PCM device [default]\n");
+    fprintf(stderr, "    -r <rate>          Sample rate [48000]\n");
+    fprintf(stderr, "    -p <frames>        Period size [1024]\n");
+    fprintf(stderr, "    -n <nfrag>         Number of periods [2]\n");
+    fprintf(stderr, "    -M <device>        Raw MIDI device instead of sequencer\n");
+    fprintf(stderr, "  -w                 Use PipeWire, at the sample rate set by -r\n");
     fprintf(stderr, "  -B                 Ambisonics B format output\n");
+    fprintf(stderr, "  -x                 Add a dry output for each audio section\n");
+    fprintf(stderr, "  -X                 Disable the reverb\n");
+    fprintf(stderr, "  -R <cpu>           Run reverb in a separate thread on CPU\n");
+    fprintf(stderr, "    adds one period of latency to the reverb input\n");
+    fprintf(stderr, "  -C <file>          Use convolution reverb with impulse response file\n");
     exit(1);
 }
 
@@ -91,15 +167,57 @@ static void procoptions(int ac, char *av[], const char *where)
         case 'h':
             help();
             exit(0);
+        case 'c':
+            c_opt = true;
+            break;
         case 't':
             t_opt = true;
             break;
         case 'u':
             u_opt = true;
             break;
+        case 'd':
+            d_opt = true;
+            break;
+        case 'P':
+            P_val = optarg;
+            break;
         case 'B':
             B_opt = true;
             break;
+        case 'x':
+            x_opt = true;
+            break;
+        case 'X':
+            X_opt = true;
+            break;
+        case 'A':
+            A_opt = true;
+            w_opt = false;
+            break;
+        case 'J':
+            A_opt = false;
+            w_opt = false;
+            break;
+        case 'w':
+            w_opt = true;
+            A_opt = false;
+            break;
+        case 'D':
+            D_val = optarg;
+            break;
+        case 'M':
+            M_val = optarg;
+            break;
+        case 'r':
+            r_val = atoi(optarg);
+            break;
+        case 'p':
+            p_val = atoi(optarg);
+            break;
+        case 'n':
+            n_val = atoi(optarg);
+            break;
         case 'N':
             N_val = optarg;
             break;
@@ -121,6 +239,12 @@ static void procoptions(int ac, char *av[], const char *where)
         case 's':
             s_val = optarg;
             break;
+        case 'R':
+            R_val = atoi(optarg);
+            break;
+        case 'C':
+            C_val = optarg;
+            break;
         case '?':
             fprintf(stderr, "\n%s\n", where);
             if (optopt != ':' && strchr(options, optopt))
@@ -168,24 +292,114 @@ static int readconfig(const char *path)
     return 1;
 }
 
+// Splits the -I option into instrument names.
+//
+static int split_instr(void)
+{
+    char *p;
+
+    strncpy(I_list, I_val, 1023);
+    for (p = strtok(I_list, ","); p; p = strtok(0, ","))
+    {
+        if (ninstr == Slave::NINSTR)
+        {
+            fprintf(stderr, "Error: more than %d instruments.\n", Slave::NINSTR);
+            return 1;
+        }
+        instr[ninstr] = new Instr();
+        instr[ninstr++]->_name = p;
+    }
+    if (!ninstr)
+    {
+        fprintf(stderr, "Error: no instrument.\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Opens the ALSA PCM device with channels for all instruments,
+// and the MIDI input. Without MIDI input Aeolus still runs.
+//
+static int open_alsa(void)
+{
+    char names[Slave::NINSTR][64];
+    const char *ports[Slave::NINSTR];
+    Lfq_u8 *queues[Slave::NINSTR];
+    const char *q;
+    int k, err;
+
+    alsapcm = new Alsapcm();
+    if (alsapcm->open(D_val, r_val, p_val, n_val, ninstr * ((B_opt ? 4 : 2) + (x_opt ? NASECT : 0))))
+        return 1;
+    alsamidi = new Alsamidi();
+    if (M_val)
+        err = alsamidi->open_raw(M_val, &instr[0]->_alsa_queue);
+    else
+    {
+        for (k = 0; k < ninstr; k++)
+        {
+            q = strrchr(instr[k]->_name, '/');
+            if (k)
+                snprintf(names[k], 64, "%s/midi_in", q ? q + 1 : instr[k]->_name);
+            else
+                strcpy(names[k], "midi_in");
+            ports[k] = names[k];
+            queues[k] = &instr[k]->_alsa_queue;
+        }
+        err = alsamidi->open_seq(N_val, ninstr, ports, queues);
+    }
+    if (err)
+    {
+        fprintf(stderr, "Warning: no MIDI input.\n");
+        delete alsamidi;
+        alsamidi = 0;
+    }
+    return 0;
+}
+
 static void sigint_handler(int)
 {
     signal(SIGINT, SIG_IGN);
     iface->stop();
 }
 
+// In daemon mode SIGINT and SIGTERM end the program. Posting a
+// semaphore is safe in a signal handler, the wakeup thread sends
+// it on as an exit event.
+static void sigterm_handler(int)
+{
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+    sig_wakeup.post();
+}
+
+static int write_pidfile(const char *path)
+{
+    FILE *F;
+
+    if (!(F = fopen(path, "w")))
+    {
+        fprintf(stderr, "Error: can't write '%s'.\n", path);
+        return 1;
+    }
+    fprintf(F, "%d\n", getpid());
+    fclose(F);
+    return 0;
+}
+
 int main(int ac, char *av[])
 {
     ITC_ctrl itcc;
+    Instr *I;
     Audio *audio;
     Model *model;
     Slave *slave;
-    Osc *osc = NULL;
-    void *so_handle;
-    iface_cr *so_create;
+    void *so_handle = 0;
+    iface_cr *so_create = 0;
     char s[1024];
     char *p;
-    int n;
+    const char *q;
+    int k, m, n;
 
     p = getenv("HOME");
     if (p)
@@ -195,90 +409,237 @@ int main(int ac, char *av[])
     if (readconfig(s))
         readconfig("/etc/aeolus.conf");
     procoptions(ac, av, "On command line:");
+    if (split_instr())
+        return 1;
+
+    if (c_opt)
+    {
+        uint16_t midimap[16];
+
+        for (k = n = 0; (k < ninstr) && !n; k++)
+        {
+            I = instr[k];
+            model = new Model(&I->_comm_queue, &I->_midi_queue, midimap, N_val, S_val, I->_name, W_val, u_opt);
+            n = model->compile();
+            delete model;
+        }
+        return n;
+    }
+
+    if (d_opt)
+    {
+        // Detach before any threads are started. The working
+        // directory and the output are kept.
+        if (daemon(1, 1))
+        {
+            fprintf(stderr, "Error: can't run as a daemon.\n");
+            return 1;
+        }
+        if (P_val && write_pidfile(P_val))
+            return 1;
+    }
 
     if (mlockall(MCL_CURRENT | MCL_FUTURE))
         fprintf(stderr, "Warning: memory lock failed.\n");
 
-    if (t_opt)
-        sprintf(s, "%s/aeolus_txt.so", LIBDIR);
-    else
-        sprintf(s, "%s/aeolus_x11.so", LIBDIR);
-    so_handle = dlopen(s, RTLD_NOW);
-    if (!so_handle)
+    if (!d_opt)
     {
-        fprintf(stderr, "Error: can't open user interface plugin: %s.\n", dlerror());
+        if (t_opt)
+            sprintf(s, "%s/aeolus_txt.so", LIBDIR);
+        else
+            sprintf(s, "%s/aeolus_x11.so", LIBDIR);
+        so_handle = dlopen(s, RTLD_NOW);
+        if (!so_handle)
+        {
+            fprintf(stderr, "Error: can't open user interface plugin: %s.\n", dlerror());
+            return 1;
+        }
+        so_create = (iface_cr *)dlsym(so_handle, "create_iface");
+        if (!so_create)
+        {
+            fprintf(stderr, "Error: can't create user interface plugin: %s.\n", dlerror());
+            dlclose(so_handle);
+            return 1;
+        }
+    }
+
+    if (A_opt && open_alsa())
         return 1;
+#ifdef PIPEWIRE
+    if (w_opt)
+    {
+        pwfilter = new Pwfilter(N_val);
+        if (pwfilter->open(r_val))
+            return 1;
     }
-    so_create = (iface_cr *)dlsym(so_handle, "create_iface");
-    if (!so_create)
+#else
+    if (w_opt)
     {
-        fprintf(stderr, "Error: can't create user interface plugin: %s.\n", dlerror());
-        dlclose(so_handle);
+        fprintf(stderr, "Error: Aeolus was built without PipeWire.\n");
         return 1;
     }
+#endif
 
-    audio = new Audio(N_val, &note_queue, &comm_queue);
-    audio->init_jack(s_val, B_opt, &midi_queue);
-    model = new Model(&comm_queue, &midi_queue, audio->midimap(), audio->appname(), S_val, I_val, W_val, u_opt);
+    // The first instrument owns the JACK client, the others add
+    // their ports to it, prefixed by the instrument name, and get
+    // the next OSC ports. The user interface shows the first one.
+    // With ALSA or PipeWire they all run in its thread.
+    for (k = 0; k < ninstr; k++)
+    {
+        I = instr[k];
+#ifdef PIPEWIRE
+        if (w_opt)
+        {
+            q = strrchr(I->_name, '/');
+            I->_audio = new Audio(k ? (q ? q + 1 : I->_name) : N_val, &I->_note_queue, &I->_comm_queue, &I->_stop_queue);
+            I->_audio->set_direct(x_opt, X_opt);
+            I->_audio->init_host(pwfilter->fsamp(), B_opt, &I->_midi_queue, &I->_midi_wakeup, SCHED_FIFO, HOST_RELPRI);
+            if (pwfilter->add(I->_audio, k ? I->_audio->appname() : 0))
+                return 1;
+        }
+        else
+#endif
+        if (A_opt)
+        {
+            q = strrchr(I->_name, '/');
+            I->_audio = new Audio(k ? (q ? q + 1 : I->_name) : N_val, &I->_note_queue, &I->_comm_queue, &I->_stop_queue);
+            I->_audio->set_direct(x_opt, X_opt);
+            I->_audio->init_host(alsapcm->fsamp(), B_opt, &I->_midi_queue, &I->_midi_wakeup, SCHED_FIFO, HOST_RELPRI);
+            alsapcm->add(I->_audio, &I->_alsa_queue);
+        }
+        else if (k)
+        {
+            q = strrchr(I->_name, '/');
+            I->_audio = new Audio(q ? q + 1 : I->_name, &I->_note_queue, &I->_comm_queue, &I->_stop_queue);
+            I->_audio->set_direct(x_opt, X_opt);
+            I->_audio->init_shared(instr[0]->_audio, B_opt, &I->_midi_queue, &I->_midi_wakeup);
+        }
+        else
+        {
+            I->_audio = new Audio(N_val, &I->_note_queue, &I->_comm_queue, &I->_stop_queue);
+            I->_audio->set_direct(x_opt, X_opt);
+            I->_audio->init_jack(s_val, B_opt, &I->_midi_queue, &I->_midi_wakeup, R_val);
+        }
+        I->_model = new Model(&I->_comm_queue, &I->_midi_queue, I->_audio->midimap(), I->_audio->appname(),
+                              S_val, I->_name, W_val, u_opt, C_val);
+        if (o_val)
+            I->_osc = new Osc(o_val + k, O_val, k, ninstr, instr[0]->_audio->dspload(), &I->_stop_queue, &I->_comm_queue);
+    }
     slave = new Slave();
-    if (o_val)
-        osc = new Osc(o_val, O_val);
-    iface = so_create(ac, av);
-
-    ITC_ctrl::connect(audio, EV_EXIT, &itcc, EV_EXIT);
-    ITC_ctrl::connect(audio, EV_QMIDI, model, EV_QMIDI);
-    ITC_ctrl::connect(audio, TO_MODEL, model, FM_AUDIO);
-    ITC_ctrl::connect(model, EV_EXIT, &itcc, EV_EXIT);
-    ITC_ctrl::connect(model, TO_AUDIO, audio, FM_MODEL);
-    ITC_ctrl::connect(model, TO_SLAVE, slave, FM_MODEL);
-    ITC_ctrl::connect(model, TO_IFACE, iface, FM_MODEL);
+    if (so_create)
+        iface = so_create(ac, av);
+
+    for (k = 0; k < ninstr; k++)
+    {
+        audio = instr[k]->_audio;
+        model = instr[k]->_model;
+        ITC_ctrl::connect(audio, EV_EXIT, &itcc, EV_EXIT);
+        ITC_ctrl::connect(audio, TO_MODEL, model, FM_AUDIO);
+        ITC_ctrl::connect(model, EV_EXIT, &itcc, EV_EXIT);
+        ITC_ctrl::connect(model, TO_AUDIO, audio, FM_MODEL);
+        ITC_ctrl::connect(model, TO_SLAVE, slave, Slave::fm_model(k));
+        ITC_ctrl::connect(slave, Slave::to_audio(k), audio, FM_SLAVE);
+        ITC_ctrl::connect(slave, Slave::to_model(k), model, FM_SLAVE);
+        if (instr[k]->_osc)
+        {
+            ITC_ctrl::connect(instr[k]->_osc, TO_MODEL, model, FM_OSC);
+            ITC_ctrl::connect(instr[k]->_osc, EV_EXIT, &itcc, EV_EXIT);
+            ITC_ctrl::connect(model, TO_OSC, instr[k]->_osc, FM_MODEL);
+        }
+    }
     ITC_ctrl::connect(slave, EV_EXIT, &itcc, EV_EXIT);
-    ITC_ctrl::connect(slave, TO_AUDIO, audio, FM_SLAVE);
-    ITC_ctrl::connect(slave, TO_MODEL, model, FM_SLAVE);
-    if (osc)
+    if (iface)
     {
-        ITC_ctrl::connect(osc, TO_MODEL, model, FM_OSC);
-        ITC_ctrl::connect(osc, EV_EXIT, &itcc, EV_EXIT);
-        ITC_ctrl::connect(model, TO_OSC, osc, FM_MODEL);
+        ITC_ctrl::connect(instr[0]->_model, TO_IFACE, iface, FM_MODEL);
+        ITC_ctrl::connect(iface, EV_EXIT, &itcc, EV_EXIT);
+        ITC_ctrl::connect(iface, TO_MODEL, instr[0]->_model, FM_IFACE);
     }
-    ITC_ctrl::connect(iface, EV_EXIT, &itcc, EV_EXIT);
-    ITC_ctrl::connect(iface, TO_MODEL, model, FM_IFACE);
 
-    audio->start();
-
-    if (model->thr_start(SCHED_FIFO, audio->relpri() - 30, 0))
+    audio = instr[0]->_audio;
+    for (k = 0; k < ninstr; k++)
     {
-        fprintf(stderr, "Warning: can't run model thread in RT mode.\n");
-        model->thr_start(SCHED_OTHER, 0, 0);
+        I = instr[k];
+        I->_audio->start();
+        if (I->_model->thr_start(SCHED_FIFO, audio->relpri() - 30, 0))
+        {
+            fprintf(stderr, "Warning: can't run model thread in RT mode.\n");
+            I->_model->thr_start(SCHED_OTHER, 0, 0);
+        }
+        I->_midi_wakeup.start(I->_model, EV_QMIDI, SCHED_FIFO, audio->relpri() - 30);
+        if (I->_osc)
+            I->_osc->thr_start(SCHED_OTHER, 0, 0);
     }
     slave->thr_start(SCHED_OTHER, 0, 0);
-    if (osc)
-        osc->thr_start(SCHED_OTHER, 0, 0);
-    iface->thr_start(SCHED_OTHER, 0, 0);
-
-    signal(SIGINT, sigint_handler);
-    n = 3;
+    if (alsapcm)
+    {
+        alsapcm->start(SCHED_FIFO, HOST_RELPRI, &itcc, EV_EXIT);
+        if (alsamidi)
+            alsamidi->start(SCHED_FIFO, HOST_RELPRI - 10);
+    }
+#ifdef PIPEWIRE
+    if (pwfilter && pwfilter->start(&itcc, EV_EXIT))
+        itcc.put_event(EV_EXIT, 1);
+#endif
+    if (iface)
+    {
+        iface->thr_start(SCHED_OTHER, 0, 0);
+        signal(SIGINT, sigint_handler);
+    }
+    else
+    {
+        sig_wakeup.start(&itcc, EV_EXIT, SCHED_OTHER, 0);
+        signal(SIGINT, sigterm_handler);
+        signal(SIGTERM, sigterm_handler);
+    }
+    // Wait for the first exit event, then for the models, the
+    // slave and the OSC threads to end.
+    m = ninstr + 2;
+    for (k = 0; k < ninstr; k++)
+        if (instr[k]->_osc)
+            m++;
+    n = m;
     while (n)
     {
         itcc.get_event(1 << EV_EXIT);
         {
-            if (n-- == 3)
+            if (n-- == m)
             {
-                model->terminate();
+                for (k = 0; k < ninstr; k++)
+                {
+                    instr[k]->_model->terminate();
+                    if (instr[k]->_osc)
+                        instr[k]->_osc->terminate();
+                }
                 slave->terminate();
-                if (osc)
-                    osc->terminate();
-                iface->terminate();
+                if (iface)
+                    iface->terminate();
             }
         }
     }
 
-    delete audio;
-    delete model;
+    // The first Audio closes JACK, which stops rendering the others.
+    delete alsamidi;
+    delete alsapcm;
+#ifdef PIPEWIRE
+    delete pwfilter;
+#endif
+    for (k = 0; k < ninstr; k++)
+        delete instr[k]->_audio;
+    for (k = 0; k < ninstr; k++)
+    {
+        I = instr[k];
+        I->_midi_wakeup.stop();
+        delete I->_model;
+        delete I->_osc;
+        delete I;
+    }
+    sig_wakeup.stop();
     delete slave;
-    delete osc;
     delete iface;
-    dlclose(so_handle);
+    if (so_handle)
+        dlclose(so_handle);
+    if (d_opt && P_val)
+        unlink(P_val);
 
     return 0;
 }
@@ -72,26 +72,26 @@ Mainwin::Mainwin(X_window *parent, X_callback *callb, int xp, int yp, X_resman *
                                                                                          _callb(callb),
                                                                                          _xresm(xresm),
                                                                                          _count(0),
+                                                                                         _ngroup(0),
+                                                                                         _nword(0),
+                                                                                         _groups(0),
+                                                                                         _st_mod(0),
+                                                                                         _st_loc(0),
                                                                                          _flashb(0),
                                                                                          _local(false)
 {
-    int i;
-
     _atom = XInternAtom(dpy(), "WM_DELETE_WINDOW", True);
     XSetWMProtocols(dpy(), win(), &_atom, 1);
     _atom = XInternAtom(dpy(), "WM_PROTOCOLS", True);
     x_add_events(ExposureMask);
     x_set_bit_gravity(NorthWestGravity);
-
-    for (i = 0; i < NGROUP; i++)
-    {
-        _st_mod[i] = 0;
-        _st_loc[i] = 0;
-    }
 }
 
 Mainwin::~Mainwin(void)
 {
+    delete[] _groups;
+    delete[] _st_mod;
+    delete[] _st_loc;
 }
 
 void Mainwin::handle_event(XEvent *E)
@@ -142,6 +142,7 @@ void Mainwin::xcmesg(XClientMessageEvent *E)
 void Mainwin::handle_callb(int k, X_window *W, XEvent *E)
 {
     int g, i;
+    uint32_t *b;
     X_button *B;
     XButtonEvent *Z;
     char s[256];
@@ -228,14 +229,14 @@ void Mainwin::handle_callb(int k, X_window *W, XEvent *E)
                 break;
 
             case B_MSTO:
-                _mesg = new M_ifc_preset(MT_IFC_PRSTO, _b_mod, _p_mod, _ngroup, _st_mod);
+                _mesg = new M_ifc_preset(MT_IFC_PRSTO, _b_mod, _p_mod, 0);
                 _callb->handle_callb(CB_MAIN_MSG, this, 0);
                 sprintf(s, "%d:%d  Stored", _b_mod + 1, _p_mod + 1);
                 _t_comm->set_text(s);
                 break;
 
             case B_MINS:
-                _mesg = new M_ifc_preset(MT_IFC_PRINS, _b_mod, _p_mod, _ngroup, _st_mod);
+                _mesg = new M_ifc_preset(MT_IFC_PRINS, _b_mod, _p_mod, 0);
                 _callb->handle_callb(CB_MAIN_MSG, this, 0);
                 sprintf(s, "%d:%d  Stored", _b_mod + 1, _p_mod + 1);
                 _t_comm->set_text(s);
@@ -253,7 +254,8 @@ void Mainwin::handle_callb(int k, X_window *W, XEvent *E)
                     if (_local)
                     {
                         clr_group(_groups + g);
-                        _st_loc[g] = 0;
+                        for (i = 0; i < _groups[g]._nifelm; i += 32)
+                            _st_loc[_groups[g]._iword + (i >> 5)] = 0;
                     }
                     else
                     {
@@ -271,15 +273,16 @@ void Mainwin::handle_callb(int k, X_window *W, XEvent *E)
             i = k & GROUP_MASK;
             if (_local)
             {
+                b = _st_loc + _groups[g]._iword + (i >> 5);
                 if (B->stat())
                 {
                     B->set_stat(0);
-                    _st_loc[g] &= ~(1 << i);
+                    *b &= ~(1u << (i & 31));
                 }
                 else
                 {
                     B->set_stat(1);
-                    _st_loc[g] |= (1 << i);
+                    *b |= 1u << (i & 31);
                 }
             }
             else
@@ -324,6 +327,10 @@ void Mainwin::setup(M_ifc_init *M)
     char s[256];
 
     _ngroup = M->_ngroup;
+    _nword = M->_nword;
+    _groups = new Group[_ngroup];
+    _st_mod = new uint32_t[_nword]();
+    _st_loc = new uint32_t[_nword]();
     y = 15;
     for (g = 0; g < _ngroup; g++)
     {
@@ -331,6 +338,8 @@ void Mainwin::setup(M_ifc_init *M)
         G->_ylabel = y + 20;
         G->_label = M->_groupd[g]._label;
         G->_nifelm = M->_groupd[g]._nifelm;
+        G->_iword = M->_groupd[g]._iword;
+        G->_butt = new X_tbutton *[G->_nifelm];
         x = 95;
         S = &ife0;
         for (i = 0; i < G->_nifelm; i++)
@@ -355,7 +364,7 @@ void Mainwin::setup(M_ifc_init *M)
                 x = 35;
                 y += S->size.y + 4;
             }
-            if (i == 20)
+            if ((i >= 20) && !((i - 20) % 12))
             {
                 x = 65;
                 y += S->size.y + 4;
@@ -432,21 +441,22 @@ void Mainwin::set_ifelm(M_ifc_ifelm *M)
     switch (M->type())
     {
     case MT_IFC_GRCLR:
-        _st_mod[M->_group] = 0;
+        for (int i = 0; i < G->_nifelm; i += 32)
+            _st_mod[G->_iword + (i >> 5)] = 0;
         if (!_local)
             clr_group(G);
         _t_comm->set_text("");
         break;
 
     case MT_IFC_ELCLR:
-        _st_mod[M->_group] &= ~(1 << M->_ifelm);
+        _st_mod[G->_iword + (M->_ifelm >> 5)] &= ~(1u << (M->_ifelm & 31));
         if (!_local)
             G->_butt[M->_ifelm]->set_stat(0);
         _t_comm->set_text("");
         break;
 
     case MT_IFC_ELSET:
-        _st_mod[M->_group] |= (1 << M->_ifelm);
+        _st_mod[G->_iword + (M->_ifelm >> 5)] |= 1u << (M->_ifelm & 31);
         if (!_local)
             G->_butt[M->_ifelm]->set_stat(1);
         _t_comm->set_text("");
@@ -454,7 +464,7 @@ void Mainwin::set_ifelm(M_ifc_ifelm *M)
 
     case MT_IFC_ELATT:
         if (!_local && _flashb)
-            _flashb->set_stat((_st_mod[_flashg] >> _flashi) & 1);
+            _flashb->set_stat(get_bit(_st_mod, _flashg, _flashi));
         _flashb = G->_butt[M->_ifelm];
         _flashg = M->_group;
         _flashi = M->_ifelm;
@@ -466,9 +476,9 @@ void Mainwin::set_state(M_ifc_preset *M)
 {
     char s[256];
 
-    if (M->_stat)
+    if (M->_stat && (M->_nword == _nword))
     {
-        memcpy(_st_mod, M->_bits, NGROUP * sizeof(uint32_t));
+        memcpy(_st_mod, M->_bits, _nword * sizeof(uint32_t));
         sprintf(s, "%d:%d  Loaded", M->_bank + 1, M->_pres + 1);
         if (!_local)
             set_butt();
@@ -495,7 +505,7 @@ void Mainwin::set_ready(void)
 {
     if (!_local && _flashb)
     {
-        _flashb->set_stat((_st_mod[_flashg] >> _flashi) & 1);
+        _flashb->set_stat(get_bit(_st_mod, _flashg, _flashi));
     }
     _flashb = 0;
 }
@@ -503,19 +513,24 @@ void Mainwin::set_ready(void)
 void Mainwin::set_butt(void)
 {
     int g, i;
-    uint32_t b, *s;
+    uint32_t *s;
     Group *G;
 
     s = _local ? _st_loc : _st_mod;
     for (g = 0, G = _groups; g < _ngroup; g++, G++)
     {
-        for (i = 0, b = *s++; i < G->_nifelm; i++, b >>= 1)
+        for (i = 0; i < G->_nifelm; i++)
         {
-            G->_butt[i]->set_stat(b & 1);
+            G->_butt[i]->set_stat(get_bit(s, g, i));
         }
     }
 }
 
+int Mainwin::get_bit(const uint32_t *s, int g, int i) const
+{
+    return (s[_groups[g]._iword + (i >> 5)] >> (i & 31)) & 1;
+}
+
 void Mainwin::upd_pres(void)
 {
     char s[80];
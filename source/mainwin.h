@@ -27,9 +27,13 @@
 class Group
 {
 public:
+    Group(void) : _butt(0) {}
+    ~Group(void) { delete[] _butt; }
+
     const char *_label;
     int _nifelm;
-    X_tbutton *_butt[32];
+    int _iword; // first word of the group in a bitset
+    X_tbutton **_butt;
     int _ylabel;
     int _ydivid;
 };
@@ -94,6 +98,7 @@ private:
     void clr_group(Group *);
     void set_butt(void);
     void upd_pres(void);
+    int get_bit(const uint32_t *s, int g, int i) const;
 
     Atom _atom;
     X_callback *_callb;
@@ -104,9 +109,10 @@ private:
     int _ysize;
     int _count;
     int _ngroup;
-    Group _groups[NGROUP];
-    uint32_t _st_mod[NGROUP];
-    uint32_t _st_loc[NGROUP];
+    int _nword;
+    Group *_groups;
+    uint32_t *_st_mod;
+    uint32_t *_st_loc;
     int _group;
     int _ifelm;
     X_button *_flashb;
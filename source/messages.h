@@ -25,6 +25,7 @@
 #include "rankwave.h"
 #include "asection.h"
 #include "addsynth.h"
+#include "reverb.h"
 #include "global.h"
 
 enum
@@ -56,6 +57,7 @@ enum
     MT_CALC_RANK,
     MT_LOAD_RANK,
     MT_SAVE_RANK,
+    MT_LOAD_IR,
 
     MT_IFC_INIT,
     MT_IFC_READY,
@@ -80,7 +82,15 @@ enum
     MT_IFC_EDIT,
     MT_IFC_APPLY,
     MT_IFC_SAVE,
-    MT_IFC_TXTIP
+    MT_IFC_TXTIP,
+    MT_IFC_BUNDLE,
+    MT_IFC_ACTIONS,
+    MT_IFC_SQSET,
+    MT_IFC_SQGOTO,
+    MT_IFC_SQDEC,
+    MT_IFC_SQINC,
+    MT_IFC_RELOAD,
+    MT_IFC_PRLOAD
 };
 
 #define SRC_GUI_DRAG 100
@@ -94,6 +104,9 @@ public:
 
     float _fsamp;
     int _fsize;
+    int _policy;
+    int _relpri;
+    int _revlat;
     int _nasect;
     Fparm *_instrpar;
     Fparm *_asectpar[NASECT];
@@ -139,10 +152,69 @@ public:
     const char *_path;
 };
 
+class M_load_ir : public ITC_mesg
+{
+public:
+    M_load_ir(const char *path) : ITC_mesg(MT_LOAD_IR),
+                                  _revproc(0),
+                                  _old(0)
+    {
+        strncpy(_path, path, 1023);
+        _path[1023] = 0;
+    }
+
+    char _path[1024];
+    float _fsamp;
+    int _fsize;
+    int _policy;
+    int _relpri;
+    int _revlat;
+    Revproc *_revproc;
+    Revproc *_old;
+};
+
+// Description of the instrument for the user interfaces. The
+// labels are copied, so this remains valid after the model has
+// replaced its tables.
+//
 class M_ifc_init : public ITC_mesg
 {
 public:
-    M_ifc_init(void) : ITC_mesg(MT_IFC_INIT) {}
+    M_ifc_init(int ndivis, int ngroup) : ITC_mesg(MT_IFC_INIT),
+                                         _ndivis(ndivis),
+                                         _ngroup(ngroup),
+                                         _divisd(new Divisd[ndivis]),
+                                         _groupd(new Groupd[ngroup]())
+    {
+    }
+
+    ~M_ifc_init(void)
+    {
+        for (int g = 0; g < _ngroup; g++)
+            delete[] _groupd[g]._ifelmd;
+        delete[] _divisd;
+        delete[] _groupd;
+    }
+
+    struct Divisd
+    {
+        char _label[16];
+        int _asect;
+        int _flags;
+    };
+    struct Ifelmd
+    {
+        char _label[32];
+        char _mnemo[8];
+        int _type;
+    };
+    struct Groupd
+    {
+        char _label[16];
+        int _nifelm;
+        int _iword; // first word of the group in a bitset
+        Ifelmd *_ifelmd;
+    };
 
     const char *_stopsdir;
     const char *_wavesdir;
@@ -154,29 +226,15 @@ public:
     int _nkeybd;
     int _ndivis;
     int _ngroup;
+    int _nword; // words in a bitset of all stops
     int _ntempe;
     struct
     {
         const char *_label;
         bool _pedal;
     } _keybdd[NKEYBD];
-    struct
-    {
-        const char *_label;
-        int _asect;
-        int _flags;
-    } _divisd[NDIVIS];
-    struct
-    {
-        const char *_label;
-        int _nifelm;
-        struct
-        {
-            const char *_label;
-            const char *_mnemo;
-            int _type;
-        } _ifelmd[32];
-    } _groupd[8];
+    Divisd *_divisd;
+    Groupd *_groupd;
     struct
     {
         const char *_label;
@@ -187,14 +245,54 @@ public:
 class M_ifc_ifelm : public ITC_mesg
 {
 public:
-    M_ifc_ifelm(int type, int g, int i) : ITC_mesg(type),
-                                          _group(g),
-                                          _ifelm(i)
+    M_ifc_ifelm(int type, int g, int i, bool applied = false, int qpos = 0) : ITC_mesg(type),
+                                                                             _group(g),
+                                                                             _ifelm(i),
+                                                                             _applied(applied),
+                                                                             _qpos(qpos)
     {
     }
 
     int _group;
     int _ifelm;
+    bool _applied; // Already sent to the audio thread
+    int _qpos;     // Then, the words of the model's queue read by it
+};
+
+// The action words of all stops, sent by the model to the OSC
+// and audio threads once the instrument is ready. These allow
+// OSC to send stop changes directly to the audio thread, and
+// the audio thread to apply a registration snapshot. There is
+// a pair of actions for each bit of the registration bitset,
+// unused bits have none. A snapshot is only applied with the
+// table of the same generation, which counts the reloads.
+//
+class M_ifc_actions : public ITC_mesg
+{
+public:
+    M_ifc_actions(int ngroup = 0, int nword = 0) : ITC_mesg(MT_IFC_ACTIONS),
+                                                   _gen(0),
+                                                   _ngroup(ngroup),
+                                                   _nword(nword),
+                                                   _nifelm(new int[ngroup]),
+                                                   _iword(new int[ngroup]),
+                                                   _action(new uint32_t[32 * nword][2]())
+    {
+    }
+
+    ~M_ifc_actions(void)
+    {
+        delete[] _nifelm;
+        delete[] _iword;
+        delete[] _action;
+    }
+
+    int _gen;
+    int _ngroup;
+    int _nword;
+    int *_nifelm;
+    int *_iword;
+    uint32_t (*_action)[2];
 };
 
 class M_ifc_aupar : public ITC_mesg
@@ -263,21 +361,48 @@ public:
 class M_ifc_preset : public ITC_mesg
 {
 public:
-    M_ifc_preset(int type, int bank, int pres, int stat, uint32_t *bits) : ITC_mesg(type),
-                                                                           _bank(bank),
-                                                                           _pres(pres),
-                                                                           _stat(stat)
+    M_ifc_preset(int type, int bank, int pres, int stat, int nword = 0, const uint32_t *bits = 0) : ITC_mesg(type),
+                                                                                                    _bank(bank),
+                                                                                                    _pres(pres),
+                                                                                                    _stat(stat),
+                                                                                                    _nword(nword),
+                                                                                                    _tag(0),
+                                                                                                    _bits(new uint32_t[nword])
     {
         if (bits)
-            memcpy(_bits, bits, NGROUP * sizeof(uint32_t));
+            memcpy(_bits, bits, nword * sizeof(uint32_t));
         else
-            memset(_bits, 0, NGROUP * sizeof(uint32_t));
+            memset(_bits, 0, nword * sizeof(uint32_t));
+    }
+
+    ~M_ifc_preset(void)
+    {
+        delete[] _bits;
     }
 
     int _bank;
     int _pres;
     int _stat;
-    uint32_t _bits[NGROUP];
+    int _nword;
+    int _tag; // copied from a MT_IFC_PRGET request to the reply
+    uint32_t *_bits;
+};
+
+// A preset sequence, as a list of (bank << 8 | preset) steps
+// (MT_IFC_SQSET), or a step to go to (MT_IFC_SQGOTO).
+//
+class M_ifc_sequence : public ITC_mesg
+{
+public:
+    M_ifc_sequence(int type, int index) : ITC_mesg(type),
+                                          _index(index),
+                                          _nstep(0)
+    {
+    }
+
+    int _index;
+    int _nstep;
+    uint16_t _steps[NSTEP];
 };
 
 class M_ifc_edit : public ITC_mesg
@@ -295,6 +420,28 @@ public:
     Addsynth *_synth;
 };
 
+// The contents of a presets file to replace the current
+// presets, from the state of the LV2 plugin.
+//
+class M_ifc_prload : public ITC_mesg
+{
+public:
+    M_ifc_prload(const void *data, int size) : ITC_mesg(MT_IFC_PRLOAD),
+                                               _size(size),
+                                               _data(new unsigned char[size])
+    {
+        memcpy(_data, data, size);
+    }
+
+    ~M_ifc_prload(void)
+    {
+        delete[] _data;
+    }
+
+    int _size;
+    unsigned char *_data;
+};
+
 class M_ifc_txtip : public ITC_mesg
 {
 public:
@@ -306,4 +453,24 @@ public:
     char *_line;
 };
 
+// A group of interface messages to be applied as one update.
+// The messages are owned, and recovered, by the receiver.
+//
+class M_ifc_bundle : public ITC_mesg
+{
+public:
+    M_ifc_bundle(void) : ITC_mesg(MT_IFC_BUNDLE),
+                         _nmesg(0)
+    {
+    }
+
+    enum
+    {
+        MAXMESG = 128
+    };
+
+    int _nmesg;
+    ITC_mesg *_mesg[MAXMESG];
+};
+
 #endif
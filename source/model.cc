@@ -23,13 +23,18 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "model.h"
 #include "scales.h"
 #include "global.h"
 
 Divis::Divis(void) : _flags(0),
                      _dmask(0),
-                     _nrank(0)
+                     _nrank(0),
+                     _ranks(0)
 {
     *_label = 0;
     _param[SWELL]._val = SWELL_DEF;
@@ -54,11 +59,57 @@ Ifelm::Ifelm(void) : _state(0)
     *_mnemo = 0;
 }
 
-Group::Group(void) : _nifelm(0)
+Group::Group(void) : _nifelm(0),
+                     _iword(0),
+                     _ifelms(0)
 {
     *_label = 0;
 }
 
+// Makes room for element n of a table of n elements. The table
+// is reallocated when n is a power of two, doubling its size.
+//
+template <class T> static T *grow(T *p, int n)
+{
+    T *q;
+
+    if (n & (n - 1))
+        return p;
+    q = new T[n ? 2 * n : 1];
+    for (int i = 0; i < n; i++)
+        q[i] = p[i];
+    delete[] p;
+    return q;
+}
+
+// Words used by a group in a bitset of all stops. A group has
+// at least one, so the presets of an instrument with up to 32
+// stops per group are the same as before.
+//
+static int group_words(int nifelm)
+{
+    return (nifelm > 32) ? (nifelm + 31) >> 5 : 1;
+}
+
+// Deletes tables of divisions and groups, with their ranks
+// and stops.
+//
+static void free_tables(Divis *D, int ndivis, Group *G, int ngroup)
+{
+    int d, r;
+
+    for (d = 0; d < ndivis; d++)
+    {
+        for (r = 0; r < D[d]._nrank; r++)
+            delete D[d]._ranks[r]._synth;
+        delete[] D[d]._ranks;
+    }
+    for (d = 0; d < ngroup; d++)
+        delete[] G[d]._ifelms;
+    delete[] D;
+    delete[] G;
+}
+
 Model::Model(Lfq_u32 *qcomm,
              Lfq_u8 *qmidi,
              uint16_t *midimap,
@@ -66,7 +117,9 @@ Model::Model(Lfq_u32 *qcomm,
              const char *stopsdir,
              const char *instrdir,
              const char *wavesdir,
-             bool uhome) : A_thread("Model"),
+             bool uhome,
+             const char *irfile,
+             bool prmem) : A_thread("Model"),
                            _qcomm(qcomm),
                            _qmidi(qmidi),
                            _midimap(midimap),
@@ -74,26 +127,69 @@ Model::Model(Lfq_u32 *qcomm,
                            _stopsdir(stopsdir),
                            _uhome(uhome),
                            _ready(false),
+                           _qhold(false),
+                           _qpend(0),
+                           _regpend(false),
+                           _irfile(irfile),
+                           _prmem(prmem),
+                           _divis(0),
+                           _group(0),
                            _nasect(0),
                            _ndivis(0),
+                           _naudiv(0),
                            _nkeybd(0),
                            _ngroup(0),
+                           _nword(0),
+                           _pbits(0),
                            _count(0),
                            _bank(0),
                            _pres(0),
                            _sc_cmode(0),
                            _sc_group(0),
+                           _instrname(instrdir),
+                           _nstep(0),
+                           _istep(-1),
+                           _stamp(0),
+                           _agen(0),
                            _audio(0)
                            //_midi(0)
 {
+    const char *p, *q;
+
     sprintf(_instrdir, "%s/%s", stopsdir, instrdir);
     sprintf(_wavesdir, "%s/%s", stopsdir, wavesdir);
     memset(_midimap, 0, 16 * sizeof(uint16_t));
-    memset(_preset, 0, NBANK * NPRES * sizeof(Preset *));
+
+    // With -u the preset store is in the home directory, with a
+    // file per instrument. The old shared file is used to start
+    // it if there is none yet.
+    if (_uhome)
+    {
+        p = getenv("HOME");
+        q = strrchr(_instrname, '/');
+        q = q ? q + 1 : _instrname;
+        if (p)
+        {
+            sprintf(_prpath, "%s/.aeolus-presets-%s", p, q);
+            sprintf(_prlegacy, "%s/.aeolus-presets", p);
+        }
+        else
+        {
+            sprintf(_prpath, ".aeolus-presets-%s", q);
+            strcpy(_prlegacy, ".aeolus-presets");
+        }
+    }
+    else
+    {
+        sprintf(_prpath, "%s/presets", _instrdir);
+        *_prlegacy = 0;
+    }
 }
 
 Model::~Model(void)
 {
+    free_instr();
+    delete[] _pbits;
     if (_audio)
         _audio->recover();
     //if (_midi)
@@ -104,11 +200,22 @@ void Model::thr_main(void)
 {
     int E;
 
+    // MIDI input raises EV_QMIDI, so there is no need to poll
+    // qmidi. The timer is only used to retry a registration
+    // snapshot that did not fit in qcomm.
     init();
-    set_time(0);
-    inc_time(100000);
-    while ((E = get_event_timed()) != EV_EXIT)
+    while (true)
     {
+        if (_regpend)
+        {
+            set_time(0);
+            inc_time(5000);
+            E = get_event_timed();
+        }
+        else
+            E = get_event();
+        if (E == EV_EXIT)
+            break;
         switch (E)
         {
         case FM_AUDIO:
@@ -119,8 +226,7 @@ void Model::thr_main(void)
             break;
 
         case EV_TIME:
-            inc_time(50000);
-            proc_qmidi();
+            send_regist();
             break;
 
         case EV_QMIDI:
@@ -136,10 +242,22 @@ void Model::thr_main(void)
 
 void Model::init(void)
 {
-    read_instr();
+    if (read_image() && !read_instr())
+        write_image(true);
+    init_bits();
     read_presets();
 }
 
+// Reads the instrument definition and writes the image,
+// without starting the model.
+//
+int Model::compile(void)
+{
+    if (read_instr())
+        return 1;
+    return write_image();
+}
+
 void Model::fini(void)
 {
     write_presets();
@@ -156,9 +274,11 @@ void Model::proc_mesg(ITC_mesg *M)
     case MT_IFC_ELSET:
     case MT_IFC_ELXOR:
     {
-        // Set, reset or toggle a stop.
+        // Set, reset or toggle a stop. A change applied by OSC
+        // can be undone by commands that the audio thread read
+        // after it, and then has to be sent again.
         M_ifc_ifelm *X = (M_ifc_ifelm *)M;
-        set_ifelm(X->_group, X->_ifelm, X->type() - MT_IFC_ELCLR);
+        set_ifelm(X->_group, X->_ifelm, X->type() - MT_IFC_ELCLR, X->_applied && (_qcomm->nwr() == X->_qpos));
         break;
     }
     case MT_IFC_ELATT:
@@ -212,6 +332,7 @@ void Model::proc_mesg(ITC_mesg *M)
             if (index >= 8)
                 break;
             memcpy(_chconf[X->_index]._bits, X->_bits, 16 * sizeof(uint16_t));
+            _store.set_mconf(X->_index, X->_bits);
         }
         set_mconf(X->_index, X->_bits);
     }
@@ -256,18 +377,16 @@ void Model::proc_mesg(ITC_mesg *M)
     {
         // Store a preset.
         M_ifc_preset *X = (M_ifc_preset *)M;
-        uint32_t d[NGROUP];
-        get_state(d);
-        set_preset(X->_bank, X->_pres, d);
+        get_state(_pbits);
+        set_preset(X->_bank, X->_pres, _pbits);
         break;
     }
     case MT_IFC_PRINS:
     {
         // Insert a preset.
         M_ifc_preset *X = (M_ifc_preset *)M;
-        uint32_t d[NGROUP];
-        get_state(d);
-        ins_preset(X->_bank, X->_pres, d);
+        get_state(_pbits);
+        ins_preset(X->_bank, X->_pres, _pbits);
         break;
     }
     case MT_IFC_PRDEL:
@@ -277,13 +396,35 @@ void Model::proc_mesg(ITC_mesg *M)
         del_preset(X->_bank, X->_pres);
         break;
     }
+    case MT_IFC_SQSET:
+        // Define the preset sequence.
+        set_sequence((M_ifc_sequence *)M);
+        break;
+
+    case MT_IFC_SQGOTO:
+        // Go to a sequence step.
+        seq_goto(((M_ifc_sequence *)M)->_index);
+        break;
+
+    case MT_IFC_SQDEC:
+        // Previous sequence step.
+        seq_goto(_istep - 1);
+        break;
+
+    case MT_IFC_SQINC:
+        // Next sequence step.
+        seq_goto(_istep + 1);
+        break;
+
     case MT_IFC_PRGET:
     {
-        // Read a preset.
+        // Read a preset. On input _stat is the source of the
+        // request, which gets the reply.
         M_ifc_preset *X = (M_ifc_preset *)M;
-        X->_stat = get_preset(X->_bank, X->_pres, X->_bits);
-        send_event(TO_IFACE, M);
-        M = 0;
+        M_ifc_preset *Y = new M_ifc_preset(MT_IFC_PRGET, X->_bank, X->_pres, 0, _nword);
+        Y->_stat = get_preset(X->_bank, X->_pres, Y->_bits);
+        Y->_tag = X->_tag;
+        send_event((X->_stat == FM_OSC) ? TO_OSC : TO_IFACE, Y);
         break;
     }
     case MT_IFC_EDIT:
@@ -311,6 +452,29 @@ void Model::proc_mesg(ITC_mesg *M)
         // Save presets, midi presets, and wavetables.
         save();
         break;
+    case MT_IFC_RELOAD:
+        // Reload the instrument definition.
+        reload();
+        break;
+    case MT_IFC_PRLOAD:
+    {
+        // Replace the presets.
+        M_ifc_prload *X = (M_ifc_prload *)M;
+        load_presets(X->_data, X->_size);
+        break;
+    }
+    case MT_IFC_BUNDLE:
+    {
+        // Apply a group of messages as one update.
+        M_ifc_bundle *X = (M_ifc_bundle *)M;
+        _qhold = true;
+        for (int i = 0; i < X->_nmesg; i++)
+            proc_mesg(X->_mesg[i]);
+        _qhold = false;
+        _qcomm->write_commit(_qpend);
+        _qpend = 0;
+        break;
+    }
     case MT_LOAD_RANK:
     case MT_CALC_RANK:
     {
@@ -326,15 +490,33 @@ void Model::proc_mesg(ITC_mesg *M)
         init_audio();
         init_iface();
         init_ranks(MT_LOAD_RANK);
+        if (_irfile)
+            load_ir(_irfile);
+        break;
+    case MT_LOAD_IR:
+    {
+        // Reverb engine replaced, delete the old one.
+        M_load_ir *X = (M_load_ir *)M;
+        delete X->_old;
         break;
+    }
     case MT_AUDIO_SYNC:
         // Wavetable calculation done.
         send_event(TO_IFACE, new ITC_mesg(MT_IFC_READY));
+        send_actions(TO_AUDIO);
+        send_actions(TO_OSC);
+        // Also undoes stop changes made with the actions
+        // of a definition that has been reloaded.
+        send_regist();
         send_event(TO_OSC, new ITC_mesg(MT_IFC_READY));
         _ready = true;
         printf("Ready\n");
         break;
 
+    case MT_IFC_ACTIONS:
+        // Replaced by the audio thread.
+        break;
+
     default:
         fprintf(stderr, "Model: unexpected message, type = %ld\n", M->type());
     }
@@ -454,13 +636,17 @@ void Model::proc_qmidi(void)
     }
 }
 
+// Sends the divisions that the audio thread does not have yet.
+// They go through the slave thread, so they are created before
+// any of their ranks arrive.
+//
 void Model::init_audio(void)
 {
     int d;
     Divis *D;
     M_new_divis *M;
 
-    for (d = 0, D = _divis; d < _ndivis; d++, D++)
+    for (d = _naudiv, D = _divis + d; d < _ndivis; d++, D++)
     {
         M = new M_new_divis();
         M->_flags = D->_flags;
@@ -469,8 +655,9 @@ void Model::init_audio(void)
         M->_swell = D->_param[Divis::SWELL]._val;
         M->_tfreq = D->_param[Divis::TFREQ]._val;
         M->_tmodd = D->_param[Divis::TMODD]._val;
-        send_event(TO_AUDIO, M);
+        send_event(TO_SLAVE, M);
     }
+    _naudiv = _ndivis;
 }
 
 void Model::init_iface(void)
@@ -481,7 +668,7 @@ void Model::init_iface(void)
     Divis *D;
     Group *G;
 
-    M = new M_ifc_init;
+    M = new M_ifc_init(_ndivis, _ngroup);
     M->_stopsdir = _stopsdir;
     M->_wavesdir = _wavesdir;
     M->_instrdir = _instrdir;
@@ -492,6 +679,7 @@ void Model::init_iface(void)
     M->_nkeybd = _nkeybd;
     M->_ndivis = _ndivis;
     M->_ngroup = _ngroup;
+    M->_nword = _nword;
     M->_ntempe = NSCALES;
     for (i = 0; i < NKEYBD; i++)
     {
@@ -499,22 +687,24 @@ void Model::init_iface(void)
         M->_keybdd[i]._label = K->_label;
         M->_keybdd[i]._pedal = K->_pedal;
     }
-    for (i = 0; i < NDIVIS; i++)
+    for (i = 0; i < _ndivis; i++)
     {
         D = _divis + i;
-        M->_divisd[i]._label = D->_label;
+        strcpy(M->_divisd[i]._label, D->_label);
         M->_divisd[i]._flags = D->_flags;
         M->_divisd[i]._asect = D->_asect;
     }
-    for (i = 0; i < NGROUP; i++)
+    for (i = 0; i < _ngroup; i++)
     {
         G = _group + i;
-        M->_groupd[i]._label = G->_label;
+        strcpy(M->_groupd[i]._label, G->_label);
         M->_groupd[i]._nifelm = G->_nifelm;
+        M->_groupd[i]._iword = G->_iword;
+        M->_groupd[i]._ifelmd = new M_ifc_init::Ifelmd[G->_nifelm];
         for (j = 0; j < G->_nifelm; j++)
         {
-            M->_groupd[i]._ifelmd[j]._label = G->_ifelms[j]._label;
-            M->_groupd[i]._ifelmd[j]._mnemo = G->_ifelms[j]._mnemo;
+            strcpy(M->_groupd[i]._ifelmd[j]._label, G->_ifelms[j]._label);
+            strcpy(M->_groupd[i]._ifelmd[j]._mnemo, G->_ifelms[j]._mnemo);
             M->_groupd[i]._ifelmd[j]._type = G->_ifelms[j]._type;
         }
     }
@@ -610,24 +800,47 @@ void Model::proc_rank(int g, int i, int comm)
     }
 }
 
-void Model::set_ifelm(int g, int i, int m)
+// Writes a command of one or two words to the audio thread.
+// While _qhold is set commands are only committed at the end,
+// so the audio thread sees all of them in the same period.
+//
+bool Model::send_comm(int n, uint32_t w0, uint32_t w1)
+{
+    if (_qcomm->write_avail() < _qpend + n)
+        return false;
+    _qcomm->write(_qpend, w0);
+    if (n > 1)
+        _qcomm->write(_qpend + 1, w1);
+    if (_qhold)
+        _qpend += n;
+    else
+        _qcomm->write_commit(n);
+    return true;
+}
+
+// Changes the state of a stop. If applied is set the audio
+// thread already has the change, and only the state and the
+// interfaces are updated.
+//
+void Model::set_ifelm(int g, int i, int m, bool applied)
 {
     int s;
     Ifelm *I;
     Group *G;
 
+    if ((!_ready) || (g < 0) || (g >= _ngroup))
+        return;
     G = _group + g;
-    if ((!_ready) || (g >= _ngroup) || (i >= G->_nifelm))
+    if ((i < 0) || (i >= G->_nifelm))
         return;
     I = G->_ifelms + i;
     s = (m == 2) ? I->_state ^ 1 : m;
     if (I->_state != s)
     {
         I->_state = s;
-        if (_qcomm->write_avail())
+        _stamp++;
+        if (applied || send_comm(1, s ? I->_action1 : I->_action0))
         {
-            _qcomm->write(0, s ? I->_action1 : I->_action0);
-            _qcomm->write_commit(1);
             send_event (TO_IFACE, new M_ifc_ifelm (MT_IFC_ELCLR + s, g, i));
             send_event (TO_OSC, new M_ifc_ifelm (MT_IFC_ELCLR + s, g, i));
         }
@@ -640,71 +853,160 @@ void Model::clr_group(int g)
     Ifelm *I;
     Group *G;
 
-    G = _group + g;
-    if ((!_ready) || (g >= _ngroup))
+    if ((!_ready) || (g < 0) || (g >= _ngroup))
         return;
 
+    G = _group + g;
     for (i = 0; i < G->_nifelm; i++)
     {
         I = G->_ifelms + i;
         if (I->_state)
         {
             I->_state = 0;
-            if (_qcomm->write_avail())
+            _stamp++;
+            send_comm(1, I->_action0);
+        }
+    }
+    send_event(TO_IFACE, new M_ifc_ifelm(MT_IFC_GRCLR, g, 0));
+    send_event(TO_OSC, new M_ifc_ifelm(MT_IFC_GRCLR, g, 0));
+}
+
+void Model::send_actions(int dest)
+{
+    int g, i, k;
+    M_ifc_actions *M;
+    Group *G;
+
+    M = new M_ifc_actions(_ngroup, _nword);
+    M->_gen = _agen;
+    for (g = 0; g < _ngroup; g++)
+    {
+        G = _group + g;
+        M->_nifelm[g] = G->_nifelm;
+        M->_iword[g] = G->_iword;
+        for (i = 0; i < G->_nifelm; i++)
+        {
+            k = 32 * G->_iword + i;
+            M->_action[k][0] = G->_ifelms[i]._action0;
+            M->_action[k][1] = G->_ifelms[i]._action1;
+        }
+    }
+    send_event(dest, M);
+}
+
+// Sends the state of all stops to the audio thread as a single
+// command, with the bitset of all stops, which is applied in one
+// period. If diff is given it follows as a second bitset, and
+// only the stops in it are changed. If there is no room in the
+// queue a full snapshot is sent later, then including any changes
+// made in the mean time. The low 7 bits of the generation of the
+// action table it is meant for are sent with it.
+//
+void Model::send_regist(const uint32_t *diff)
+{
+    int g, i, k, n;
+    uint32_t s;
+    Group *G;
+
+    n = diff ? 2 * _nword : _nword;
+    if (_qcomm->write_avail() < _qpend + n + 1)
+    {
+        _regpend = true;
+        return;
+    }
+    _qcomm->write(_qpend, (18 << 24) | ((((_agen & 127) << 1) | (diff ? 1 : 0)) << 16) | _nword);
+    for (g = 0; g < _ngroup; g++)
+    {
+        G = _group + g;
+        for (k = 0; k < group_words(G->_nifelm); k++)
+        {
+            s = 0;
+            for (i = 32 * k; (i < 32 * k + 32) && (i < G->_nifelm); i++)
             {
-                _qcomm->write(0, I->_action0);
-                _qcomm->write_commit(1);
+                if (G->_ifelms[i]._state & 1)
+                    s |= 1u << (i & 31);
             }
+            _qcomm->write(_qpend + G->_iword + k + 1, s);
         }
     }
-    send_event(TO_IFACE, new M_ifc_ifelm(MT_IFC_GRCLR, g, 0));
+    for (k = 0; diff && (k < _nword); k++)
+        _qcomm->write(_qpend + _nword + k + 1, diff[k]);
+    if (_qhold)
+        _qpend += n + 1;
+    else
+        _qcomm->write_commit(n + 1);
+    _regpend = false;
 }
 
 void Model::get_state(uint32_t *d)
 {
     int g, i;
-    uint32_t s;
+    uint32_t *s;
     Group *G;
-    Ifelm *I;
 
+    memset(d, 0, _nword * sizeof(uint32_t));
     for (g = 0; g < _ngroup; g++)
     {
         G = _group + g;
-        s = 0;
+        s = d + G->_iword;
         for (i = 0; i < G->_nifelm; i++)
         {
-            I = G->_ifelms + i;
-            if (I->_state & 1)
-                s |= 1 << i;
+            if (G->_ifelms[i]._state & 1)
+                s[i >> 5] |= 1u << (i & 31);
         }
-        *d++ = s;
     }
 }
 
 void Model::set_state(int bank, int pres)
 {
-    int g, i;
-    uint32_t d[NGROUP], s;
+    recall(bank, pres, get_preset(bank, pres, _pbits) ? _pbits : 0, 0);
+}
+
+// Sets the stops to bits, the state of preset (bank, pres), and
+// informs the interfaces. If diff is given it must have the stops
+// that differ from the current state, and only these are sent to
+// the audio thread.
+//
+void Model::recall(int bank, int pres, uint32_t *bits, const uint32_t *diff)
+{
+    int g, i, s;
+    uint32_t *d;
     Group *G;
+    Ifelm *I;
 
     _bank = bank;
     _pres = pres;
-    if (get_preset(bank, pres, d))
+    d = bits;
+    if (d)
     {
-        for (g = 0; g < _ngroup; g++)
+        for (g = 0; _ready && (g < _ngroup); g++)
         {
-            s = d[g];
             G = _group + g;
             for (i = 0; i < G->_nifelm; i++)
             {
-                set_ifelm(g, i, s & 1);
-                s >>= 1;
+                I = G->_ifelms + i;
+                s = (d[G->_iword + (i >> 5)] >> (i & 31)) & 1;
+                if (I->_state != s)
+                {
+                    I->_state = s;
+                    send_event(TO_IFACE, new M_ifc_ifelm(MT_IFC_ELCLR + I->_state, g, i));
+                    send_event(TO_OSC, new M_ifc_ifelm(MT_IFC_ELCLR + I->_state, g, i));
+                }
             }
         }
-        send_event(TO_IFACE, new M_ifc_preset(MT_IFC_PRRCL, bank, pres, _ngroup, d));
+        if (_ready)
+        {
+            _stamp++;
+            send_regist(diff);
+        }
+        send_event(TO_IFACE, new M_ifc_preset(MT_IFC_PRRCL, bank, pres, _ngroup, _nword, d));
+        send_event(TO_OSC, new M_ifc_preset(MT_IFC_PRRCL, bank, pres, _ngroup, _nword, d));
     }
     else
-        send_event(TO_IFACE, new M_ifc_preset(MT_IFC_PRRCL, bank, pres, 0, 0));
+    {
+        send_event(TO_IFACE, new M_ifc_preset(MT_IFC_PRRCL, bank, pres, 0));
+        send_event(TO_OSC, new M_ifc_preset(MT_IFC_PRRCL, bank, pres, 0));
+    }
 }
 
 void Model::set_aupar(int s, int a, int p, float v)
@@ -718,6 +1020,7 @@ void Model::set_aupar(int s, int a, int p, float v)
         v = P->_max;
     P->_val = v;
     send_event(TO_IFACE, new M_ifc_aupar(s, a, p, v));
+    send_event(TO_OSC, new M_ifc_aupar(s, a, p, v));
 }
 
 void Model::set_dipar(int s, int d, int p, float v)
@@ -729,19 +1032,19 @@ void Model::set_dipar(int s, int d, int p, float v)
         float f;
     } u;
 
+    if ((d < 0) || (d >= _ndivis))
+        return;
     P = _divis[d]._param + p;
     if (v < P->_min)
         v = P->_min;
     if (v > P->_max)
         v = P->_max;
     P->_val = v;
-    if (_qcomm->write_avail() >= 2)
+    u.f = v;
+    if (send_comm(2, (17 << 24) | (p << 16) | (d << 8), u.i))
     {
-        u.f = v;
-        _qcomm->write(0, (17 << 24) | (p << 16) | (d << 8));
-        _qcomm->write(1, u.i);
-        _qcomm->write_commit(2);
         send_event(TO_IFACE, new M_ifc_dipar(s, d, p, v));
+        send_event(TO_OSC, new M_ifc_dipar(s, d, p, v));
     }
 }
 
@@ -754,11 +1057,7 @@ void Model::set_mconf(int i, uint16_t *d)
 
 void Model::midi_off(int keybd)
 {
-    if (_qcomm->write_avail())
-    {
-        _qcomm->write(0, (2 << 24) | keybd);
-        _qcomm->write_commit(1);
-    }
+    send_comm(1, (2 << 24) | keybd);
 }
 
 void Model::retune(float freq, int temp)
@@ -773,6 +1072,21 @@ void Model::retune(float freq, int temp)
         send_event(TO_IFACE, new M_ifc_retune(_fbase, _itemp));
 }
 
+void Model::load_ir(const char *path)
+{
+    M_load_ir *M;
+
+    // The IR is loaded by the slave thread, and passed
+    // from there to the audio thread.
+    M = new M_load_ir(path);
+    M->_fsamp = _audio->_fsamp;
+    M->_fsize = _audio->_fsize;
+    M->_policy = _audio->_policy;
+    M->_relpri = _audio->_relpri;
+    M->_revlat = _audio->_revlat;
+    send_event(TO_SLAVE, M);
+}
+
 void Model::recalc(int g, int i)
 {
     _count++;
@@ -787,6 +1101,7 @@ void Model::save(void)
     Group *G;
 
     write_instr();
+    write_image(true);
     write_presets();
     _ready = false;
     for (g = 0; g < _ngroup; g++)
@@ -798,11 +1113,188 @@ void Model::save(void)
     send_event(TO_SLAVE, new ITC_mesg(MT_AUDIO_SYNC));
 }
 
+// Sets the place of each group in a bitset of all stops, and
+// allocates the bitsets used by the model.
+//
+void Model::init_bits(void)
+{
+    int g, k;
+
+    _nword = 0;
+    for (g = 0; g < _ngroup; g++)
+    {
+        _group[g]._iword = _nword;
+        _nword += group_words(_group[g]._nifelm);
+    }
+    delete[] _pbits;
+    _pbits = new uint32_t[_nword];
+    for (k = 0; k < 2; k++)
+    {
+        delete[] _ahead[k]._bits;
+        delete[] _ahead[k]._diff;
+        _ahead[k]._index = -1;
+        _ahead[k]._bits = new uint32_t[_nword];
+        _ahead[k]._diff = new uint32_t[_nword];
+    }
+}
+
+void Model::free_instr(void)
+{
+    free_tables(_divis, _ndivis, _group, _ngroup);
+    _divis = 0;
+    _group = 0;
+    _ndivis = 0;
+    _ngroup = 0;
+}
+
+// True if two ranks have the same wavetables, pan and delay.
+//
+static bool same_rank(const Addsynth *A, const Addsynth *B)
+{
+    const char *p = (const char *)(&A->_n0);
+    const char *q = (const char *)(&A->_h_atp + 1);
+
+    if ((A->_pan != B->_pan) || (A->_del != B->_del))
+        return false;
+    return !memcmp(p, (const char *)(&B->_n0), q - p);
+}
+
+// Reads the instrument definition again while running. Divisions
+// and ranks are matched by position, and the ranks that are the
+// same keep their wavetables. Other ranks are loaded or computed
+// as on startup. All stops are cleared. If the definition can't
+// be read the current instrument is kept.
+//
+void Model::reload(void)
+{
+    int d, r, g, nasect, nkeybd, ndivis, ngroup, nword, itemp;
+    float fbase;
+    bool retuned;
+    Asect A[NASECT];
+    Keybd K[NKEYBD];
+    Divis *D, *E;
+    Group *G;
+    Rank *R, *S;
+    union
+    {
+        uint32_t i;
+        float f;
+    } u;
+
+    if (!_ready)
+        return;
+    // Room for a reset and the parameters of each division.
+    if (_qcomm->write_avail() < _qpend + 8 * _naudiv)
+    {
+        fprintf(stderr, "Can't reload the instrument now\n");
+        return;
+    }
+
+    for (d = 0; d < NASECT; d++)
+    {
+        A[d] = _asect[d];
+        _asect[d] = Asect();
+    }
+    for (d = 0; d < NKEYBD; d++)
+    {
+        K[d] = _keybd[d];
+        _keybd[d] = Keybd();
+    }
+    D = _divis;
+    G = _group;
+    nasect = _nasect;
+    nkeybd = _nkeybd;
+    ndivis = _ndivis;
+    ngroup = _ngroup;
+    nword = _nword;
+    fbase = _fbase;
+    itemp = _itemp;
+    _divis = 0;
+    _group = 0;
+    _nasect = _nkeybd = _ndivis = _ngroup = 0;
+
+    if (read_instr())
+    {
+        fprintf(stderr, "Reload failed, keeping the current instrument\n");
+        free_instr();
+        for (d = 0; d < NASECT; d++)
+            _asect[d] = A[d];
+        for (d = 0; d < NKEYBD; d++)
+            _keybd[d] = K[d];
+        _divis = D;
+        _group = G;
+        _nasect = nasect;
+        _nkeybd = nkeybd;
+        _ndivis = ndivis;
+        _ngroup = ngroup;
+        _fbase = fbase;
+        _itemp = itemp;
+        return;
+    }
+
+    // Keep the ranks that have not changed. Setting their
+    // count to the one init_ranks() will use skips them.
+    retuned = (_fbase != fbase) || (_itemp != itemp);
+    for (d = 0; d < _ndivis; d++)
+    {
+        for (r = 0; r < _divis[d]._nrank; r++)
+        {
+            R = _divis[d]._ranks + r;
+            S = (d < ndivis) && (r < D[d]._nrank) ? D[d]._ranks + r : 0;
+            if (!retuned && S && S->_rwave && same_rank(R->_synth, S->_synth))
+            {
+                delete R->_synth;
+                *R = *S;
+                R->_count = _count + 1;
+                S->_synth = 0;
+            }
+        }
+    }
+    free_tables(D, ndivis, G, ngroup);
+    init_bits();
+
+    // Reset the divisions in the audio thread. This clears
+    // all stops and deletes the ranks that are not used.
+    // Snapshots from now on are for the actions of the new
+    // definition.
+    _agen++;
+    for (d = 0; d < _naudiv; d++)
+    {
+        E = _divis + d;
+        if (d < _ndivis)
+        {
+            send_comm(2, (19 << 24) | (d << 8) | E->_asect, (E->_nrank << 16) | (E->_keybd & 0xFFFF));
+            for (r = 0; r < Divis::NPARAM; r++)
+            {
+                u.f = E->_param[r]._val;
+                send_comm(2, (17 << 24) | (r << 16) | (d << 8), u.i);
+            }
+        }
+        else
+            send_comm(2, (19 << 24) | (d << 8), 0xFFFF);
+    }
+    // Stop changes from OSC go through the model until
+    // the new actions are sent.
+    send_event(TO_OSC, new M_ifc_actions());
+    for (g = 0; g < ngroup; g++)
+        send_event(TO_OSC, new M_ifc_ifelm(MT_IFC_GRCLR, g, 0));
+    _stamp++;
+
+    init_audio();
+    if (_nword != nword)
+        read_presets();
+    init_iface();
+    init_ranks(MT_LOAD_RANK);
+    write_image(true);
+}
+
 Rank *Model::find_rank(int g, int i)
 {
     int d, r;
     Ifelm *I;
 
+    if ((g < 0) || (g >= _ngroup) || (i < 0) || (i >= _group[g]._nifelm))
+        return 0;
     I = _group[g]._ifelms + i;
     if ((I->_type == Ifelm::DIVRANK) || (I->_type == Ifelm::KBDRANK))
     {
@@ -951,6 +1443,7 @@ int Model::read_instr(void)
                     stat = BAD_ASECT;
                 else
                 {
+                    _divis = grow(_divis, _ndivis);
                     D = _divis + _ndivis++;
                     strcpy(D->_label, t1);
                     if (_nasect < s)
@@ -987,6 +1480,7 @@ int Model::read_instr(void)
                     stat = BAD_STR1;
                 else
                 {
+                    _group = grow(_group, _ngroup);
                     G = _group + _ngroup++;
                     strcpy(G->_label, t1);
                 }
@@ -1010,7 +1504,7 @@ int Model::read_instr(void)
         }
         else if (!strcmp(p, "/rank"))
         {
-            if (!D && G)
+            if (!D)
                 stat = BAD_SCOPE;
             else if (sscanf(q, "%c%d%s%n", &c, &d, t1, &n) != 3)
                 stat = ARGS;
@@ -1037,6 +1531,7 @@ int Model::read_instr(void)
                     {
                         A->_pan = c;
                         A->_del = d;
+                        D->_ranks = grow(D->_ranks, D->_nrank);
                         R = D->_ranks + D->_nrank++;
                         R->_count = 0;
                         R->_synth = A;
@@ -1076,6 +1571,7 @@ int Model::read_instr(void)
                     else
                     {
                         d--;
+                        G->_ifelms = grow(G->_ifelms, G->_nifelm);
                         I = G->_ifelms + G->_nifelm++;
                         strcpy(I->_mnemo, t1);
                         strcpy(I->_label, t2);
@@ -1117,6 +1613,7 @@ int Model::read_instr(void)
                     k--;
                     d--;
                     r--;
+                    G->_ifelms = grow(G->_ifelms, G->_nifelm);
                     I = G->_ifelms + G->_nifelm++;
                     R = _divis[d]._ranks + r;
                     strcpy(I->_label, R->_synth->_stopname);
@@ -1160,6 +1657,7 @@ int Model::read_instr(void)
                 {
                     k--;
                     d--;
+                    G->_ifelms = grow(G->_ifelms, G->_nifelm);
                     I = G->_ifelms + G->_nifelm++;
                     strcpy(I->_mnemo, t1);
                     strcpy(I->_label, t2);
@@ -1230,6 +1728,301 @@ int Model::read_instr(void)
     return (stat <= DONE) ? 0 : 2;
 }
 
+// Header of the compiled instrument image. It is followed by the
+// _asect and _keybd arrays, the _ndivis divisions, the _ngroup
+// groups, the stops of all groups in group order, the parameters
+// of all ranks in division and rank order, and an Imgfile for the
+// stop file of each rank. An image is only used with the build
+// that wrote it, and if none of these files and the definition
+// have changed.
+//
+class Imghead
+{
+public:
+    char _magic[8];
+    char _build[48];
+    int32_t _sizes[8];
+    int64_t _dtime;
+    int64_t _dsize;
+    int32_t _nasect;
+    int32_t _nkeybd;
+    int32_t _ndivis;
+    int32_t _ngroup;
+    int32_t _nifelm;
+    int32_t _nsynth;
+    int32_t _itemp;
+    float _fbase;
+};
+
+class Imgfile
+{
+public:
+    int64_t _mtime;
+    int64_t _size;
+};
+
+static const char img_build[48] = VERSION " " __DATE__ " " __TIME__;
+
+// Gets the modification time and size of a file.
+//
+static int img_file(const char *dir, const char *name, Imgfile *F)
+{
+    char path[1200];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (stat(path, &st))
+        return 1;
+    F->_mtime = st.st_mtim.tv_sec * (int64_t)1000000000 + st.st_mtim.tv_nsec;
+    F->_size = st.st_size;
+    return 0;
+}
+
+static void img_sizes(int32_t *s)
+{
+    s[0] = sizeof(Imghead);
+    s[1] = sizeof(Asect);
+    s[2] = sizeof(Keybd);
+    s[3] = sizeof(Divis);
+    s[4] = sizeof(Group);
+    s[5] = sizeof(Ifelm);
+    s[6] = sizeof(Addsynth);
+    s[7] = NASECT | (NKEYBD << 8) | (sizeof(Imgfile) << 16);
+}
+
+// Loads the instrument from the compiled image with a single
+// mmap. Fails if there is no image, or if the definition file
+// or any stop file has changed since it was written.
+//
+int Model::read_image(void)
+{
+    int fd, d, r, n;
+    int32_t sizes[8];
+    size_t k, m;
+    char path[1200];
+    const char *p;
+    struct stat st;
+    Imghead H;
+    Imgfile F0, F1;
+    Addsynth A;
+    Divis *D;
+    Group *G;
+
+    sprintf(path, "%s/definition.img", _instrdir);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 1;
+    if (fstat(fd, &st) || (st.st_size < (off_t)sizeof(Imghead)))
+    {
+        close(fd);
+        return 1;
+    }
+    m = st.st_size;
+    p = (const char *)mmap(0, m, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return 1;
+
+    memcpy(&H, p, sizeof(Imghead));
+    img_sizes(sizes);
+    if (   strcmp(H._magic, "AEOLIMG") || memcmp(H._sizes, sizes, sizeof(sizes))
+        || memcmp(H._build, img_build, sizeof(img_build))
+        || (H._ndivis < 0) || (H._ndivis > NDIVIS) || (H._ngroup < 0) || (H._ngroup > NGROUP)
+        || (H._nifelm < 0) || (H._nifelm > H._ngroup * Group::NIFELM)
+        || (H._nsynth < 0) || (H._nsynth > H._ndivis * NRANKS)
+        || (sizeof(Imghead) + sizeof(_asect) + sizeof(_keybd) + H._ndivis * sizeof(Divis) + H._ngroup * sizeof(Group)
+            + H._nifelm * sizeof(Ifelm) + H._nsynth * (sizeof(Addsynth) + sizeof(Imgfile)) != m))
+    {
+        fprintf(stderr, "File '%s' is not a valid instrument image\n", path);
+        munmap((void *)p, m);
+        return 1;
+    }
+    sprintf(path, "%s/definition", _instrdir);
+    if (!stat(path, &st) && ((st.st_mtim.tv_sec * (int64_t)1000000000 + st.st_mtim.tv_nsec != H._dtime) || (st.st_size != H._dsize)))
+    {
+        printf("Instrument image is out of date\n");
+        munmap((void *)p, m);
+        return 1;
+    }
+    k = m - H._nsynth * (sizeof(Addsynth) + sizeof(Imgfile));
+    for (n = 0; n < H._nsynth; n++)
+    {
+        memcpy(&A, p + k + n * sizeof(Addsynth), sizeof(Addsynth));
+        memcpy(&F0, p + m - (H._nsynth - n) * sizeof(Imgfile), sizeof(Imgfile));
+        A._filename[sizeof(A._filename) - 1] = 0;
+        if (img_file(_stopsdir, A._filename, &F1) || (F0._mtime != F1._mtime) || (F0._size != F1._size))
+        {
+            printf("Instrument image is out of date, '%s' has changed\n", A._filename);
+            munmap((void *)p, m);
+            return 1;
+        }
+    }
+    sprintf(path, "%s/definition.img", _instrdir);
+    printf("Reading '%s'\n", path);
+
+    k = sizeof(Imghead);
+    memcpy(_asect, p + k, sizeof(_asect));
+    k += sizeof(_asect);
+    memcpy(_keybd, p + k, sizeof(_keybd));
+    k += sizeof(_keybd);
+    _divis = new Divis[H._ndivis];
+    memcpy(_divis, p + k, H._ndivis * sizeof(Divis));
+    k += H._ndivis * sizeof(Divis);
+    _group = new Group[H._ngroup];
+    memcpy(_group, p + k, H._ngroup * sizeof(Group));
+    k += H._ngroup * sizeof(Group);
+    _nasect = H._nasect;
+    _nkeybd = H._nkeybd;
+    _ndivis = H._ndivis;
+    _ngroup = H._ngroup;
+    _fbase = H._fbase;
+    _itemp = H._itemp;
+
+    // Check the counts of ranks and stops before the
+    // tables that follow are used.
+    n = r = 0;
+    for (d = 0, D = _divis; d < _ndivis; d++, D++)
+    {
+        D->_ranks = 0;
+        if ((D->_nrank < 0) || (D->_nrank > NRANKS))
+            n = -1;
+        else if (n >= 0)
+            n += D->_nrank;
+    }
+    for (d = 0, G = _group; d < _ngroup; d++, G++)
+    {
+        G->_ifelms = 0;
+        if ((G->_nifelm < 0) || (G->_nifelm > Group::NIFELM))
+            r = -1;
+        else if (r >= 0)
+            r += G->_nifelm;
+    }
+    if ((n != H._nsynth) || (r != H._nifelm))
+    {
+        fprintf(stderr, "Instrument image does not match its ranks\n");
+        munmap((void *)p, m);
+        _ndivis = 0;
+        _ngroup = 0;
+        free_instr();
+        return 2;
+    }
+
+    for (d = 0, G = _group; d < _ngroup; d++, G++)
+    {
+        G->_ifelms = new Ifelm[G->_nifelm];
+        memcpy(G->_ifelms, p + k, G->_nifelm * sizeof(Ifelm));
+        k += G->_nifelm * sizeof(Ifelm);
+        for (r = 0; r < G->_nifelm; r++)
+            G->_ifelms[r]._state = 0;
+    }
+    for (d = 0, D = _divis; d < _ndivis; d++, D++)
+    {
+        D->_ranks = new Rank[D->_nrank];
+        for (r = 0; r < D->_nrank; r++)
+        {
+            D->_ranks[r]._count = 0;
+            D->_ranks[r]._synth = new Addsynth;
+            D->_ranks[r]._rwave = 0;
+            memcpy(D->_ranks[r]._synth, p + k, sizeof(Addsynth));
+            k += sizeof(Addsynth);
+        }
+    }
+    munmap((void *)p, m);
+    return 0;
+}
+
+// Writes the image of the loaded instrument. With quiet set it is
+// only written if the instrument directory is writable, so that a
+// read-only one only gives errors with aeolus -c.
+//
+int Model::write_image(bool quiet)
+{
+    int d, r;
+    char path[1200];
+    char temp[1220];
+    struct stat st;
+    FILE *F;
+    Imghead H;
+    Imgfile S;
+    Divis D;
+    Group G;
+
+    if (quiet && access(_instrdir, W_OK))
+        return 1;
+    sprintf(path, "%s/definition", _instrdir);
+    if (stat(path, &st))
+        return 1;
+    memset(&H, 0, sizeof(Imghead));
+    strcpy(H._magic, "AEOLIMG");
+    memcpy(H._build, img_build, sizeof(img_build));
+    img_sizes(H._sizes);
+    H._dtime = st.st_mtim.tv_sec * (int64_t)1000000000 + st.st_mtim.tv_nsec;
+    H._dsize = st.st_size;
+    H._nasect = _nasect;
+    H._nkeybd = _nkeybd;
+    H._ndivis = _ndivis;
+    H._ngroup = _ngroup;
+    H._itemp = _itemp;
+    H._fbase = _fbase;
+    for (d = 0; d < _ndivis; d++)
+        H._nsynth += _divis[d]._nrank;
+    for (d = 0; d < _ngroup; d++)
+        H._nifelm += _group[d]._nifelm;
+
+    sprintf(path, "%s/definition.img", _instrdir);
+    sprintf(temp, "%s.tmp", path);
+    if (!(F = fopen(temp, "w")))
+    {
+        fprintf(stderr, "Can't open '%s' for writing\n", temp);
+        return 1;
+    }
+    printf("Writing '%s'\n", path);
+    fwrite(&H, sizeof(Imghead), 1, F);
+    fwrite(_asect, sizeof(_asect), 1, F);
+    fwrite(_keybd, sizeof(_keybd), 1, F);
+    // Pointers are set again when the image is read.
+    for (d = 0; d < _ndivis; d++)
+    {
+        D = _divis[d];
+        D._ranks = 0;
+        fwrite(&D, sizeof(Divis), 1, F);
+    }
+    for (d = 0; d < _ngroup; d++)
+    {
+        G = _group[d];
+        G._ifelms = 0;
+        fwrite(&G, sizeof(Group), 1, F);
+    }
+    for (d = 0; d < _ngroup; d++)
+        fwrite(_group[d]._ifelms, sizeof(Ifelm), _group[d]._nifelm, F);
+    for (d = 0; d < _ndivis; d++)
+    {
+        for (r = 0; r < _divis[d]._nrank; r++)
+            fwrite(_divis[d]._ranks[r]._synth, sizeof(Addsynth), 1, F);
+    }
+    for (d = 0; d < _ndivis; d++)
+    {
+        for (r = 0; r < _divis[d]._nrank; r++)
+        {
+            memset(&S, 0, sizeof(Imgfile));
+            img_file(_stopsdir, _divis[d]._ranks[r]._synth->_filename, &S);
+            fwrite(&S, sizeof(Imgfile), 1, F);
+        }
+    }
+    if (ferror(F) | fclose(F))
+    {
+        fprintf(stderr, "Can't write '%s'\n", temp);
+        unlink(temp);
+        return 1;
+    }
+    if (rename(temp, path))
+    {
+        fprintf(stderr, "Can't rename '%s'\n", temp);
+        unlink(temp);
+        return 1;
+    }
+    return 0;
+}
+
 int Model::write_instr(void)
 {
     FILE *F;
@@ -1325,221 +2118,128 @@ int Model::write_instr(void)
     return 0;
 }
 
-int Model::get_preset(int bank, int pres, uint32_t *bits)
+// Sets the preset sequence. The current step is the first one
+// if the sequence changes, and all steps are read ahead again.
+//
+void Model::set_sequence(M_ifc_sequence *M)
 {
-    int k;
-    Preset *P;
+    int k, n;
 
-    if ((bank < 0) | (pres < 0) || (bank >= NBANK) || (pres >= NPRES))
-        return 0;
-    P = _preset[bank][pres];
-    if (P)
+    n = (M->_nstep < NSTEP) ? M->_nstep : NSTEP;
+    if ((n != _nstep) || memcmp(_steps, M->_steps, n * sizeof(uint16_t)))
     {
-        for (k = 0; k < _ngroup; k++)
-            *bits++ = P->_bits[k];
-        return k;
+        memcpy(_steps, M->_steps, n * sizeof(uint16_t));
+        _nstep = n;
+        _istep = -1;
+        _store.set_steps(_nstep, _steps);
     }
-    return 0;
+    for (k = 0; k < 2; k++)
+        _ahead[k]._index = -1;
+    seq_ahead(_ahead, _istep + 1);
 }
 
-void Model::set_preset(int bank, int pres, uint32_t *bits)
+// Goes to step k of the preset sequence. Steps next to the current
+// one have been read ahead, so if nothing changed since then only
+// the stops that differ are sent to the audio thread.
+//
+void Model::seq_goto(int k)
 {
-    int k;
-    Preset *P;
+    int b, p;
+    Seqstep *S;
 
-    if ((bank < 0) | (pres < 0) || (bank >= NBANK) || (pres >= NPRES))
+    if ((k < 0) || (k >= _nstep))
         return;
-    P = _preset[bank][pres];
-    if (!P)
-    {
-        P = new Preset;
-        _preset[bank][pres] = P;
-    }
-    for (k = 0; k < _ngroup; k++)
-        P->_bits[k] = *bits++;
+    b = _steps[k] >> 8;
+    p = _steps[k] & 255;
+    if (_ahead[0]._index == k)
+        S = _ahead;
+    else if (_ahead[1]._index == k)
+        S = _ahead + 1;
+    else
+        S = 0;
+    _istep = k;
+    if (S && (S->_stamp == _stamp))
+        recall(b, p, S->_found ? S->_bits : 0, S->_diff);
+    else
+        set_state(b, p);
+    seq_ahead(_ahead, k + 1);
+    seq_ahead(_ahead + 1, k - 1);
 }
 
-void Model::ins_preset(int bank, int pres, uint32_t *bits)
+void Model::seq_ahead(Seqstep *S, int k)
 {
-    int j, k;
-    Preset *P;
+    int i;
 
-    if ((bank < 0) | (pres < 0) || (bank >= NBANK) || (pres >= NPRES))
+    S->_index = -1;
+    if ((k < 0) || (k >= _nstep))
         return;
-    P = _preset[bank][NPRES - 1];
-    for (j = NPRES - 1; j > pres; j--)
-        _preset[bank][j] = _preset[bank][j - 1];
-    if (!P)
-    {
-        P = new Preset;
-        _preset[bank][pres] = P;
-    }
-    for (k = 0; k < _ngroup; k++)
-        P->_bits[k] = *bits++;
+    S->_index = k;
+    S->_stamp = _stamp;
+    S->_found = get_preset(_steps[k] >> 8, _steps[k] & 255, S->_bits);
+    get_state(S->_diff);
+    for (i = 0; i < _nword; i++)
+        S->_diff[i] = S->_found ? S->_bits[i] ^ S->_diff[i] : 0;
 }
 
-void Model::del_preset(int bank, int pres)
+int Model::get_preset(int bank, int pres, uint32_t *bits)
 {
-    int j;
+    return _store.get(bank, pres, bits);
+}
 
-    if ((bank < 0) | (pres < 0) || (bank >= NBANK) || (pres >= NPRES))
-        return;
-    delete _preset[bank][pres];
-    for (j = pres; j < NPRES - 1; j++)
-        _preset[bank][j] = _preset[bank][j + 1];
-    _preset[bank][NPRES - 1] = 0;
+void Model::set_preset(int bank, int pres, uint32_t *bits)
+{
+    _store.set(bank, pres, bits);
+    _stamp++;
 }
 
-int Model::read_presets(void)
+void Model::ins_preset(int bank, int pres, uint32_t *bits)
 {
-    int i, j, k, n;
-    char name[1200];
-    unsigned char *p, data[256];
-    FILE *F;
-    Preset *P;
+    _store.insert(bank, pres, bits);
+    _stamp++;
+}
 
-    if (_uhome)
-    {
-        p = (unsigned char *)(getenv("HOME"));
-        if (p)
-            sprintf(name, "%s/.aeolus-presets", p);
-        else
-            strcpy(name, ".aeolus-presets");
-    }
-    else
-    {
-        sprintf(name, "%s/presets", _instrdir);
-    }
-    if (!(F = fopen(name, "r")))
-    {
-        fprintf(stderr, "Can't open '%s' for reading\n", name);
-        return 1;
-    }
+void Model::del_preset(int bank, int pres)
+{
+    _store.remove(bank, pres);
+    _stamp++;
+}
 
-    fread(data, 16, 1, F);
-    if (strcmp((char *)data, "PRESET") || data[7])
-    {
-        fprintf(stderr, "File '%s' is not a valid preset file\n", name);
-        fclose(F);
-        return 1;
-    }
-    n = RD2(data + 14);
+// Opens the preset store.
+//
+int Model::read_presets(void)
+{
+    int i;
 
-    if (fread(data, 256, 1, F) != 1)
-    {
-        fprintf(stderr, "No valid data in file '%s'\n", name);
-        fclose(F);
+    if (_store.open(_prpath, _uhome ? _prlegacy : 0, _nword, _prmem))
         return 1;
-    }
-    p = data;
     for (i = 0; i < 8; i++)
-    {
-        for (j = 0; j < 16; j++)
-        {
-            _chconf[i]._bits[j] = RD2(p);
-            p += 2;
-        }
-    }
-
-    if (n != _ngroup)
-    {
-        fprintf(stderr, "Presets in file '%s' are not compatible\n", name);
-        fclose(F);
-        return 1;
-    }
-    while (fread(data, 4 + 4 * _ngroup, 1, F) == 1)
-    {
-        p = data;
-        i = *p++;
-        j = *p++;
-        p++;
-        p++;
-        if ((i < NBANK) && (j < NPRES))
-        {
-            P = new Preset;
-            for (k = 0; k < _ngroup; k++)
-            {
-                P->_bits[k] = RD4(p);
-                p += 4;
-            }
-            _preset[i][j] = P;
-        }
-    }
-
-    fclose(F);
+        _store.get_mconf(i, _chconf[i]._bits);
+    _nstep = _store.get_steps(_steps);
     return 0;
 }
 
-int Model::write_presets(void)
+// Replaces the presets by the contents of another presets file,
+// if they are valid for this instrument. Used to restore the
+// state of the LV2 plugin.
+//
+void Model::load_presets(const unsigned char *data, int size)
 {
-    int i, j, k, v;
-    char name[1200];
-    unsigned char *p, data[256];
-    FILE *F;
-    Preset *P;
-
-    if (_uhome)
-    {
-        p = (unsigned char *)(getenv("HOME"));
-        if (p)
-            sprintf(name, "%s/.aeolus-presets", p);
-        else
-            strcpy(name, ".aeolus-presets");
-    }
-    else
-    {
-        sprintf(name, "%s/presets", _instrdir);
-    }
-    if (!(F = fopen(name, "w")))
-    {
-        fprintf(stderr, "Can't open '%s' for writing\n", name);
-        return 1;
-    }
-    printf("Writing '%s'\n", name);
-
-    strcpy((char *)data, "PRESET");
-    data[7] = 0;
-    WR2(data + 8, 0);
-    WR2(data + 10, 0);
-    WR2(data + 12, 0);
-    WR2(data + 14, _ngroup);
-    fwrite(data, 16, 1, F);
+    int i;
 
-    p = data;
+    if (_store.load(data, size))
+        return;
     for (i = 0; i < 8; i++)
-    {
-        for (j = 0; j < 16; j++)
-        {
-            v = _chconf[i]._bits[j];
-            WR2(p, v);
-            p += 2;
-        }
-    }
-    fwrite(data, 256, 1, F);
-
-    for (i = 0; i < NBANK; i++)
-    {
-        for (j = 0; j < NPRES; j++)
-        {
-            P = _preset[i][j];
-            if (P)
-            {
-                p = data;
-                *p++ = i;
-                *p++ = j;
-                *p++ = 0;
-                *p++ = 0;
-                for (k = 0; k < _ngroup; k++)
-                {
-                    v = P->_bits[k];
-                    WR4(p, v);
-                    p += 4;
-                }
-                fwrite(data, 4 + 4 * _ngroup, 1, F);
-            }
-        }
-    }
+        _store.get_mconf(i, _chconf[i]._bits);
+    _nstep = _store.get_steps(_steps);
+    _istep = -1;
+    _stamp++;
+    set_mconf(0, _chconf[0]._bits);
+}
 
-    fclose(F);
-    return 0;
+// All changes are already in the file, this only removes
+// the records that are no longer used.
+//
+int Model::write_presets(void)
+{
+    return _store.compact();
 }
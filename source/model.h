@@ -28,6 +28,7 @@
 #include "lfqueue.h"
 #include "addsynth.h"
 #include "rankwave.h"
+#include "prstore.h"
 #include "global.h"
 
 
@@ -67,7 +68,7 @@ public:
     int         _asect;
     int         _keybd;
     Fparm       _param [NPARAM];
-    Rank        _ranks [NRANKS];
+    Rank       *_ranks;
 };
 
     
@@ -104,13 +105,15 @@ class Group
 {
 public:
 
-    enum { NIFELM = NRANKS + 8 };
+    // Limited by the button numbers of the X11 interface.
+    enum { NIFELM = 256 };
 
     Group (void);
 
     char     _label [16];
     int      _nifelm;
-    Ifelm    _ifelms [NIFELM]; 
+    int      _iword; // first word of the group in a bitset
+    Ifelm   *_ifelms; 
 };
 
 
@@ -127,16 +130,25 @@ public:
 };
 
 
-class Preset
+// A preset sequence step read ahead of time, with the stops
+// that differ from the current state. Valid as long as _stamp
+// equals the model's, which changes with any stop or preset.
+//
+class Seqstep
 {
 public:
 
-    Preset (void) { memset (_bits, 0, NGROUP * sizeof (uint32_t)); }
+    Seqstep (void) : _index (-1), _bits (0), _diff (0) {}
+    ~Seqstep (void) { delete[] _bits; delete[] _diff; }
 
-    uint32_t  _bits [NGROUP];
+    int       _index;
+    int       _stamp;
+    int       _found;
+    uint32_t *_bits;
+    uint32_t *_diff;
 };
 
-    
+
 
 class Model : public A_thread
 {
@@ -149,11 +161,15 @@ public:
            const char   *stops,
            const char   *instr,
            const char   *waves,
-           bool          uhome);
+           bool          uhome,
+           const char   *irfile = 0,
+           bool          prmem = false);
 
     virtual ~Model (void);
    
     void terminate (void) {  put_event (EV_EXIT, 1); }
+    int  compile (void);
+    int  presets_fd (void) const { return _store.fd (); }
 
 private:
 
@@ -167,25 +183,39 @@ private:
     void init_iface (void);
     void init_ranks (int comm);
     void proc_rank (int g, int i, int comm);
-    void set_ifelm (int g, int i, int m);
+    bool send_comm (int n, uint32_t w0, uint32_t w1 = 0);
+    void set_ifelm (int g, int i, int m, bool applied = false);
+    void send_actions (int dest);
+    void send_regist (const uint32_t *diff = 0);
     void clr_group (int g);
     void set_aupar (int s, int a, int p, float v);
     void set_dipar (int s, int d, int p, float v);
     void set_mconf (int i, uint16_t *d);
     void get_state (uint32_t *bits);
     void set_state (int bank, int pres);
+    void recall (int bank, int pres, uint32_t *bits, const uint32_t *diff);
+    void set_sequence (M_ifc_sequence *M);
+    void seq_goto (int k);
+    void seq_ahead (Seqstep *S, int k);
     void midi_off (int mask);
     void retune (float freq, int temp);
+    void load_ir (const char *path);
     void recalc (int g, int i);
+    void init_bits (void);
+    void free_instr (void);
+    void reload (void);
     void save (void);
     Rank *find_rank (int g, int i);
     int  read_instr (void);
     int  write_instr (void);
+    int  read_image (void);
+    int  write_image (bool quiet = false);
     int  get_preset (int bank, int pres, uint32_t *bits);
     void set_preset (int bank, int pres, uint32_t *bits);
     void ins_preset (int bank, int pres, uint32_t *bits);
     void del_preset (int bank, int pres);
     int  read_presets (void);
+    void load_presets (const unsigned char *data, int size);
     int  write_presets (void);
 
     Lfq_u32        *_qcomm; 
@@ -195,18 +225,28 @@ private:
     const char     *_stopsdir;
     char            _instrdir [1024];
     char            _wavesdir [1024];
+    char            _prpath [1200];
+    char            _prlegacy [1100];
     bool            _uhome;
     bool            _ready;
+    bool            _qhold;
+    int             _qpend;
+    bool            _regpend;
+    const char     *_irfile;
+    bool            _prmem;
 
     Asect           _asect [NASECT];
     Keybd           _keybd [NKEYBD];
-    Divis           _divis [NDIVIS];
-    Group           _group [NGROUP];
+    Divis          *_divis;
+    Group          *_group;
 
     int             _nasect;
     int             _ndivis;
+    int             _naudiv; // divisions in the audio thread
     int             _nkeybd;
     int             _ngroup;
+    int             _nword; // words in a bitset of all stops
+    uint32_t       *_pbits;
     float           _fbase;
     int             _itemp;
     int             _count;
@@ -217,7 +257,14 @@ private:
     int             _sc_cmode; // stop control command mode
     int             _sc_group; // stop control group number
     Midiconf        _chconf [8];
-    Preset         *_preset [NBANK][NPRES];
+    const char     *_instrname;
+    Prstore         _store;
+    uint16_t        _steps [NSTEP];
+    int             _nstep;
+    int             _istep;
+    int             _stamp;
+    int             _agen;      // generation of the action table
+    Seqstep         _ahead [2];
     M_audio_info   *_audio;
     M_midi_info    *_midi;
 };
@@ -19,16 +19,168 @@
 // ----------------------------------------------------------------------------
 
 #include "osc.h"
+#include "scales.h"
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 
-Osc::Osc(int port, const char *notify_uri) : A_thread("OSC"),
-                                             udp_port(port)
+static int64_t now_ms(void)
 {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+// Dispatch table for incoming OSC messages. A null format accepts
+// any arguments. The table is hashed on the address once, so each
+// message costs one hash, usually one string compare of the
+// address, and one of the format.
+enum
+{
+    OSC_EXIT,
+    OSC_SAVE,
+    OSC_RELOAD,
+    OSC_RETUNE,
+    OSC_STOP,
+    OSC_SET_STOP,
+    OSC_CLEAR_STOP,
+    OSC_TOGGLE_STOP,
+    OSC_CLEAR_GROUP,
+    OSC_AUDIO_PARAM,
+    OSC_DIVISION_PARAM,
+    OSC_NOTES_OFF,
+    OSC_STORE_MIDI,
+    OSC_RECALL_MIDI,
+    OSC_RECALL_PRESET, // must be in this order
+    OSC_STORE_PRESET,  //
+    OSC_INSERT_PRESET, //
+    OSC_DELETE_PRESET, //
+    OSC_GET_PRESET,    //
+    OSC_INC_PRESET,
+    OSC_DEC_PRESET,
+    OSC_SEQUENCE,
+    OSC_SEQ_GOTO,
+    OSC_SEQ_NEXT,
+    OSC_SEQ_PREV,
+    OSC_GET_TEMPERAMENTS,
+    OSC_SUBSCRIBE,
+    OSC_UNSUBSCRIBE
+};
+
+static const struct
+{
+    const char *path;
+    const char *format;
+    int op;
+} osc_commands[] = {
+    {"/exit", 0, OSC_EXIT},
+    {"/quit", 0, OSC_EXIT},
+    {"/save", 0, OSC_SAVE},
+    {"/reload", 0, OSC_RELOAD},
+    {"/retune", "fi", OSC_RETUNE},
+    {"/stop", "iii", OSC_STOP},
+    {"/set_stop", "ii", OSC_SET_STOP},
+    {"/clear_stop", "ii", OSC_CLEAR_STOP},
+    {"/toggle_stop", "ii", OSC_TOGGLE_STOP},
+    {"/clear_group", "i", OSC_CLEAR_GROUP},
+    {"/audio_param", "iif", OSC_AUDIO_PARAM},
+    {"/division_param", "iif", OSC_DIVISION_PARAM},
+    {"/all_notes_off", 0, OSC_NOTES_OFF},
+    {"/store_midi_config", "iiiiiiiiiiiiiiiii", OSC_STORE_MIDI},
+    {"/recall_midi_config", "i", OSC_RECALL_MIDI},
+    {"/recall_preset", "ii", OSC_RECALL_PRESET},
+    {"/inc_preset", 0, OSC_INC_PRESET},
+    {"/dec_preset", 0, OSC_DEC_PRESET},
+    {"/store_preset", "ii", OSC_STORE_PRESET},
+    {"/insert_preset", "ii", OSC_INSERT_PRESET},
+    {"/delete_preset", "ii", OSC_DELETE_PRESET},
+    {"/get_preset", "ii", OSC_GET_PRESET},
+    {"/sequence", 0, OSC_SEQUENCE},
+    {"/seq_goto", "i", OSC_SEQ_GOTO},
+    {"/seq_next", 0, OSC_SEQ_NEXT},
+    {"/seq_prev", 0, OSC_SEQ_PREV},
+    {"/get_temperaments", 0, OSC_GET_TEMPERAMENTS},
+    {"/subscribe", 0, OSC_SUBSCRIBE},
+    {"/unsubscribe", 0, OSC_UNSUBSCRIBE}};
+
+#define OSC_HASH_SIZE 64
+
+static int osc_hash[OSC_HASH_SIZE];
+
+static uint32_t osc_fnv(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s)
+    {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void osc_init_hash(void)
+{
+    static bool done = false;
+    unsigned int i, k;
+
+    if (done)
+        return;
+    done = true;
+    for (i = 0; i < sizeof(osc_commands) / sizeof(osc_commands[0]); i++)
+    {
+        k = osc_fnv(osc_commands[i].path);
+        while (osc_hash[k & (OSC_HASH_SIZE - 1)])
+            k++;
+        osc_hash[k & (OSC_HASH_SIZE - 1)] = i + 1;
+    }
+}
+
+static int osc_lookup(const char *path, const char *format)
+{
+    uint32_t k;
+    int i;
+
+    for (k = osc_fnv(path); (i = osc_hash[k & (OSC_HASH_SIZE - 1)]); k++)
+    {
+        if (strcmp(osc_commands[i - 1].path, path) == 0)
+        {
+            if (osc_commands[i - 1].format && strcmp(osc_commands[i - 1].format, format))
+                return -1;
+            return osc_commands[i - 1].op;
+        }
+    }
+    return -1;
+}
+
+// The OSC interface of instrument index of count, which listen on
+// consecutive ports. Each one sends notifications to its own port:
+// the one in notify_uri plus index, or by default the one after
+// the OSC ports of all instruments plus index.
+//
+Osc::Osc(int port, const char *notify_uri, int index, int count, const float *dspload, Lfq_u32 *qstop, Lfq_u32 *qcomm) : A_thread("OSC"),
+                                                                                                                        udp_port(port),
+                                                                                                                        osc_fd(-1),
+                                                                                                                        epoll_fd(-1),
+                                                                                                                        bundle(0),
+                                                                                                                        stop_queue(qstop),
+                                                                                                                        comm_queue(qcomm),
+                                                                                                                        actions(0),
+                                                                                                                        flush_time(0),
+                                                                                                                        load_time(0),
+                                                                                                                        dsp_load(dspload)
+{
+    // Created here as events may be sent before the thread runs.
+    event_fd = eventfd(0, EFD_NONBLOCK);
+    osc_init_hash();
     if (notify_uri)
     {
         char buffer[1024];
@@ -51,11 +203,13 @@ Osc::Osc(int port, const char *notify_uri) : A_thread("OSC"),
         }
 
         int port_number = 0;
-        if (port_str) port_number = atoi(port_str);
-        else port_number = udp_port + 1;
+        if (port_str) port_number = atoi(port_str) + index;
+        else port_number = udp_port + count;
         
         printf("nofify_addr: %s port_str: %d notify_path: %s\n", notify_addr, port_number, notify_path);
 
+        bool notify;
+        struct sockaddr_in &notify_sockaddr = clients[0];
         memset(notify_sockaddr.sin_zero, '\0', sizeof notify_sockaddr.sin_zero);
         notify_sockaddr.sin_family = AF_INET;
         notify_sockaddr.sin_port = htons(port_number);
@@ -74,6 +228,7 @@ Osc::Osc(int port, const char *notify_uri) : A_thread("OSC"),
         }
         if (notify)
         {
+            nclients = 1;
             char buffer[INET_ADDRSTRLEN];
             inet_ntop(AF_INET, &notify_sockaddr.sin_addr, buffer, sizeof(buffer));
             printf("Sending OSC notifications to %s:%d Path: %s\n", buffer, ntohs(notify_sockaddr.sin_port), notify_path);
@@ -81,8 +236,46 @@ Osc::Osc(int port, const char *notify_uri) : A_thread("OSC"),
     }
 }
 
+Osc::~Osc(void)
+{
+    if (osc_fd >= 0)
+        close(osc_fd);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    if (event_fd >= 0)
+        close(event_fd);
+    delete actions;
+}
+
+int Osc::put_event(unsigned int evid, ITC_mesg *M)
+{
+    int r = A_thread::put_event(evid, M);
+    wake();
+    return r;
+}
+
+int Osc::put_event(unsigned int evid, unsigned int incr)
+{
+    int r = A_thread::put_event(evid, incr);
+    wake();
+    return r;
+}
+
+void Osc::wake(void)
+{
+    uint64_t n = 1;
+
+    // Can only fail if the counter is about to overflow,
+    // in which case the thread is awake anyway.
+    if (write(event_fd, &n, sizeof(n)) != sizeof(n))
+        return;
+}
+
 void Osc::thr_main()
 {
+    struct epoll_event ev, events[2];
+    int i, n;
+
 	// Create sockets for UDP communication
     osc_fd = socket(AF_INET, SOCK_DGRAM, 0);
     fcntl(osc_fd, F_SETFL, O_NONBLOCK);
@@ -93,127 +286,498 @@ void Osc::thr_main()
     bind(osc_fd, (struct sockaddr *)&sin, sizeof(struct sockaddr_in));
     printf("Listening for OSC on port %d\n", udp_port);
 
-    struct timeval timeout;
-	fd_set readSet;
+    epoll_fd = epoll_create1(0);
+    ev.events = EPOLLIN;
+    ev.data.fd = osc_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, osc_fd, &ev);
+    ev.data.fd = event_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev);
+
+    // Handle anything sent before the thread started, then
+    // sleep until either a UDP packet or an ITC event arrives,
+    // or until notifications are due.
+    while (proc_events())
+    {
+        n = epoll_wait(epoll_fd, events, 2, proc_timers());
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.fd == osc_fd)
+                proc_udp();
+        }
+    }
+    send_event(EV_EXIT, 1);
+}
 
-	char buffer[2048];
-	tosc_bundle bundle;
-	tosc_message osc;
+// Handles all pending ITC events. Returns false on EV_EXIT.
+//
+bool Osc::proc_events(void)
+{
+    uint64_t n;
+    int E;
 
-    while (1) {
-        int E = get_event_timed();
-        switch (E) {
-        	case FM_MODEL:
-           		proc_mesg(get_message());
-           		break;
+    // Reset the eventfd before looking at the queue, so
+    // no event can be missed.
+    if (read(event_fd, &n, sizeof(n)) != sizeof(n))
+        n = 0;
+    while ((E = get_event_nowait()) != EV_TIME)
+    {
+        switch (E)
+        {
+        case FM_MODEL:
+            proc_mesg(get_message());
+            break;
+        case EV_EXIT:
+            return false;
         }
+    }
+    return true;
+}
+
+void Osc::proc_udp(void)
+{
+    char buffer[2048];
+    tosc_bundle osc_bundle;
+    tosc_message osc;
+    int len, n;
 
-        FD_ZERO(&readSet);
-        FD_SET(osc_fd, &readSet);
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 10000;
-        if (select(osc_fd + 1, &readSet, NULL, NULL, &timeout) > 0) {
-        	int len = 0;
-			//struct sockaddr_in sa_in;
-			//socklen_t sa_len = sizeof(struct sockaddr_in);
-            //while ((len = (int)recvfrom(osc_fd, buffer, sizeof(buffer), 0, (sockaddr *) &sa_in, &sa_len)) > 0) {
-            while ((len = (int)recvfrom(osc_fd, buffer, sizeof(buffer), 0, NULL, NULL)) > 0) {
-                if (tosc_isBundle(buffer)) {
-                    tosc_parseBundle(&bundle, buffer, len);
-                    while (tosc_getNextMessage(&bundle, &osc)) {
-                        process_osc(&osc);
-                    }
-                }
-                else {
-                    tosc_parseMessage(&osc, buffer, len);
-                    process_osc(&osc);
-                }
+    socklen_t size = sizeof(sender);
+
+    while ((len = (int)recvfrom(osc_fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&sender, &size)) > 0) {
+        if (tosc_isBundle(buffer)) {
+            // A bundle must fit in one M_ifc_bundle to be applied
+            // atomically, larger ones are rejected.
+            tosc_parseBundle(&osc_bundle, buffer, len);
+            for (n = 0; tosc_getNextMessage(&osc_bundle, &osc); n++)
+                ;
+            if (n > M_ifc_bundle::MAXMESG) {
+                fprintf(stderr, "Warning: OSC bundle of %d messages ignored, the limit is %d.\n", n, (int)M_ifc_bundle::MAXMESG);
+                continue;
+            }
+            tosc_parseBundle(&osc_bundle, buffer, len);
+            bundle = new M_ifc_bundle();
+            while (tosc_getNextMessage(&osc_bundle, &osc)) {
+                process_osc(&osc);
             }
+            if (bundle->_nmesg)
+                send_event(TO_MODEL, bundle);
+            else
+                delete bundle;
+            bundle = 0;
+        }
+        else {
+            tosc_parseMessage(&osc, buffer, len);
+            process_osc(&osc);
         }
-        // usleep(10000);
     }
 }
 
+// Sends a message to the model, or adds it to the bundle being
+// received. All messages in a bundle are sent to the model as a
+// single M_ifc_bundle, which it applies as one atomic update.
+// Each OSC message posts at most one, and proc_udp() rejects
+// bundles with more than MAXMESG messages, so it can't be full.
+//
+void Osc::post(ITC_mesg *M)
+{
+    if (!bundle)
+    {
+        send_event(TO_MODEL, M);
+        return;
+    }
+    bundle->_mesg[bundle->_nmesg++] = M;
+}
+
+// Sets or clears a stop. Outside a bundle the action word goes
+// straight to the audio thread, so the change is heard in the
+// next period, and the model only updates its state. The model
+// sends it again if the audio thread may have read any of its
+// commands later, which is the case if it had not read all of
+// them before this write. Bundles go via the model to be applied
+// as a whole.
+//
+void Osc::set_stop(int group, int ifelm, int state)
+{
+    bool applied = false;
+    int qpos = 0;
+
+    if (ready && actions && stop_queue && comm_queue && !bundle && (group >= 0) && (group < actions->_ngroup) && (ifelm >= 0) && (ifelm < actions->_nifelm[group]) && stop_queue->write_avail())
+    {
+        qpos = comm_queue->nrd();
+        stop_queue->write(0, actions->_action[32 * actions->_iword[group] + ifelm][state]);
+        stop_queue->write_commit(1);
+        applied = true;
+    }
+    post(new M_ifc_ifelm(state ? MT_IFC_ELSET : MT_IFC_ELCLR, group, ifelm, applied, qpos));
+}
+
 void Osc::process_osc(tosc_message *osc_msg)
 {
-    if (strcmp(tosc_getAddress(osc_msg), "/exit") == 0)
-        send_event(EV_EXIT, 1);
-    else if (strcmp(tosc_getAddress(osc_msg), "/quit") == 0)
+    int op, a, b, c, i, len;
+    float v;
+    char path[256];
+
+    op = osc_lookup(tosc_getAddress(osc_msg), tosc_getFormat(osc_msg));
+    switch (op)
+    {
+    case OSC_EXIT:
         send_event(EV_EXIT, 1);
-    else if (strcmp(tosc_getAddress(osc_msg), "/save") == 0)
-        send_event(TO_MODEL, new ITC_mesg(MT_IFC_SAVE));
-    else if (strcmp(tosc_getAddress(osc_msg), "/retune") == 0 && strcmp(tosc_getFormat(osc_msg), "fi") == 0)
-        send_event(TO_MODEL, new M_ifc_retune(tosc_getNextFloat(osc_msg), tosc_getNextInt32(osc_msg)));
-    else if (strcmp(tosc_getAddress(osc_msg), "/recall_preset") == 0 && strcmp(tosc_getFormat(osc_msg), "ii") == 0)
-        send_event(TO_MODEL, new M_ifc_preset(MT_IFC_PRRCL, tosc_getNextInt32(osc_msg), tosc_getNextInt32(osc_msg), 0, 0));
-    else if (strcmp(tosc_getAddress(osc_msg), "/store_preset") == 0 && strcmp(tosc_getFormat(osc_msg), "ii") == 0)
-        send_event(TO_MODEL, new M_ifc_preset(MT_IFC_PRSTO, tosc_getNextInt32(osc_msg), tosc_getNextInt32(osc_msg), 0, 0));
-    else if (strcmp(tosc_getAddress(osc_msg), "/inc_preset") == 0)
-        send_event(TO_MODEL, new ITC_mesg(MT_IFC_PRINC));
-    else if (strcmp(tosc_getAddress(osc_msg), "/dec_preset") == 0)
-        send_event(TO_MODEL, new ITC_mesg(MT_IFC_PRDEC));
-    else if (strcmp(tosc_getAddress(osc_msg), "/store_midi_config") == 0 && strcmp(tosc_getFormat(osc_msg), "iiiiiiiiiiiiiiiii") == 0)
-    {
-        int preset = tosc_getNextInt32(osc_msg);
-        for (int i = 0; i < 16; ++i)
+        break;
+    case OSC_SAVE:
+        post(new ITC_mesg(MT_IFC_SAVE));
+        break;
+    case OSC_RELOAD:
+        post(new ITC_mesg(MT_IFC_RELOAD));
+        break;
+    case OSC_RETUNE:
+        v = tosc_getNextFloat(osc_msg);
+        a = tosc_getNextInt32(osc_msg);
+        post(new M_ifc_retune(v, a));
+        break;
+    case OSC_STOP:
+        a = tosc_getNextInt32(osc_msg);
+        b = tosc_getNextInt32(osc_msg);
+        c = tosc_getNextInt32(osc_msg);
+        set_stop(a, b, c ? 1 : 0);
+        break;
+    case OSC_SET_STOP:
+    case OSC_CLEAR_STOP:
+        a = tosc_getNextInt32(osc_msg);
+        b = tosc_getNextInt32(osc_msg);
+        set_stop(a, b, op == OSC_SET_STOP);
+        break;
+    case OSC_TOGGLE_STOP:
+        // Needs the current state, so goes via the model.
+        a = tosc_getNextInt32(osc_msg);
+        b = tosc_getNextInt32(osc_msg);
+        post(new M_ifc_ifelm(MT_IFC_ELXOR, a, b));
+        break;
+    case OSC_CLEAR_GROUP:
+        a = tosc_getNextInt32(osc_msg);
+        post(new M_ifc_ifelm(MT_IFC_GRCLR, a, 0));
+        break;
+    case OSC_AUDIO_PARAM:
+        a = tosc_getNextInt32(osc_msg);
+        b = tosc_getNextInt32(osc_msg);
+        v = tosc_getNextFloat(osc_msg);
+        post(new M_ifc_aupar(FM_OSC, a, b, v));
+        break;
+    case OSC_DIVISION_PARAM:
+        a = tosc_getNextInt32(osc_msg);
+        b = tosc_getNextInt32(osc_msg);
+        v = tosc_getNextFloat(osc_msg);
+        post(new M_ifc_dipar(FM_OSC, a, b, v));
+        break;
+    case OSC_NOTES_OFF:
+        post(new ITC_mesg(MT_IFC_ANOFF));
+        break;
+    case OSC_STORE_MIDI:
+        a = tosc_getNextInt32(osc_msg);
+        for (i = 0; i < 16; ++i)
             midi_config[i] = tosc_getNextInt32(osc_msg);
-        send_event(TO_MODEL, new M_ifc_chconf(MT_IFC_MCSET, preset, midi_config));
+        post(new M_ifc_chconf(MT_IFC_MCSET, a, midi_config));
+        break;
+    case OSC_RECALL_MIDI:
+        a = tosc_getNextInt32(osc_msg);
+        post(new M_ifc_chconf(MT_IFC_MCGET, a, 0));
+        break;
+    case OSC_RECALL_PRESET:
+    case OSC_STORE_PRESET:
+    case OSC_INSERT_PRESET:
+    case OSC_DELETE_PRESET:
+    case OSC_GET_PRESET:
+    {
+        static const int types[5] = {MT_IFC_PRRCL, MT_IFC_PRSTO, MT_IFC_PRINS, MT_IFC_PRDEL, MT_IFC_PRGET};
+        a = tosc_getNextInt32(osc_msg);
+        b = tosc_getNextInt32(osc_msg);
+        // For MT_IFC_PRGET, _stat tells the model where to reply,
+        // and _tag finds the sender when the reply arrives.
+        M_ifc_preset *X = new M_ifc_preset(types[op - OSC_RECALL_PRESET], a, b, FM_OSC, 0);
+        if (op == OSC_GET_PRESET)
+        {
+            X->_tag = nreplies++ & (MAX_OSC_REPLIES - 1);
+            replies[X->_tag] = sender;
+        }
+        post(X);
+        break;
     }
-    else if (strcmp(tosc_getAddress(osc_msg), "/stop") == 0 && strcmp(tosc_getFormat(osc_msg), "iii") == 0)
+    case OSC_INC_PRESET:
+        post(new ITC_mesg(MT_IFC_PRINC));
+        break;
+    case OSC_DEC_PRESET:
+        post(new ITC_mesg(MT_IFC_PRDEC));
+        break;
+    case OSC_SEQUENCE:
     {
-        int div = tosc_getNextInt32(osc_msg);
-        int stop = tosc_getNextInt32(osc_msg);
-        int val = tosc_getNextInt32(osc_msg);
-        if (val)
-            send_event(TO_MODEL, new M_ifc_ifelm(MT_IFC_ELSET, div, stop));
-        else
-            send_event(TO_MODEL, new M_ifc_ifelm(MT_IFC_ELCLR, div, stop));
+        // Pairs of bank and preset numbers, none to clear.
+        M_ifc_sequence *X = new M_ifc_sequence(MT_IFC_SQSET, 0);
+        const char *f = tosc_getFormat(osc_msg);
+        while ((f[0] == 'i') && (f[1] == 'i') && (X->_nstep < NSTEP))
+        {
+            a = tosc_getNextInt32(osc_msg);
+            b = tosc_getNextInt32(osc_msg);
+            X->_steps[X->_nstep++] = ((a & 255) << 8) | (b & 255);
+            f += 2;
+        }
+        post(X);
+        break;
+    }
+    case OSC_SEQ_GOTO:
+        post(new M_ifc_sequence(MT_IFC_SQGOTO, tosc_getNextInt32(osc_msg)));
+        break;
+    case OSC_SEQ_NEXT:
+        post(new ITC_mesg(MT_IFC_SQINC));
+        break;
+    case OSC_SEQ_PREV:
+        post(new ITC_mesg(MT_IFC_SQDEC));
+        break;
+    case OSC_GET_TEMPERAMENTS:
+        sprintf(path, "%s/temperament", notify_path);
+        for (i = 0; i < NSCALES; i++)
+        {
+            len = tosc_writeMessage(osc_buffer, sizeof(osc_buffer), path, "iss", i, scales[i]._label, scales[i]._mnemo);
+            send_to(&sender, len);
+        }
+        break;
+    case OSC_SUBSCRIBE:
+    case OSC_UNSUBSCRIBE:
+        subscribe(osc_msg, op == OSC_SUBSCRIBE);
+        break;
+    default:
+        break;
+    }
+}
+
+// Adds or removes the sender of the message as a client.
+//
+void Osc::subscribe(tosc_message *osc_msg, bool add)
+{
+    struct sockaddr_in addr = sender;
+    int i;
 
+    if (strcmp(tosc_getFormat(osc_msg), "i") == 0)
+        addr.sin_port = htons(tosc_getNextInt32(osc_msg));
+    else if (*tosc_getFormat(osc_msg))
+        return;
+    for (i = 0; i < nclients; i++)
+    {
+        if ((clients[i].sin_addr.s_addr == addr.sin_addr.s_addr) && (clients[i].sin_port == addr.sin_port))
+            break;
+    }
+    if (add && (i == nclients))
+    {
+        if (nclients == MAX_OSC_CLIENTS)
+        {
+            fprintf(stderr, "OSC: too many clients\n");
+            return;
+        }
+        clients[nclients++] = addr;
     }
-    else if (strcmp(tosc_getAddress(osc_msg), "/audio_param") == 0 && strcmp(tosc_getFormat(osc_msg), "iif") == 0)
+    else if (!add && (i < nclients))
+        clients[i] = clients[--nclients];
+}
+
+// Queues a state change. An earlier change of the same item in
+// this tick is replaced, and the new one goes at the end to keep
+// the order of e.g. a group clear and a stop change. There is
+// only one current preset, for other kinds a and b identify the
+// item.
+//
+void Osc::add_change(int kind, int a, int b, int i, float v)
+{
+    int k;
+
+    if (!nclients)
+        return;
+    for (k = 0; k < nchanges; k++)
     {
-        int asect = tosc_getNextInt32(osc_msg);
-        int parid = tosc_getNextInt32(osc_msg);
-        float val = tosc_getNextFloat(osc_msg);
-        send_event(TO_MODEL, new M_ifc_aupar(FM_OSC, asect, parid, val));
+        if ((changes[k].kind == kind) && ((kind == NT_PRESET) || ((changes[k].a == a) && (changes[k].b == b))))
+        {
+            memmove(changes + k, changes + k + 1, (nchanges - k - 1) * sizeof(struct change));
+            nchanges--;
+            break;
+        }
+    }
+    if (nchanges == MAX_OSC_CHANGES)
+        flush();
+    if (!nchanges)
+        flush_time = now_ms() + OSC_TICK_MS;
+    changes[nchanges].kind = kind;
+    changes[nchanges].a = a;
+    changes[nchanges].b = b;
+    changes[nchanges].i = i;
+    changes[nchanges].v = v;
+    nchanges++;
+}
+
+// Sends notifications that are due. Returns the time until the
+// next one in ms, or -1 if there is nothing to wait for.
+//
+int Osc::proc_timers(void)
+{
+    int64_t t = now_ms();
 
+    if (nchanges && (t >= flush_time))
+        flush();
+    if (nclients && dsp_load && (t >= load_time))
+    {
+        add_change(NT_LOAD, 0, 0, 0, *dsp_load);
+        load_time = t + 1000;
     }
-    // else
-    //     tosc_printMessage(osc_msg);
+    if (nchanges)
+        return flush_time - t;
+    if (nclients && dsp_load)
+        return load_time - t;
+    return -1;
 }
 
-void Osc::proc_mesg(ITC_mesg *M)
+// Sends all queued changes to all clients as one OSC bundle,
+// or more if they don't fit in one.
+//
+void Osc::flush(void)
 {
-    if (M)
-        switch (M->type())
+    static const char *names[] = {"ready", "stop", "clear_group", "current_preset", "audio_param", "division_param", "dsp_load"};
+    tosc_bundle B;
+    char path[300];
+    struct change *C;
+    int k;
+
+    tosc_writeBundle(&B, 1, osc_buffer, sizeof(osc_buffer));
+    for (k = 0; k < nchanges; k++)
+    {
+        if (tosc_getBundleLength(&B) + sizeof(path) + 64 > sizeof(osc_buffer))
+        {
+            send_clients(tosc_getBundleLength(&B));
+            tosc_writeBundle(&B, 1, osc_buffer, sizeof(osc_buffer));
+        }
+        C = changes + k;
+        sprintf(path, "%s/%s", notify_path, names[C->kind]);
+        switch (C->kind)
         {
-        case MT_IFC_RETUNE:
-            printf("OSC retune\n");
+        case NT_READY:
+            tosc_writeNextMessage(&B, path, "");
             break;
-        case MT_IFC_READY:
-            printf("OSC ready\n");
-            if (notify)
-            {
-                char buffer[1024], str[1024];
-                sprintf(str, "%s/ready", notify_path);
-                int len = tosc_writeMessage(buffer, sizeof(buffer), str, "");
-                sendto(osc_fd, buffer, len, MSG_CONFIRM | MSG_DONTWAIT, (const struct sockaddr *)&notify_sockaddr, sizeof(notify_sockaddr));
-            }
+        case NT_STOP:
+            tosc_writeNextMessage(&B, path, "iii", C->a, C->b, C->i);
+            break;
+        case NT_GROUP:
+            tosc_writeNextMessage(&B, path, "i", C->a);
+            break;
+        case NT_PRESET:
+            tosc_writeNextMessage(&B, path, "ii", C->a, C->b);
+            break;
+        case NT_AUPAR:
+        case NT_DIPAR:
+            tosc_writeNextMessage(&B, path, "iif", C->a, C->b, C->v);
+            break;
+        case NT_LOAD:
+            tosc_writeNextMessage(&B, path, "f", C->v);
             break;
-        case MT_IFC_ELSET:
-        case MT_IFC_ELCLR:
-            {
-                M_ifc_ifelm *X = (M_ifc_ifelm *)M;
-                printf("OSC received %ld for group %d element %d\n", M->type(), X->_group, X->_ifelm);
-                if (notify)
-                {
-                    char buffer[1024], str[1024];
-                    sprintf(str, "%s/stop", notify_path);
-                    int len = tosc_writeMessage(buffer, sizeof(buffer), str, "");
-                    //!@todo Add parameters!!!
-                    sendto(osc_fd, buffer, len, MSG_CONFIRM | MSG_DONTWAIT, (const struct sockaddr *)&notify_sockaddr, sizeof(notify_sockaddr));
-                }
-            }
         }
+    }
+    send_clients(tosc_getBundleLength(&B));
+    nchanges = 0;
+}
+
+// Sends the message in osc_buffer to all clients.
+//
+void Osc::send_clients(int len)
+{
+    for (int i = 0; i < nclients; i++)
+        sendto(osc_fd, osc_buffer, len, MSG_CONFIRM | MSG_DONTWAIT, (const struct sockaddr *)&clients[i], sizeof(clients[i]));
+}
+
+// Sends the message in osc_buffer to one address.
+//
+void Osc::send_to(const struct sockaddr_in *addr, int len)
+{
+    sendto(osc_fd, osc_buffer, len, MSG_CONFIRM | MSG_DONTWAIT, (const struct sockaddr *)addr, sizeof(*addr));
+}
 
+// Writes an OSC message with the integers of a preset. The
+// number of arguments depends on the instrument, so this can't
+// use the variadic tinyosc writer. Returns the length, or 0 if
+// the buffer is too small.
+//
+static int write_preset(char *buffer, int size, const char *path, M_ifc_preset *M)
+{
+    int i, k, n, len;
+    uint32_t v, head[3] = {(uint32_t)M->_bank, (uint32_t)M->_pres, (uint32_t)M->_stat};
+
+    n = M->_nword + 3;
+    len = ((strlen(path) + 4) & ~3) + ((n + 5) & ~3) + 4 * n;
+    if (len > size)
+        return 0;
+    memset(buffer, 0, len);
+    strcpy(buffer, path);
+    i = (strlen(path) + 4) & ~3;
+    buffer[i] = ',';
+    memset(buffer + i + 1, 'i', n);
+    i += (n + 5) & ~3;
+    for (k = 0; k < n; k++, i += 4)
+    {
+        v = htonl((k < 3) ? head[k] : M->_bits[k - 3]);
+        memcpy(buffer + i, &v, 4);
+    }
+    return len;
+}
+
+void Osc::proc_mesg(ITC_mesg *M)
+{
+    if (!M)
+        return;
+    switch (M->type())
+    {
+    case MT_IFC_READY:
+        printf("OSC ready\n");
+        ready = true;
+        add_change(NT_READY, 0, 0, 0, 0);
+        break;
+    case MT_IFC_ACTIONS:
+        delete actions;
+        actions = (M_ifc_actions *)M;
+        return;
+    case MT_IFC_PRGET:
+    {
+        // Bank, preset, status and the bitset of all stops.
+        M_ifc_preset *X = (M_ifc_preset *)M;
+        char path[300];
+        sprintf(path, "%s/preset", notify_path);
+        int len = write_preset(osc_buffer, sizeof(osc_buffer), path, X);
+        if (len > 0)
+            send_to(&replies[X->_tag & (MAX_OSC_REPLIES - 1)], len);
+        break;
+    }
+    case MT_IFC_PRRCL:
+    {
+        M_ifc_preset *X = (M_ifc_preset *)M;
+        add_change(NT_PRESET, X->_bank, X->_pres, 0, 0);
+        break;
+    }
+    case MT_IFC_ELSET:
+    case MT_IFC_ELCLR:
+    {
+        M_ifc_ifelm *X = (M_ifc_ifelm *)M;
+        add_change(NT_STOP, X->_group, X->_ifelm, M->type() == MT_IFC_ELSET, 0);
+        break;
+    }
+    case MT_IFC_GRCLR:
+    {
+        M_ifc_ifelm *X = (M_ifc_ifelm *)M;
+        add_change(NT_GROUP, X->_group, 0, 0, 0);
+        break;
+    }
+    case MT_IFC_AUPAR:
+    {
+        M_ifc_aupar *X = (M_ifc_aupar *)M;
+        add_change(NT_AUPAR, X->_asect, X->_parid, 0, X->_value);
+        break;
+    }
+    case MT_IFC_DIPAR:
+    {
+        M_ifc_dipar *X = (M_ifc_dipar *)M;
+        add_change(NT_DIPAR, X->_divis, X->_parid, 0, X->_value);
+        break;
+    }
+    }
+    M->recover();
 }
@@ -35,15 +35,67 @@
             int : Preset index
         /inc_preset - Recall next preset in current bank
         /dec_preset - Recall previous preset in current bank
+        /insert_preset - Insert current state as preset
+            int : Bank index
+            int : Preset index
+        /delete_preset - Delete a preset
+            int : Bank index
+            int : Preset index
+        /get_preset - Request a preset, replied to the sender with /preset
+            (bank, preset, status, then the stops as 32-bit words,
+            one per 32 stops of each group)
+            int : Bank index
+            int : Preset index
         /store_midi_config - Store MIDI configuration
             int : MIDI config preset (0..7)
             16 * int : 16-bit word for config of MIDI channel
+        /recall_midi_config - Recall MIDI configuration
+            int : MIDI config preset (0..7)
+        /stop - Set or clear a stop
+            int : Group index
+            int : Stop index
+            int : 0 to clear, other to set
+        /set_stop, /clear_stop, /toggle_stop - Change a stop
+            int : Group index
+            int : Stop index
+        /clear_group - Clear all stops in a group
+            int : Group index
+        /audio_param - Set an audio parameter
+            int : Audio section index, -1 for the instrument
+            int : Parameter index
+            float : Value
+        /division_param - Set a division parameter (swell, tremulant)
+            int : Division index
+            int : Parameter index
+            float : Value
+        /all_notes_off - Release all notes
+        /get_temperaments - Request the temperament list, replied to
+            the sender with one /temperament (index, label, mnemonic) each
+        /subscribe - Receive notifications, at the sender's address
+            or at the sender's IP address and the given port
+            [int : UDP port]
+        /unsubscribe - Stop notifications, with the same arguments
+    All messages in an OSC bundle are applied at the same time.
+
+    Subscribed clients, and the one given on the command line,
+    receive state changes as one OSC bundle per tick. Changes to
+    the same item within a tick are merged. Notifications:
+        /ready
+        /stop - int : group, int : stop, int : state
+        /clear_group - int : group
+        /current_preset - int : bank, int : preset
+        /audio_param - int : section, int : parameter, float : value
+        /division_param - int : division, int : parameter, float : value
+        /dsp_load - float : load of the audio thread, every second
 */
 
 #ifndef __OSC_H
 #define __OSC_H
 
 #define MAX_OSC_CLIENTS 5 // Max quantity of clients that may register for tallies
+#define MAX_OSC_REPLIES 16 // Max number of /get_preset requests in progress, a power of 2
+#define MAX_OSC_CHANGES 64 // Max quantity of state changes in one notification tick
+#define OSC_TICK_MS 5 // Notification interval
 
 #include <clthreads.h>
 #include "messages.h"
@@ -53,25 +105,74 @@
 class Osc : public A_thread
 {
 public:
-    Osc(int port, const char *notify_uri);
-    virtual ~Osc(void) {}
+    Osc(int port, const char *notify_uri, int index = 0, int count = 1, const float *dspload = 0, Lfq_u32 *qstop = 0, Lfq_u32 *qcomm = 0);
+    virtual ~Osc(void);
 
     void terminate(void) { put_event(EV_EXIT, 1); }
 
+    // Wake up the OSC thread when an ITC event arrives.
+    virtual int put_event(unsigned int evid, ITC_mesg *M);
+    virtual int put_event(unsigned int evid, unsigned int incr = 1);
+
 private:
     virtual void thr_main(void);
+    void wake(void);
+    bool proc_events(void);
+    void proc_udp(void);
+    void post(ITC_mesg *M);
+    void set_stop(int group, int ifelm, int state);
+    void subscribe(tosc_message *osc_msg, bool add);
+    void add_change(int kind, int a, int b, int i, float v);
+    int proc_timers(void);
+    void flush(void);
+    void send_clients(int len);
+    void send_to(const struct sockaddr_in *addr, int len);
     void process_osc(tosc_message *osc_msg);
-    void sendOscFloat(const char *path, float value);
-    void sendOscInt(const char *path, int value);
     void proc_mesg(ITC_mesg *M);
+
+    enum
+    {
+        NT_READY,
+        NT_STOP,
+        NT_GROUP,
+        NT_PRESET,
+        NT_AUPAR,
+        NT_DIPAR,
+        NT_LOAD
+    };
+
+    struct change
+    {
+        int kind;
+        int a;
+        int b;
+        int i;
+        float v;
+    };
+
     int udp_port;
     uint16_t midi_config[16];
     int osc_fd;
-    bool notify = false;
-    struct sockaddr_in notify_sockaddr;
+    int event_fd;
+    int epoll_fd;
+    M_ifc_bundle *bundle; // Collects the messages of an OSC bundle
+    Lfq_u32 *stop_queue; // Direct stop changes to the audio thread
+    Lfq_u32 *comm_queue; // Commands from the model to the audio thread
+    M_ifc_actions *actions; // Stop action words, from the model
+    bool ready = false;
     char notify_path[256] = {'\0'};
+    int nclients = 0;
+    struct sockaddr_in clients[MAX_OSC_CLIENTS];
+    struct sockaddr_in sender; // Source of the message being processed
+    int nreplies = 0;
+    struct sockaddr_in replies[MAX_OSC_REPLIES]; // Sources of /get_preset, by tag
+    int nchanges = 0;
+    struct change changes[MAX_OSC_CHANGES];
+    int64_t flush_time;
+    int64_t load_time;
+    const volatile float *dsp_load;
 
-    char osc_buffer[1024]; // Used to send OSC messages
+    char osc_buffer[8192]; // Used to send OSC messages
 };
 
 #endif
@@ -0,0 +1,594 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "prstore.h"
+
+Prstore::Prstore(void) : _fd(-1),
+                         _mem(false),
+                         _nword(0),
+                         _rsize(4),
+                         _data(0),
+                         _fsize(0),
+                         _nstep(0)
+{
+    _path[0] = 0;
+    memset(_offs, 0, sizeof(_offs));
+    memset(_mconf, 0, sizeof(_mconf));
+}
+
+Prstore::~Prstore(void)
+{
+    close();
+    delete[] _data;
+}
+
+// Opens the store at path, or if that does not exist a copy of
+// the legacy file, if given. A file that is not valid for this
+// instrument is renamed to path.old and a new one is created.
+// With mem set the store starts as a copy of either file, and
+// neither of them is changed.
+//
+int Prstore::open(const char *path, const char *legacy, int nword, bool mem)
+{
+    int fd = -1;
+    char name[1100];
+    unsigned char data[HDSIZE + MCSIZE];
+
+    close();
+    snprintf(_path, sizeof(_path), "%s", path);
+    _nword = nword;
+    _rsize = 4 + 4 * nword;
+    // Enough for a sequence, or a block of records in scan().
+    delete[] _data;
+    _data = new unsigned char[(NSTEP + 1) * _rsize];
+
+    _mem = mem;
+    if (_mem)
+    {
+        if ((fd = memfd_create("presets", 0)) < 0)
+        {
+            fprintf(stderr, "Can't create a preset store in memory\n");
+            return 1;
+        }
+        if (!copy(_path, fd) || (legacy && !copy(legacy, fd)))
+            _fd = fd;
+    }
+    else
+    {
+        _fd = ::open(_path, O_RDWR);
+        if ((_fd < 0) && legacy && ((fd = ::open(_path, O_RDWR | O_CREAT, 0644)) >= 0))
+        {
+            if (copy(legacy, fd))
+            {
+                ::close(fd);
+                unlink(_path);
+            }
+            else
+            {
+                printf("Copied '%s' to '%s'\n", legacy, _path);
+                _fd = fd;
+            }
+        }
+    }
+    if ((_fd >= 0) && scan())
+    {
+        if (!_mem)
+        {
+            ::close(_fd);
+            sprintf(name, "%s.old", _path);
+            rename(_path, name);
+            fprintf(stderr, "Presets file '%s' renamed to '%s'\n", _path, name);
+        }
+        _fd = -1;
+    }
+    if (_fd >= 0)
+        return 0;
+
+    memset(_offs, 0, sizeof(_offs));
+    memset(_mconf, 0, sizeof(_mconf));
+    _nstep = 0;
+    if (_mem)
+    {
+        _fd = fd;
+        if (ftruncate(_fd, 0))
+        {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+    else
+        _fd = ::open(_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0)
+    {
+        fprintf(stderr, "Can't open '%s' for writing\n", _path);
+        return 1;
+    }
+    memset(data, 0, sizeof(data));
+    strcpy((char *)data, "PRESET");
+    WR2(data + 14, _nword);
+    if (pwrite(_fd, data, sizeof(data), 0) != (ssize_t)sizeof(data))
+    {
+        fprintf(stderr, "Can't write '%s'\n", _path);
+        ::close(_fd);
+        _fd = -1;
+        return 1;
+    }
+    fdatasync(_fd);
+    _fsize = sizeof(data);
+    return 0;
+}
+
+// Rewrites the file with only the current presets, midi
+// configuration and sequence. The new file replaces the old
+// one by a rename, so either of them is valid at any time.
+// A store in memory is not rewritten.
+//
+int Prstore::compact(void)
+{
+    int i, j, k, n, fd;
+    char name[1100];
+    unsigned char *p, *rec, data[HDSIZE + MCSIZE];
+    uint32_t *bits;
+    FILE *F;
+
+    if (_fd < 0)
+        return 1;
+    if (_mem)
+        return 0;
+    n = nlive();
+    if (_fsize == HDSIZE + MCSIZE + (uint32_t)(n * _rsize))
+        return 0;
+
+    sprintf(name, "%s.tmp", _path);
+    if (!(F = fopen(name, "w")))
+    {
+        fprintf(stderr, "Can't open '%s' for writing\n", name);
+        return 1;
+    }
+    printf("Writing '%s'\n", _path);
+
+    memset(data, 0, sizeof(data));
+    strcpy((char *)data, "PRESET");
+    WR2(data + 14, _nword);
+    p = data + HDSIZE;
+    for (i = 0; i < 8; i++)
+    {
+        for (j = 0; j < 16; j++)
+        {
+            k = _mconf[i][j];
+            WR2(p, k);
+            p += 2;
+        }
+    }
+    fwrite(data, sizeof(data), 1, F);
+
+    rec = new unsigned char[_rsize];
+    bits = new uint32_t[_nword];
+    for (i = 0; i < NBANK; i++)
+    {
+        for (j = 0; j < NPRES; j++)
+        {
+            if (get(i, j, bits))
+            {
+                encode(rec, i, j, OP_SET, bits);
+                fwrite(rec, _rsize, 1, F);
+            }
+        }
+    }
+    if (_nstep)
+    {
+        memset(rec, 0, _rsize);
+        rec[0] = SEQREC;
+        rec[1] = SEQLEN;
+        rec[2] = _nstep >> 8;
+        rec[3] = _nstep & 255;
+        fwrite(rec, _rsize, 1, F);
+        for (j = 0; j < _nstep; j++)
+        {
+            rec[1] = j;
+            rec[2] = _steps[j] >> 8;
+            rec[3] = _steps[j] & 255;
+            fwrite(rec, _rsize, 1, F);
+        }
+    }
+    delete[] rec;
+    delete[] bits;
+
+    if (fflush(F) || fsync(fileno(F)) || ferror(F))
+    {
+        fprintf(stderr, "Can't write '%s'\n", name);
+        fclose(F);
+        unlink(name);
+        return 1;
+    }
+    fclose(F);
+    if (rename(name, _path))
+    {
+        fprintf(stderr, "Can't rename '%s'\n", name);
+        unlink(name);
+        return 1;
+    }
+    if ((fd = ::open(_path, O_RDWR)) < 0)
+    {
+        fprintf(stderr, "Can't open '%s'\n", _path);
+        return 1;
+    }
+    ::close(_fd);
+    _fd = fd;
+    return scan();
+}
+
+// Replaces the file by size bytes of another presets file, which
+// must be for the same number of stops. Records are used as in
+// scan(), a partial one at the end is removed. A store in memory
+// is overwritten in place.
+//
+int Prstore::load(const unsigned char *data, int size)
+{
+    int n, fd;
+    char name[1100];
+    FILE *F;
+
+    if ((size < HDSIZE + MCSIZE) || strcmp((const char *)data, "PRESET") || data[7])
+    {
+        fprintf(stderr, "Presets data is not valid\n");
+        return 1;
+    }
+    n = RD2(data + 14);
+    if (n != _nword)
+    {
+        fprintf(stderr, "Presets data is not compatible\n");
+        return 1;
+    }
+    if (_mem)
+    {
+        if ((_fd < 0) || ftruncate(_fd, 0) || (pwrite(_fd, data, size, 0) != size))
+        {
+            fprintf(stderr, "Can't write the preset store in memory\n");
+            return 1;
+        }
+        return scan();
+    }
+
+    sprintf(name, "%s.tmp", _path);
+    if (!(F = fopen(name, "w")))
+    {
+        fprintf(stderr, "Can't open '%s' for writing\n", name);
+        return 1;
+    }
+    fwrite(data, size, 1, F);
+    if (fflush(F) || fsync(fileno(F)) || ferror(F))
+    {
+        fprintf(stderr, "Can't write '%s'\n", name);
+        fclose(F);
+        unlink(name);
+        return 1;
+    }
+    fclose(F);
+    if (rename(name, _path))
+    {
+        fprintf(stderr, "Can't rename '%s'\n", name);
+        unlink(name);
+        return 1;
+    }
+    if ((fd = ::open(_path, O_RDWR)) < 0)
+    {
+        fprintf(stderr, "Can't open '%s'\n", _path);
+        return 1;
+    }
+    close();
+    _fd = fd;
+    return scan();
+}
+
+void Prstore::close(void)
+{
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = -1;
+}
+
+int Prstore::get(int bank, int pres, uint32_t *bits)
+{
+    int k;
+    unsigned char *p;
+
+    if ((_fd < 0) || (bank < 0) || (pres < 0) || (bank >= NBANK) || (pres >= NPRES))
+        return 0;
+    if (!_offs[bank][pres])
+        return 0;
+    if (pread(_fd, _data, _rsize, _offs[bank][pres]) != _rsize)
+        return 0;
+    p = _data + 4;
+    for (k = 0; k < _nword; k++)
+    {
+        *bits++ = RD4(p);
+        p += 4;
+    }
+    return k;
+}
+
+void Prstore::set(int bank, int pres, const uint32_t *bits)
+{
+    if ((bank < 0) || (pres < 0) || (bank >= NBANK) || (pres >= NPRES))
+        return;
+    encode(_data, bank, pres, OP_SET, bits);
+    append(_data, 1);
+}
+
+void Prstore::insert(int bank, int pres, const uint32_t *bits)
+{
+    if ((bank < 0) || (pres < 0) || (bank >= NBANK) || (pres >= NPRES))
+        return;
+    encode(_data, bank, pres, OP_INS, bits);
+    append(_data, 1);
+}
+
+void Prstore::remove(int bank, int pres)
+{
+    if ((bank < 0) || (pres < 0) || (bank >= NBANK) || (pres >= NPRES))
+        return;
+    encode(_data, bank, pres, OP_DEL, 0);
+    append(_data, 1);
+}
+
+void Prstore::get_mconf(int index, uint16_t *bits) const
+{
+    memcpy(bits, _mconf[index], 16 * sizeof(uint16_t));
+}
+
+// The midi configuration has a fixed place in the file,
+// and is updated there.
+//
+void Prstore::set_mconf(int index, const uint16_t *bits)
+{
+    int j, v;
+    unsigned char *p, data[32];
+
+    if ((index < 0) || (index >= 8))
+        return;
+    memcpy(_mconf[index], bits, 16 * sizeof(uint16_t));
+    if (_fd < 0)
+        return;
+    for (j = 0, p = data; j < 16; j++, p += 2)
+    {
+        v = bits[j];
+        WR2(p, v);
+    }
+    if (pwrite(_fd, data, 32, HDSIZE + 32 * index) != 32)
+        fprintf(stderr, "Can't write '%s'\n", _path);
+    fdatasync(_fd);
+}
+
+int Prstore::get_steps(uint16_t *steps) const
+{
+    memcpy(steps, _steps, _nstep * sizeof(uint16_t));
+    return _nstep;
+}
+
+void Prstore::set_steps(int nstep, const uint16_t *steps)
+{
+    int j;
+    unsigned char *p;
+
+    if (nstep > NSTEP)
+        nstep = NSTEP;
+    memset(_data, 0, (nstep + 1) * _rsize);
+    _data[0] = SEQREC;
+    _data[1] = SEQLEN;
+    _data[2] = nstep >> 8;
+    _data[3] = nstep & 255;
+    for (j = 0, p = _data + _rsize; j < nstep; j++, p += _rsize)
+    {
+        p[0] = SEQREC;
+        p[1] = j;
+        p[2] = steps[j] >> 8;
+        p[3] = steps[j] & 255;
+    }
+    append(_data, nstep + 1);
+}
+
+// Reads the header and midi configuration, and replays all
+// records to build the index. A partial record at the end,
+// left by a crash, is removed.
+//
+int Prstore::scan(void)
+{
+    int i, j, n;
+    uint32_t offs;
+    unsigned char *p, data[HDSIZE + MCSIZE];
+
+    memset(_offs, 0, sizeof(_offs));
+    _nstep = 0;
+    if ((pread(_fd, data, HDSIZE, 0) != HDSIZE) || strcmp((char *)data, "PRESET") || data[7])
+    {
+        fprintf(stderr, "File '%s' is not a valid preset file\n", _path);
+        return 1;
+    }
+    n = RD2(data + 14);
+    if (n != _nword)
+    {
+        fprintf(stderr, "Presets in file '%s' are not compatible\n", _path);
+        return 1;
+    }
+    if (pread(_fd, data, MCSIZE, HDSIZE) != MCSIZE)
+    {
+        fprintf(stderr, "No valid data in file '%s'\n", _path);
+        return 1;
+    }
+    p = data;
+    for (i = 0; i < 8; i++)
+    {
+        for (j = 0; j < 16; j++)
+        {
+            _mconf[i][j] = RD2(p);
+            p += 2;
+        }
+    }
+
+    offs = HDSIZE + MCSIZE;
+    while ((n = pread(_fd, _data, 64 * _rsize, offs)) >= _rsize)
+    {
+        for (p = _data; n >= _rsize; p += _rsize, n -= _rsize)
+        {
+            replay(p, offs);
+            offs += _rsize;
+        }
+    }
+    if (n > 0)
+    {
+        fprintf(stderr, "Removing partial record from '%s'\n", _path);
+        if (ftruncate(_fd, offs))
+            return 1;
+    }
+    _fsize = offs;
+    return 0;
+}
+
+// Replaces the contents of the file fd by those of src.
+//
+int Prstore::copy(const char *src, int fd)
+{
+    int n, r;
+    off_t k;
+    char data[4096];
+    FILE *F;
+
+    if (!(F = fopen(src, "r")))
+        return 1;
+    r = ftruncate(fd, 0) ? 1 : 0;
+    k = 0;
+    while (!r && ((n = fread(data, 1, sizeof(data), F)) > 0))
+    {
+        if (pwrite(fd, data, n, k) != n)
+            r = 1;
+        k += n;
+    }
+    fclose(F);
+    return r;
+}
+
+// Writes nrec records at the end of the file and syncs it.
+// The index is only updated once they are written.
+//
+int Prstore::append(const unsigned char *data, int nrec)
+{
+    int i, n;
+
+    if (_fd < 0)
+        return 1;
+    n = nrec * _rsize;
+    if (pwrite(_fd, data, n, _fsize) != n)
+    {
+        fprintf(stderr, "Can't write '%s'\n", _path);
+        return 1;
+    }
+    fdatasync(_fd);
+    for (i = 0; i < nrec; i++)
+    {
+        replay(data, _fsize);
+        data += _rsize;
+        _fsize += _rsize;
+    }
+    return 0;
+}
+
+void Prstore::replay(const unsigned char *data, uint32_t offs)
+{
+    int i, j;
+
+    i = data[0];
+    j = data[1];
+    if (i == SEQREC)
+    {
+        // Preset sequence length or step.
+        if (j == SEQLEN)
+            _nstep = (data[2] << 8) | data[3];
+        else if (j < NSTEP)
+        {
+            _steps[j] = (data[2] << 8) | data[3];
+            if (_nstep <= j)
+                _nstep = j + 1;
+        }
+        if (_nstep > NSTEP)
+            _nstep = NSTEP;
+        return;
+    }
+    if ((i >= NBANK) || (j >= NPRES))
+        return;
+    switch (data[2])
+    {
+    case OP_SET:
+        _offs[i][j] = offs;
+        break;
+    case OP_CLR:
+        _offs[i][j] = 0;
+        break;
+    case OP_INS:
+        memmove(_offs[i] + j + 1, _offs[i] + j, (NPRES - 1 - j) * sizeof(uint32_t));
+        _offs[i][j] = offs;
+        break;
+    case OP_DEL:
+        memmove(_offs[i] + j, _offs[i] + j + 1, (NPRES - 1 - j) * sizeof(uint32_t));
+        _offs[i][NPRES - 1] = 0;
+        break;
+    }
+}
+
+void Prstore::encode(unsigned char *data, int bank, int pres, int op, const uint32_t *bits)
+{
+    int k;
+    uint32_t v;
+    unsigned char *p;
+
+    p = data;
+    *p++ = bank;
+    *p++ = pres;
+    *p++ = op;
+    *p++ = 0;
+    for (k = 0; k < _nword; k++)
+    {
+        v = bits ? bits[k] : 0;
+        WR4(p, v);
+        p += 4;
+    }
+}
+
+// Number of records in a compacted file.
+//
+int Prstore::nlive(void) const
+{
+    int i, j, n;
+
+    n = _nstep ? _nstep + 1 : 0;
+    for (i = 0; i < NBANK; i++)
+    {
+        for (j = 0; j < NPRES; j++)
+        {
+            if (_offs[i][j])
+                n++;
+        }
+    }
+    return n;
+}
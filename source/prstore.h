@@ -0,0 +1,96 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+#ifndef __PRSTORE_H
+#define __PRSTORE_H
+
+#include <stdint.h>
+#include "global.h"
+
+// Preset store. The file has the same header, midi configuration
+// and fixed size records as the old presets file, but is used as
+// a journal: every change appends a record and is synced, so the
+// file is always up to date and a store costs one small write.
+// Records that insert or delete a preset shift the rest of the
+// bank on replay. Only an index of record offsets is kept in
+// memory, presets are read from the file when needed. The file
+// is rewritten without old records by compact(). A preset has
+// nword words of stop bits. A store opened with mem set is an
+// anonymous file in memory, private to its user, and the file at
+// path is only read.
+//
+class Prstore
+{
+public:
+    Prstore(void);
+    ~Prstore(void);
+
+    int open(const char *path, const char *legacy, int nword, bool mem = false);
+    int compact(void);
+    int load(const unsigned char *data, int size);
+    void close(void);
+    int fd(void) const { return _fd; }
+
+    int get(int bank, int pres, uint32_t *bits);
+    void set(int bank, int pres, const uint32_t *bits);
+    void insert(int bank, int pres, const uint32_t *bits);
+    void remove(int bank, int pres);
+    void get_mconf(int index, uint16_t *bits) const;
+    void set_mconf(int index, const uint16_t *bits);
+    int get_steps(uint16_t *steps) const;
+    void set_steps(int nstep, const uint16_t *steps);
+
+    enum
+    {
+        HDSIZE = 16,  // header
+        MCSIZE = 256, // midi configuration
+        SEQREC = 255, // bank number of sequence records
+        SEQLEN = 255  // preset number of sequence length records
+    };
+
+    enum
+    {
+        OP_SET,
+        OP_CLR,
+        OP_INS,
+        OP_DEL
+    };
+
+private:
+    int scan(void);
+    int copy(const char *src, int fd);
+    int append(const unsigned char *data, int nrec);
+    void replay(const unsigned char *data, uint32_t offs);
+    void encode(unsigned char *data, int bank, int pres, int op, const uint32_t *bits);
+    int nlive(void) const;
+
+    char _path[1024];
+    int _fd;
+    bool _mem;
+    int _nword;
+    int _rsize;
+    unsigned char *_data;
+    uint32_t _fsize;
+    uint32_t _offs[NBANK][NPRES];
+    uint16_t _mconf[8][16];
+    uint16_t _steps[NSTEP];
+    int _nstep;
+};
+
+#endif
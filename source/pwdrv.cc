@@ -0,0 +1,254 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <string.h>
+#include <spa/pod/builder.h>
+#include <spa/control/control.h>
+#include <spa/param/latency-utils.h>
+#include "pwdrv.h"
+
+const struct pw_filter_events Pwfilter::_events = {
+    PW_VERSION_FILTER_EVENTS,
+    0, // destroy
+    static_state_changed,
+    0, // io_changed
+    0, // param_changed
+    0, // add_buffer
+    0, // remove_buffer
+    static_process};
+
+Pwfilter::Pwfilter(const char *name) : _name(name),
+                                       _loop(0),
+                                       _filter(0),
+                                       _dest(0),
+                                       _evid(0),
+                                       _fsamp(0),
+                                       _rate_err(false),
+                                       _ninstr(0)
+{
+    pw_init(0, 0);
+    _scratch = new float[MAXQUANT];
+}
+
+Pwfilter::~Pwfilter(void)
+{
+    stop();
+    if (_filter)
+        pw_filter_destroy(_filter);
+    if (_loop)
+        pw_thread_loop_destroy(_loop);
+    delete[] _scratch;
+    pw_deinit();
+}
+
+// Creates the filter node, for the graph to run at fsamp.
+//
+int Pwfilter::open(int fsamp)
+{
+    char s[32];
+
+    if (!(_loop = pw_thread_loop_new(_name, 0)))
+    {
+        fprintf(stderr, "Error: can't create PipeWire loop.\n");
+        return 1;
+    }
+    snprintf(s, 32, "1/%d", fsamp);
+    _filter = pw_filter_new_simple(pw_thread_loop_get_loop(_loop), _name,
+                                   pw_properties_new(PW_KEY_MEDIA_TYPE, "Audio",
+                                                     PW_KEY_MEDIA_CATEGORY, "Filter",
+                                                     PW_KEY_MEDIA_ROLE, "DSP",
+                                                     PW_KEY_NODE_RATE, s,
+                                                     "node.force-rate", "0",
+                                                     NULL),
+                                   &_events, this);
+    if (!_filter)
+    {
+        fprintf(stderr, "Error: can't create PipeWire filter.\n");
+        return 1;
+    }
+    _fsamp = fsamp;
+    return 0;
+}
+
+// Adds the ports of an instrument, initialised by init_host(),
+// before the filter is started.
+//
+int Pwfilter::add(Audio *audio, const char *prefix)
+{
+    int i, n;
+    char s[256];
+
+    if (_ninstr == NINSTR)
+        return 1;
+    n = audio->nout();
+    for (i = 0; i <= n; i++)
+    {
+        audio->port_name(i, prefix, s, 256);
+        if (!(_port[_ninstr][i] = pw_filter_add_port(_filter, (i == n) ? PW_DIRECTION_INPUT : PW_DIRECTION_OUTPUT,
+                                                      PW_FILTER_PORT_FLAG_MAP_BUFFERS, 0,
+                                                      pw_properties_new(PW_KEY_FORMAT_DSP,
+                                                                        (i == n) ? "8 bit raw midi" : "32 bit float mono audio",
+                                                                        PW_KEY_PORT_NAME, s, NULL),
+                                                      0, 0)))
+        {
+            fprintf(stderr, "Error: can't create the '%s' PipeWire port\n", s);
+            return 1;
+        }
+    }
+    _audio[_ninstr++] = audio;
+    return 0;
+}
+
+// Connects the filter and starts its loop. Event evid is sent to
+// dest if the filter fails.
+//
+int Pwfilter::start(Edest *dest, int evid)
+{
+    uint8_t buffer[256];
+    struct spa_pod_builder B;
+    struct spa_process_latency_info L;
+    const struct spa_pod *params[1];
+
+    _dest = dest;
+    _evid = evid;
+    spa_pod_builder_init(&B, buffer, sizeof(buffer));
+    memset(&L, 0, sizeof(L));
+    L.rate = PERIOD;
+    params[0] = spa_process_latency_build(&B, SPA_PARAM_ProcessLatency, &L);
+    if (pw_filter_connect(_filter, PW_FILTER_FLAG_RT_PROCESS, params, 1) < 0)
+    {
+        fprintf(stderr, "Error: can't connect PipeWire filter.\n");
+        return 1;
+    }
+    if (pw_thread_loop_start(_loop) < 0)
+    {
+        fprintf(stderr, "Error: can't start PipeWire loop.\n");
+        return 1;
+    }
+    return 0;
+}
+
+void Pwfilter::stop(void)
+{
+    if (!_loop)
+        return;
+    pw_thread_loop_lock(_loop);
+    if (_filter)
+        pw_filter_disconnect(_filter);
+    pw_thread_loop_unlock(_loop);
+    pw_thread_loop_stop(_loop);
+}
+
+void Pwfilter::static_process(void *data, struct spa_io_position *position)
+{
+    ((Pwfilter *)data)->process(position);
+}
+
+void Pwfilter::static_state_changed(void *data, enum pw_filter_state, enum pw_filter_state state, const char *error)
+{
+    ((Pwfilter *)data)->state_changed(state, error);
+}
+
+void Pwfilter::state_changed(enum pw_filter_state state, const char *error)
+{
+    if (state != PW_FILTER_STATE_ERROR)
+        return;
+    fprintf(stderr, "Error: PipeWire filter failed: %s.\n", error ? error : "unknown");
+    if (_dest)
+        _dest->put_event(_evid, 1);
+}
+
+// Runs in the PipeWire data thread. The quantum is taken from the
+// clock on each cycle, as it may change between cycles. The synth
+// only works at the rate it was made for: if the graph runs at
+// another one the outputs are silent, and the program is stopped
+// as when the filter fails.
+//
+void Pwfilter::process(struct spa_io_position *position)
+{
+    struct pw_buffer *B;
+    float *outputs[4 + NASECT];
+    int i, k, n, m;
+    uint32_t r;
+    Audio *A;
+
+    n = position->clock.duration;
+    if (n > MAXQUANT)
+        return;
+    r = position->clock.rate.denom;
+    if (r && (r != (uint32_t)_fsamp) && !_rate_err)
+    {
+        _rate_err = true;
+        fprintf(stderr, "Error: PipeWire runs at %u Hz instead of %d Hz.\n", r, _fsamp);
+        if (_dest)
+            _dest->put_event(_evid, 1);
+    }
+    for (k = 0; k < _ninstr; k++)
+    {
+        A = _audio[k];
+        m = A->nout();
+        for (i = 0; i < m; i++)
+        {
+            outputs[i] = (float *)pw_filter_get_dsp_buffer(_port[k][i], n);
+            if (!outputs[i])
+                outputs[i] = _scratch;
+        }
+        B = pw_filter_dequeue_buffer(_port[k][m]);
+        if (_rate_err)
+        {
+            for (i = 0; i < m; i++)
+                memset(outputs[i], 0, n * sizeof(float));
+        }
+        else
+            A->process(n, _midi, get_midi(B), outputs);
+        if (B)
+            pw_filter_queue_buffer(_port[k][m], B);
+    }
+}
+
+// Collects the MIDI events in a buffer of the MIDI port. They are
+// valid until the buffer is queued again.
+//
+int Pwfilter::get_midi(struct pw_buffer *B)
+{
+    struct spa_data *D;
+    struct spa_pod *P;
+    struct spa_pod_control *C;
+    int n;
+
+    if (!B)
+        return 0;
+    D = B->buffer->datas;
+    P = (struct spa_pod *)spa_pod_from_data(D->data, D->maxsize, D->chunk->offset, D->chunk->size);
+    if (!P || !spa_pod_is_sequence(P))
+        return 0;
+    n = 0;
+    SPA_POD_SEQUENCE_FOREACH((struct spa_pod_sequence *)P, C)
+    {
+        if ((C->type != SPA_CONTROL_Midi) || (n == NMIDI))
+            continue;
+        _midi[n]._time = C->offset;
+        _midi[n]._size = SPA_POD_BODY_SIZE(&C->value);
+        _midi[n]._data = (const uint8_t *)SPA_POD_BODY(&C->value);
+        n++;
+    }
+    return n;
+}
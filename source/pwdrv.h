@@ -0,0 +1,74 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __PWDRV_H
+#define __PWDRV_H
+
+#include <clthreads.h>
+#include <pipewire/pipewire.h>
+#include <pipewire/filter.h>
+#include "audio.h"
+
+// Runs instruments as a native PipeWire filter node. The first one
+// has the usual port names, those of the others are prefixed by
+// the instrument name, as for JACK. The quantum may change at any
+// time, and need not be a multiple of PERIOD, as the instruments
+// are run with Audio::process(). Up to PERIOD frames of that are
+// reported as process latency.
+//
+class Pwfilter
+{
+public:
+    enum { NINSTR = 8, MAXQUANT = 8192, NMIDI = 256 };
+
+    Pwfilter(const char *name);
+    ~Pwfilter(void);
+
+    int open(int fsamp);
+    int add(Audio *audio, const char *prefix);
+    int start(Edest *dest, int evid);
+    void stop(void);
+    int fsamp(void) const { return _fsamp; }
+
+private:
+    void process(struct spa_io_position *position);
+    void state_changed(enum pw_filter_state state, const char *error);
+    int get_midi(struct pw_buffer *B);
+
+    static void static_process(void *data, struct spa_io_position *position);
+    static void static_state_changed(void *data, enum pw_filter_state old,
+                                     enum pw_filter_state state, const char *error);
+    static const struct pw_filter_events _events;
+
+    const char *_name;
+    struct pw_thread_loop *_loop;
+    struct pw_filter *_filter;
+    Edest *_dest;
+    int _evid;
+    int _fsamp;
+    bool _rate_err; // the graph runs at another rate
+    int _ninstr;
+    Audio *_audio[NINSTR];
+    void *_port[NINSTR][5 + NASECT]; // outputs and MIDI input
+    float *_scratch; // for outputs without a buffer
+    Midiev _midi[NMIDI];
+};
+
+#endif
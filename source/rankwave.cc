@@ -26,11 +26,11 @@
 
 extern float exp2ap(float);
 
-Rngen Pipewave::_rgen;
-float *Pipewave::_arg = 0;
-float *Pipewave::_att = 0;
+Rngen Pipetab::_rgen;
+float *Pipetab::_arg = 0;
+float *Pipetab::_att = 0;
 
-void Pipewave::initstatic(float fsamp)
+void Pipetab::initstatic(float fsamp)
 {
     int k;
 
@@ -47,6 +47,7 @@ void Pipewave::play(void)
     int i, k;
     float g, dg, y, dy;
     float *p, *q, *r;
+    const Pipetab *T = _tab;
 
     p = _p_p;
     r = _p_r;
@@ -55,7 +56,7 @@ void Pipewave::play(void)
     {
         if (!p)
         {
-            p = _p0;
+            p = T->_p0;
             _y_p = 0.0f;
             _z_p = 0.0f;
         }
@@ -68,7 +69,7 @@ void Pipewave::play(void)
             p = 0;
             _g_r = 1.0f;
             _y_r = _y_p;
-            _i_r = _k_r;
+            _i_r = T->_k_r;
         }
     }
 
@@ -80,9 +81,9 @@ void Pipewave::play(void)
         i = _i_r - 1;
         dg = g / PERIOD;
         if (i)
-            dg *= _m_r;
+            dg *= T->_m_r;
 
-        if (r < _p1)
+        if (r < T->_p1)
         {
             while (k--)
             {
@@ -93,7 +94,7 @@ void Pipewave::play(void)
         else
         {
             y = _y_r;
-            dy = _d_r;
+            dy = T->_d_r;
             while (k--)
             {
                 y += dy;
@@ -109,9 +110,9 @@ void Pipewave::play(void)
                 }
                 *q++ += g * (r[0] + y * (r[1] - r[0]));
                 g -= dg;
-                r += _k_s;
-                if (r >= _p2)
-                    r -= _l1;
+                r += T->_k_s;
+                if (r >= T->_p2)
+                    r -= T->_l1;
             }
             _y_r = y;
         }
@@ -129,7 +130,7 @@ void Pipewave::play(void)
     {
         k = PERIOD;
         q = _out;
-        if (p < _p1)
+        if (p < T->_p1)
         {
             while (k--)
             {
@@ -139,8 +140,8 @@ void Pipewave::play(void)
         else
         {
             y = _y_p;
-            _z_p += _d_w * (_d_a * (_rgen.urandf() - 0.5f) - _z_p);
-            dy = _z_p * _k_s;
+            _z_p += T->_d_w * (T->_d_a * (Pipetab::_rgen.urandf() - 0.5f) - _z_p);
+            dy = _z_p * T->_k_s;
             while (k--)
             {
                 y += dy;
@@ -155,9 +156,9 @@ void Pipewave::play(void)
                     p -= 1;
                 }
                 *q++ += p[0] + y * (p[1] - p[0]);
-                p += _k_s;
-                if (p >= _p2)
-                    p -= _l1;
+                p += T->_k_s;
+                if (p >= T->_p2)
+                    p -= T->_l1;
             }
             _y_p = y;
         }
@@ -167,7 +168,7 @@ void Pipewave::play(void)
     _p_r = r;
 }
 
-void Pipewave::genwave(Addsynth *D, int n, float fsamp, float fpipe)
+void Pipetab::genwave(Addsynth *D, int n, float fsamp, float fpipe)
 {
     int h, i, k, nc;
     float f0, f1, f, m, t, v, v0;
@@ -263,7 +264,7 @@ void Pipewave::genwave(Addsynth *D, int n, float fsamp, float fpipe)
         _p0[i + _l0 + _l1] = _p0[i + _l0];
 }
 
-void Pipewave::looplen(float f, float fsamp, int lmax, int *aa, int *bb)
+void Pipetab::looplen(float f, float fsamp, int lmax, int *aa, int *bb)
 {
     int i, j, a, b, t;
     int z[8];
@@ -306,7 +307,7 @@ void Pipewave::looplen(float f, float fsamp, int lmax, int *aa, int *bb)
     *bb = b;
 }
 
-void Pipewave::attgain(int n, float p)
+void Pipetab::attgain(int n, float p)
 {
     int i, j, k;
     float d, m, w, x, y, z;
@@ -333,7 +334,7 @@ void Pipewave::attgain(int n, float p)
     }
 }
 
-void Pipewave::save(FILE *F)
+void Pipetab::save(FILE *F)
 {
     int k;
     union
@@ -357,7 +358,7 @@ void Pipewave::save(FILE *F)
     fwrite(_p0, k, sizeof(float), F);
 }
 
-void Pipewave::load(FILE *F)
+void Pipetab::load(FILE *F)
 {
     int k;
     union
@@ -384,28 +385,158 @@ void Pipewave::load(FILE *F)
     fread(_p0, k, sizeof(float), F);
 }
 
-Rankwave::Rankwave(int n0, int n1) : _n0(n0), _n1(n1), _list(0), _modif(false)
+Ranktab::Ranktab(Addsynth *D, float fsamp, float fbase, float *scale) : _next(0),
+                                                                       _synth(*D),
+                                                                       _hash(digest(D)),
+                                                                       _fsamp(fsamp),
+                                                                       _fbase(fbase),
+                                                                       _n0(D->_n0),
+                                                                       _n1(D->_n1),
+                                                                       _refc(1),
+                                                                       _modif(false)
 {
-    _pipes = new Pipewave[n1 - n0 + 1];
+    memcpy(_scale, scale, 12 * sizeof(float));
+    _tabs = new Pipetab[_n1 - _n0 + 1];
 }
 
-Rankwave::~Rankwave(void)
+Ranktab::~Ranktab(void)
 {
-    delete[] _pipes;
+    delete[] _tabs;
 }
 
-void Rankwave::gen_waves(Addsynth *D, float fsamp, float fbase, float *scale)
+// Hash of the synthesis parameters that determine the wavetables.
+// Names, pan and delay are not included, so identical stops used
+// under a different name or in another division share their tables.
+//
+uint32_t Ranktab::digest(Addsynth *D)
 {
-    Pipewave::initstatic(fsamp);
+    const uint8_t *p, *q;
+    uint32_t h;
+
+    p = (const uint8_t *)(&D->_n0);
+    q = (const uint8_t *)(&D->_h_atp + 1);
+    h = 2166136261u;
+    while (p < q)
+    {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+    return h;
+}
 
-    fbase *= D->_fn / (D->_fd * scale[9]);
+bool Ranktab::match(Addsynth *D, float fsamp, float fbase, float *scale) const
+{
+    const char *p = (const char *)(&D->_n0);
+    const char *q = (const char *)(&D->_h_atp + 1);
+
+    if ((_hash != digest(D)) || (_fsamp != fsamp) || (_fbase != fbase))
+        return false;
+    if (memcmp(_scale, scale, 12 * sizeof(float)))
+        return false;
+    return !memcmp((const char *)(&_synth._n0), p, q - p);
+}
+
+void Ranktab::gen_waves(void)
+{
+    float fbase;
+    Addsynth *D = &_synth;
+
+    Pipetab::initstatic(_fsamp);
+
+    fbase = _fbase * D->_fn / (D->_fd * _scale[9]);
     for (int i = _n0; i <= _n1; i++)
     {
-        _pipes[i - _n0].genwave(D, i - _n0, fsamp, ldexpf(fbase * scale[i % 12], i / 12 - 5));
+        _tabs[i - _n0].genwave(D, i - _n0, _fsamp, ldexpf(fbase * _scale[i % 12], i / 12 - 5));
     }
     _modif = true;
 }
 
+Wavestore::~Wavestore(void)
+{
+    Ranktab *T;
+
+    while (_list)
+    {
+        T = _list;
+        _list = T->_next;
+        delete T;
+    }
+}
+
+// Return an existing Ranktab with an extra reference, or 0 if
+// there is none matching the given parameters.
+//
+Ranktab *Wavestore::find(Addsynth *D, float fsamp, float fbase, float *scale)
+{
+    Ranktab *T;
+
+    purge();
+    for (T = _list; T; T = T->_next)
+    {
+        if (T->match(D, fsamp, fbase, scale))
+        {
+            T->acquire();
+            return T;
+        }
+    }
+    return 0;
+}
+
+// Create a new, empty Ranktab holding one reference. The caller
+// is responsible for loading or generating the wavetables.
+//
+Ranktab *Wavestore::create(Addsynth *D, float fsamp, float fbase, float *scale)
+{
+    Ranktab *T;
+
+    purge();
+    T = new Ranktab(D, fsamp, fbase, scale);
+    T->_next = _list;
+    _list = T;
+    return T;
+}
+
+void Wavestore::purge(void)
+{
+    Ranktab *P, *T;
+
+    P = 0;
+    T = _list;
+    while (T)
+    {
+        if (T->refc() == 0)
+        {
+            if (P)
+                P->_next = T->_next;
+            else
+                _list = T->_next;
+            delete T;
+            T = P ? P->_next : _list;
+        }
+        else
+        {
+            P = T;
+            T = T->_next;
+        }
+    }
+}
+
+Rankwave::Rankwave(Ranktab *T) : _n0(T->_n0), _n1(T->_n1), _list(0), _tab(T)
+{
+    Pipewave *P;
+    Pipetab *Q;
+
+    _pipes = new Pipewave[_n1 - _n0 + 1];
+    for (P = _pipes, Q = T->_tabs; P <= _pipes + (_n1 - _n0); P++, Q++)
+        P->_tab = Q;
+}
+
+Rankwave::~Rankwave(void)
+{
+    delete[] _pipes;
+    _tab->release();
+}
+
 void Rankwave::set_param(float *out, int del, int pan)
 {
     int n, a, b;
@@ -451,10 +582,10 @@ void Rankwave::play(int shift)
     }
 }
 
-int Rankwave::save(const char *path, Addsynth *D, float fsamp, float fbase, float *scale)
+int Ranktab::save(const char *path, Addsynth *D)
 {
     FILE *F;
-    Pipewave *P;
+    Pipetab *P;
     int i;
     char name[1024];
     char data[64];
@@ -487,12 +618,12 @@ int Rankwave::save(const char *path, Addsynth *D, float fsamp, float fbase, floa
     data[5] = _n1;
     data[6] = 0;
     data[7] = 0;
-    *((float *)(data + 8)) = fsamp;
-    *((float *)(data + 12)) = fbase;
-    memcpy(data + 16, scale, 12 * sizeof(float));
+    *((float *)(data + 8)) = _fsamp;
+    *((float *)(data + 12)) = _fbase;
+    memcpy(data + 16, _scale, 12 * sizeof(float));
     fwrite(data, 1, 64, F);
 
-    for (i = _n0, P = _pipes; i <= _n1; i++, P++)
+    for (i = _n0, P = _tabs; i <= _n1; i++, P++)
         P->save(F);
 
     fclose(F);
@@ -501,10 +632,10 @@ int Rankwave::save(const char *path, Addsynth *D, float fsamp, float fbase, floa
     return 0;
 }
 
-int Rankwave::load(const char *path, Addsynth *D, float fsamp, float fbase, float *scale)
+int Ranktab::load(const char *path, Addsynth *D)
 {
     FILE *F;
-    Pipewave *P;
+    Pipetab *P;
     int i;
     char name[1024];
     char data[64];
@@ -556,7 +687,7 @@ int Rankwave::load(const char *path, Addsynth *D, float fsamp, float fbase, floa
     }
 
     f = *((float *)(data + 8));
-    if (fabsf(f - fsamp) > 0.1f)
+    if (fabsf(f - _fsamp) > 0.1f)
     {
 #ifdef DEBUG
         fprintf(stderr, "File '%s' has a different sample frequency (%3.1lf)\n", name, f);
@@ -566,7 +697,7 @@ int Rankwave::load(const char *path, Addsynth *D, float fsamp, float fbase, floa
     }
 
     f = *((float *)(data + 12));
-    if (fabsf(f - fbase) > 0.1f)
+    if (fabsf(f - _fbase) > 0.1f)
     {
 #ifdef DEBUG
         fprintf(stderr, "File '%s' has a different tuning (%3.1lf)\n", name, f);
@@ -578,7 +709,7 @@ int Rankwave::load(const char *path, Addsynth *D, float fsamp, float fbase, floa
     for (i = 0; i < 12; i++)
     {
         f = *((float *)(data + 16 + 4 * i));
-        if (fabsf(f / scale[i] - 1.0f) > 6e-5f)
+        if (fabsf(f / _scale[i] - 1.0f) > 6e-5f)
         {
 #ifdef DEBUG
             fprintf(stderr, "File '%s' has a different temperament\n", name);
@@ -588,7 +719,7 @@ int Rankwave::load(const char *path, Addsynth *D, float fsamp, float fbase, floa
         }
     }
 
-    for (i = _n0, P = _pipes; i <= _n1; i++, P++)
+    for (i = _n0, P = _tabs; i <= _n1; i++, P++)
         P->load(F);
 
     fclose(F);
@@ -26,25 +26,23 @@
 
 #define PERIOD 64
 
-class Pipewave
+class Pipetab
 {
 private:
-    Pipewave(void) : _p0(0), _p1(0), _p2(0), _l1(0),
-                     _k_s(0), _k_r(0),
-                     _m_r(0), _d_r(0), _d_a(0), _d_w(0),
-                     _link(0), _sbit(0), _sdel(0),
-                     _p_p(0), _y_p(0), _z_p(0), _p_r(0), _y_r(0), _g_r(0), _i_r(0)
+    Pipetab(void) : _p0(0), _p1(0), _p2(0), _l0(0), _l1(0),
+                    _k_s(0), _k_r(0),
+                    _m_r(0), _d_r(0), _d_a(0), _d_w(0)
     {
     }
 
-    ~Pipewave(void) { delete[] _p0; }
+    ~Pipetab(void) { delete[] _p0; }
 
-    friend class Rankwave;
+    friend class Pipewave;
+    friend class Ranktab;
 
     void genwave(Addsynth *D, int n, float fsamp, float fpipe);
     void save(FILE *F);
     void load(FILE *F);
-    void play(void);
 
     static void looplen(float f, float fsamp, int lmax, int *aa, int *bb);
     static void attgain(int n, float p);
@@ -61,6 +59,26 @@ private:
     float _d_a;   // instability amplitude
     float _d_w;   // instability bandwidth
 
+    static void initstatic(float fsamp);
+
+    static Rngen _rgen;
+    static float *_arg;
+    static float *_att;
+};
+
+class Pipewave
+{
+private:
+    Pipewave(void) : _tab(0), _link(0), _sbit(0), _sdel(0),
+                     _p_p(0), _y_p(0), _z_p(0), _p_r(0), _y_r(0), _g_r(0), _i_r(0)
+    {
+    }
+
+    friend class Rankwave;
+
+    void play(void);
+
+    const Pipetab *_tab; // shared wavetable
     Pipewave *_link; // link to next in active chain
     uint32_t _sbit;  // on state bit
     uint32_t _sdel;  // delayed state
@@ -72,18 +90,76 @@ private:
     float _y_r;      // release interpolation
     float _g_r;      // release gain
     int16_t _i_r;    // release count
+};
 
-    static void initstatic(float fsamp);
+// Wavetables for all pipes of a rank. These are read-only once
+// generated or loaded, and shared by all Rankwaves created from
+// identical synthesis parameters, tuning and temperament. The
+// reference count is decremented by the audio thread, all other
+// operations are done by the thread that owns the Wavestore.
+//
+class Ranktab
+{
+public:
+    Ranktab(Addsynth *D, float fsamp, float fbase, float *scale);
+    ~Ranktab(void);
 
-    static Rngen _rgen;
-    static float *_arg;
-    static float *_att;
+    int n0(void) const { return _n0; }
+    int n1(void) const { return _n1; }
+    void gen_waves(void);
+    int save(const char *path, Addsynth *D);
+    int load(const char *path, Addsynth *D);
+    bool modif(void) const { return _modif; }
+    bool match(Addsynth *D, float fsamp, float fbase, float *scale) const;
+
+    void acquire(void) { __atomic_add_fetch(&_refc, 1, __ATOMIC_ACQ_REL); }
+    void release(void) { __atomic_sub_fetch(&_refc, 1, __ATOMIC_ACQ_REL); }
+    int refc(void) const { return __atomic_load_n(&_refc, __ATOMIC_ACQUIRE); }
+
+    static uint32_t digest(Addsynth *D);
+
+private:
+    Ranktab(const Ranktab &);
+    Ranktab &operator=(const Ranktab &);
+
+    friend class Rankwave;
+    friend class Wavestore;
+
+    Ranktab *_next;
+    Addsynth _synth;
+    uint32_t _hash;
+    float _fsamp;
+    float _fbase;
+    float _scale[12];
+    int _n0;
+    int _n1;
+    int _refc;
+    bool _modif;
+    Pipetab *_tabs;
+};
+
+// Refcounted set of Ranktabs, keyed by synthesis parameters.
+// Entries are deleted by purge() once the last Rankwave using
+// them has been destroyed.
+//
+class Wavestore
+{
+public:
+    Wavestore(void) : _list(0) {}
+    ~Wavestore(void);
+
+    Ranktab *find(Addsynth *D, float fsamp, float fbase, float *scale);
+    Ranktab *create(Addsynth *D, float fsamp, float fbase, float *scale);
+    void purge(void);
+
+private:
+    Ranktab *_list;
 };
 
 class Rankwave
 {
 public:
-    Rankwave(int n0, int n1);
+    Rankwave(Ranktab *T);
     ~Rankwave(void);
 
     void note_on(uint8_t n)
@@ -118,12 +194,11 @@ public:
 
     int n0(void) const { return _n0; }
     int n1(void) const { return _n1; }
+    bool active(void) const { return _list != 0; }
     void play(int shift);
     void set_param(float *out, int del, int pan);
-    void gen_waves(Addsynth *D, float fsamp, float fbase, float *scale);
-    int save(const char *path, Addsynth *D, float fsamp, float fbase, float *scale);
-    int load(const char *path, Addsynth *D, float fsamp, float fbase, float *scale);
-    bool modif(void) const { return _modif; }
+    int save(const char *path, Addsynth *D) { return _tab->save(path, D); }
+    bool modif(void) const { return _tab->modif(); }
 
     uint16_t _nmask; // used by division logic
 
@@ -136,7 +211,7 @@ private:
     uint32_t _sbit;
     Pipewave *_list;
     Pipewave *_pipes;
-    bool _modif;
+    Ranktab *_tab;
 };
 
 #endif
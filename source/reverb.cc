@@ -23,61 +23,142 @@
 #include <math.h>
 #include "reverb.h"
 
-void Delelm::init(int size, float fb)
+#define BLOCK 64
+
+#if defined(__clang__)
+#define SHUFFLE(x, ...) __builtin_shufflevector(x, x, __VA_ARGS__)
+#else
+typedef int v8i __attribute__((vector_size(32)));
+#define SHUFFLE(x, ...) __builtin_shuffle(x, (v8i){__VA_ARGS__})
+#endif
+
+// Unaligned load and store, the Delbank members are plain arrays.
+#define VLOAD(v, p) memcpy(&(v), (p), sizeof(v8f))
+#define VSTORE(p, v) memcpy((p), &(v), sizeof(v8f))
+
+void Delbank::init(int m, const int *sizes, const float *feedb)
 {
-    _size = size;
-    _line = new float[size];
-    memset(_line, 0, size * sizeof(float));
-    _i = 0;
-    _fb = fb;
-    _slo = 0;
-    _shi = 0;
+    int k, n;
+
+    for (k = n = 0; k < 8; k++)
+        n += m * sizes[2 * k];
+    _data = new float[n];
+    memset(_data, 0, n * sizeof(float));
+    for (k = n = 0; k < 8; k++)
+    {
+        _size[k] = m * sizes[2 * k];
+        _line[k] = _data + n;
+        n += _size[k];
+        _i[k] = 0;
+        _fb[k] = feedb[2 * k];
+        _slo[k] = 0;
+        _shi[k] = 0;
+    }
 }
 
-void Delelm::fini(void)
+void Delbank::fini(void)
 {
-    delete[] _line;
+    delete[] _data;
 }
 
-void Delelm::set_t60mf(float tmf)
+void Delbank::set_t60mf(float tmf)
 {
-    _gmf = powf(0.001f, _size / tmf);
+    for (int k = 0; k < 8; k++)
+        _gmf[k] = powf(0.001f, _size[k] / tmf);
 }
 
-void Delelm::set_t60lo(float tlo, float wlo)
+void Delbank::set_t60lo(float tlo, float wlo)
 {
-    _glo = powf(0.001f, _size / tlo) / _gmf - 1.0f;
-    _wlo = wlo;
+    for (int k = 0; k < 8; k++)
+    {
+        _glo[k] = powf(0.001f, _size[k] / tlo) / _gmf[k] - 1.0f;
+        _wlo[k] = wlo;
+    }
 }
 
-void Delelm::set_t60hi(float thi, float chi)
+void Delbank::set_t60hi(float thi, float chi)
 {
     float g, t;
 
-    g = powf(0.001f, _size / thi) / _gmf;
-    t = (1 - g * g) / (2 * g * g * chi);
-    _whi = (sqrt(1 + 4 * t) - 1) / (2 * t);
+    for (int k = 0; k < 8; k++)
+    {
+        g = powf(0.001f, _size[k] / thi) / _gmf[k];
+        t = (1 - g * g) / (2 * g * g * chi);
+        _whi[k] = (sqrt(1 + 4 * t) - 1) / (2 * t);
+    }
+}
+
+// Read the next n delayed samples of all lines into d, one v8f
+// per sample. This is valid as long as n is not larger than the
+// shortest line, as none of these samples will be overwritten
+// by the following write().
+//
+void Delbank::read(int n, v8f *d)
+{
+    int i, j, k;
+    float *p;
+
+    for (k = 0; k < 8; k++)
+    {
+        p = _line[k];
+        i = _i[k];
+        for (j = 0; j < n; j++)
+        {
+            d[j][k] = p[i];
+            if (++i == _size[k])
+                i = 0;
+        }
+    }
 }
 
-float Delelm::process(float x)
+// Write n new input samples and advance the line indices.
+//
+void Delbank::write(int n, v8f *d)
 {
-    float t;
+    int i, j, k;
+    float *p;
+
+    for (k = 0; k < 8; k++)
+    {
+        p = _line[k];
+        i = _i[k];
+        for (j = 0; j < n; j++)
+        {
+            p[i] = d[j][k];
+            if (++i == _size[k])
+                i = 0;
+        }
+        _i[k] = i;
+    }
+}
+
+void Delbank::reset(void)
+{
+    for (int k = 0; k < 8; k++)
+    {
+        memset(_line[k], 0, _size[k] * sizeof(float));
+        _slo[k] = 0;
+        _shi[k] = 0;
+    }
+}
 
-    t = _line[_i] * _gmf;
-    _slo += _wlo * (t - _slo);
-    t += _glo * _slo;
-    _shi += _whi * (t - _shi);
-    t = x - _fb * _shi + 1e-10;
-    _line[_i] = t;
-    if (++_i == _size)
-        _i = 0;
-    return _shi + _fb * t;
+int Delbank::maxsize(void) const
+{
+    int k, n;
+
+    for (k = n = 0; k < 8; k++)
+        if (_size[k] > n)
+            n = _size[k];
+    return n;
 }
 
-void Delelm::print(void)
+void Delbank::print(void)
 {
-    printf("%5d %6.3lf   %5.3lf %5.3lf   %6.4lf %6.4lf\n",
-           _size, _fb, _glo, _gmf, _wlo, _whi);
+    for (int k = 0; k < 8; k++)
+    {
+        printf("%5d %6.3lf   %5.3lf %5.3lf   %6.4lf %6.4lf\n",
+               _size[k], _fb[k], _glo[k], _gmf[k], _wlo[k], _whi[k]);
+    }
 }
 
 int Reverb::_sizes[16] =
@@ -112,9 +193,11 @@ void Reverb::init(float rate)
     memset(_line, 0, _size * sizeof(float));
     _i = 0;
     m = (rate < 64e3) ? 1 : 2;
-    for (int i = 0; i < 16; i++)
-        _delm[i].init(m * _sizes[i], _feedb[i]);
-    _x0 = _x1 = _x2 = _x3 = _x4 = _x5 = _x6 = _x7 = _z = 0;
+    _bank0.init(m, _sizes + 0, _feedb + 0);
+    _bank1.init(m, _sizes + 1, _feedb + 1);
+    memset(_x, 0, 8 * sizeof(float));
+    _z = 0;
+    _ilat = 0;
     set_delay(0.05);
     set_t60mf(4.0f);
     set_t60lo(5.0f, 250.0f);
@@ -124,27 +207,56 @@ void Reverb::init(float rate)
 void Reverb::fini(void)
 {
     delete[] _line;
-    for (int i = 0; i < 16; i++)
-        _delm[i].fini();
+    _bank0.fini();
+    _bank1.fini();
 }
 
 void Reverb::set_delay(float del)
 {
     if (del < 0.01f)
         del = 0.01f;
-    _idel = (int)(_rate * del);
+    _del = del;
+    _idel = (int)(_rate * del) - _ilat;
+    if (_idel < 1)
+        _idel = 1;
     if (_idel > _size)
         _idel = _size;
 }
 
+// Set the number of samples by which the reverb input is delayed
+// before it is processed. This is subtracted from the predelay.
+//
+void Reverb::set_latency(int lat)
+{
+    _ilat = lat;
+    set_delay(_del);
+}
+
+// The longest path from the input to the output is through the
+// predelay and the longest line of each bank.
+//
+int Reverb::tail(void) const
+{
+    return _size + _bank0.maxsize() + _bank1.maxsize();
+}
+
+void Reverb::reset(void)
+{
+    memset(_line, 0, _size * sizeof(float));
+    _bank0.reset();
+    _bank1.reset();
+    memset(_x, 0, 8 * sizeof(float));
+    _z = 0;
+}
+
 void Reverb::set_t60mf(float tmf)
 {
     float t;
 
     _tmf = tmf;
     t = tmf * _rate;
-    for (int i = 0; i < 16; i++)
-        _delm[i].set_t60mf(t);
+    _bank0.set_t60mf(t);
+    _bank1.set_t60mf(t);
     _gain = 1.0f / sqrtf(tmf);
 }
 
@@ -156,8 +268,8 @@ void Reverb::set_t60lo(float tlo, float flo)
     _flo = flo;
     t = tlo * _rate;
     w = 2 * M_PI * flo / _rate;
-    for (int i = 0; i < 16; i++)
-        _delm[i].set_t60lo(t, w);
+    _bank0.set_t60lo(t, w);
+    _bank1.set_t60lo(t, w);
 }
 
 void Reverb::set_t60hi(float thi, float fhi)
@@ -168,97 +280,106 @@ void Reverb::set_t60hi(float thi, float fhi)
     _fhi = fhi;
     t = thi * _rate;
     c = 1 - cosf(2 * M_PI * fhi / _rate);
-    for (int i = 0; i < 16; i++)
-        _delm[i].set_t60hi(t, c);
+    _bank0.set_t60hi(t, c);
+    _bank1.set_t60hi(t, c);
 }
 
 void Reverb::print(void)
 {
-    for (int i = 0; i < 16; i++)
-        _delm[i].print();
+    _bank0.print();
+    _bank1.print();
 }
 
+// The eight lines of each bank are processed as one v8f, with
+// the Hadamard mixing done by shuffles. All lines are longer
+// than BLOCK samples, so their delayed outputs are read and their
+// inputs written one block at a time, outside the sample loop.
+//
 void Reverb::process(int n, float gain, float *R, float *W, float *X, float *Y, float *Z)
 {
-    int i, j;
-    float t, g, x;
+    int i, j, k, m;
+    float g, x;
+    v8f t, v, s1, s2, s3;
+    v8f gmf0, glo0, wlo0, whi0, fb0, slo0, shi0;
+    v8f gmf1, glo1, wlo1, whi1, fb1, slo1, shi1;
+    v8f d0[BLOCK];
+    v8f d1[BLOCK];
 
     g = sqrtf(0.125f);
     gain *= _gain;
+    s1 = (v8f){1, -1, 1, -1, 1, -1, 1, -1};
+    s2 = (v8f){1, 1, -1, -1, 1, 1, -1, -1};
+    s3 = (v8f){1, 1, 1, 1, -1, -1, -1, -1};
+
+    VLOAD(gmf0, _bank0._gmf);
+    VLOAD(glo0, _bank0._glo);
+    VLOAD(wlo0, _bank0._wlo);
+    VLOAD(whi0, _bank0._whi);
+    VLOAD(fb0, _bank0._fb);
+    VLOAD(slo0, _bank0._slo);
+    VLOAD(shi0, _bank0._shi);
+    VLOAD(gmf1, _bank1._gmf);
+    VLOAD(glo1, _bank1._glo);
+    VLOAD(wlo1, _bank1._wlo);
+    VLOAD(whi1, _bank1._whi);
+    VLOAD(fb1, _bank1._fb);
+    VLOAD(slo1, _bank1._slo);
+    VLOAD(shi1, _bank1._shi);
+    VLOAD(v, _x);
 
     i = _i;
-    while (n--)
+    while (n)
     {
-        j = i - _idel;
-        if (j < 0)
-            j += _size;
-        x = _line[j];
-        _z += 0.6f * (*R++ - _z) + 1e-10f;
-        _line[i] = _z;
-        if (++i == _size)
-            i = 0;
-
-        _x0 = _delm[0].process(g * _x0 + x);
-        _x1 = _delm[2].process(g * _x1 + x);
-        _x2 = _delm[4].process(g * _x2 + x);
-        _x3 = _delm[6].process(g * _x3 + x);
-        _x4 = _delm[8].process(g * _x4 + x);
-        _x5 = _delm[10].process(g * _x5 + x);
-        _x6 = _delm[12].process(g * _x6 + x);
-        _x7 = _delm[14].process(g * _x7 + x);
-
-        t = _x0 - _x1;
-        _x0 += _x1;
-        _x1 = t;
-        t = _x2 - _x3;
-        _x2 += _x3;
-        _x3 = t;
-        t = _x4 - _x5;
-        _x4 += _x5;
-        _x5 = t;
-        t = _x6 - _x7;
-        _x6 += _x7;
-        _x7 = t;
-
-        t = _x0 - _x2;
-        _x0 += _x2;
-        _x2 = t;
-        t = _x1 - _x3;
-        _x1 += _x3;
-        _x3 = t;
-        t = _x4 - _x6;
-        _x4 += _x6;
-        _x6 = t;
-        t = _x5 - _x7;
-        _x5 += _x7;
-        _x7 = t;
-
-        t = _x0 - _x4;
-        _x0 += _x4;
-        _x4 = t;
-        t = _x1 - _x5;
-        _x1 += _x5;
-        _x5 = t;
-        t = _x2 - _x6;
-        _x2 += _x6;
-        _x6 = t;
-        t = _x3 - _x7;
-        _x3 += _x7;
-        _x7 = t;
-
-        *W++ += 1.25f * gain * _x0;
-        *X++ += gain * (_x1 - 0.05f * _x2);
-        *Y++ += gain * _x2;
-        *Z++ += gain * _x4;
-
-        _x0 = _delm[1].process(_x0);
-        _x1 = _delm[3].process(_x1);
-        _x2 = _delm[5].process(_x2);
-        _x3 = _delm[7].process(_x3);
-        _x4 = _delm[9].process(_x4);
-        _x5 = _delm[11].process(_x5);
-        _x6 = _delm[13].process(_x6);
-        _x7 = _delm[15].process(_x7);
+        m = (n < BLOCK) ? n : BLOCK;
+        _bank0.read(m, d0);
+        _bank1.read(m, d1);
+
+        for (k = 0; k < m; k++)
+        {
+            j = i - _idel;
+            if (j < 0)
+                j += _size;
+            x = _line[j];
+            _z += 0.6f * (*R++ - _z);
+            _line[i] = _z;
+            if (++i == _size)
+                i = 0;
+
+            t = d0[k] * gmf0;
+            slo0 += wlo0 * (t - slo0);
+            t += glo0 * slo0;
+            shi0 += whi0 * (t - shi0);
+            t = g * v + x - fb0 * shi0;
+            d0[k] = t;
+            v = shi0 + fb0 * t;
+
+            v = SHUFFLE(v, 0, 0, 2, 2, 4, 4, 6, 6) + s1 * SHUFFLE(v, 1, 1, 3, 3, 5, 5, 7, 7);
+            v = SHUFFLE(v, 0, 1, 0, 1, 4, 5, 4, 5) + s2 * SHUFFLE(v, 2, 3, 2, 3, 6, 7, 6, 7);
+            v = SHUFFLE(v, 0, 1, 2, 3, 0, 1, 2, 3) + s3 * SHUFFLE(v, 4, 5, 6, 7, 4, 5, 6, 7);
+
+            *W++ += 1.25f * gain * v[0];
+            *X++ += gain * (v[1] - 0.05f * v[2]);
+            *Y++ += gain * v[2];
+            *Z++ += gain * v[4];
+
+            t = d1[k] * gmf1;
+            slo1 += wlo1 * (t - slo1);
+            t += glo1 * slo1;
+            shi1 += whi1 * (t - shi1);
+            t = v - fb1 * shi1;
+            d1[k] = t;
+            v = shi1 + fb1 * t;
+        }
+
+        _bank0.write(m, d0);
+        _bank1.write(m, d1);
+        n -= m;
     }
     _i = i;
+
+    VSTORE(_bank0._slo, slo0);
+    VSTORE(_bank0._shi, shi0);
+    VSTORE(_bank1._slo, slo1);
+    VSTORE(_bank1._shi, shi1);
+    VSTORE(_x, v);
 }
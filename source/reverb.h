@@ -21,39 +21,71 @@
 #ifndef __REVERB_H
 #define __REVERB_H
 
-class Delelm
+// Eight floats, mapped to one AVX register or two SSE/NEON ones.
+typedef float v8f __attribute__((vector_size(32)));
+
+// Eight delay elements of the FDN processed in parallel. All
+// lines share one block of memory, and all parameters and state
+// are stored per lane so they can be loaded as a v8f.
+//
+class Delbank
 {
 private:
     friend class Reverb;
 
-    void init(int size, float fb);
+    void init(int m, const int *sizes, const float *feedb);
     void fini(void);
     void set_t60mf(float tmf);
     void set_t60lo(float tlo, float _wlo);
     void set_t60hi(float thi, float chi);
+    void read(int n, v8f *d);
+    void write(int n, v8f *d);
+    void reset(void);
+    int maxsize(void) const;
     void print(void);
-    float process(float x);
 
-    int _i;
-    int _size;
-    float *_line;
-    float _fb;
-    float _gmf;
-    float _glo;
-    float _wlo;
-    float _whi;
-    float _slo;
-    float _shi;
+    float *_data;
+    float *_line[8];
+    int _size[8];
+    int _i[8];
+    float _fb[8];
+    float _gmf[8];
+    float _glo[8];
+    float _wlo[8];
+    float _whi[8];
+    float _slo[8];
+    float _shi[8];
+};
+
+// Interface of the reverb engines used by Audio. The input R
+// is processed into the first order B-format signals W, X, Y
+// and Z, which are added to. The latency is the delay of the
+// input, in samples, that the engine should compensate for.
+// If the input has been zero and the output silent for tail()
+// samples, the engine may be reset and no longer processed
+// until there is new input.
+//
+class Revproc
+{
+public:
+    virtual ~Revproc(void) {}
+    virtual void process(int n, float gain, float *R, float *W, float *X, float *Y, float *Z) = 0;
+    virtual void set_latency(int lat) = 0;
+    virtual int tail(void) const = 0;
+    virtual void reset(void) {}
 };
 
-class Reverb
+class Reverb : public Revproc
 {
 public:
     void init(float rate);
     void fini(void);
-    void process(int n, float gain, float *R, float *W, float *X, float *Y, float *Z);
+    virtual void process(int n, float gain, float *R, float *W, float *X, float *Y, float *Z);
 
     void set_delay(float del);
+    virtual void set_latency(int lat);
+    virtual int tail(void) const;
+    virtual void reset(void);
     void set_t60mf(float tmf);
     void set_t60lo(float tlo, float flo);
     void set_t60hi(float thi, float fhi);
@@ -63,16 +95,19 @@ private:
     float *_line;
     int _size;
     int _idel;
+    int _ilat;
     int _i;
-    Delelm _delm[16];
+    Delbank _bank0;
+    Delbank _bank1;
     float _rate;
     float _gain;
+    float _del;
     float _tmf;
     float _tlo;
     float _thi;
     float _flo;
     float _fhi;
-    float _x0, _x1, _x2, _x3, _x4, _x5, _x6, _x7;
+    float _x[8];
     float _z;
 
     static int _sizes[16];
@@ -0,0 +1,147 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "revthread.h"
+#include "denormal.h"
+
+Revthread::Revthread(Revproc *reverb, int fsize, int cpu) : _reverb(reverb),
+                                                          _stop(false),
+                                                          _cpu(cpu),
+                                                          _fsize(fsize),
+                                                          _nsend(0),
+                                                          _ilat(0),
+                                                          _nframes(0),
+                                                          _gain(0),
+                                                          _iwr(0)
+{
+    int i;
+
+    // The server may increase its period later.
+    if (_fsize < MAXFRAMES)
+        _fsize = MAXFRAMES;
+    fsize = _fsize;
+    for (i = 0; i < 2; i++)
+    {
+        _inp[i] = new float[fsize];
+        memset(_inp[i], 0, fsize * sizeof(float));
+    }
+    for (i = 0; i < 4; i++)
+    {
+        _out[i] = new float[fsize];
+        memset(_out[i], 0, fsize * sizeof(float));
+    }
+}
+
+Revthread::~Revthread(void)
+{
+    int i;
+
+    _reverb->set_latency(0);
+    for (i = 0; i < 2; i++)
+        delete[] _inp[i];
+    for (i = 0; i < 4; i++)
+        delete[] _out[i];
+}
+
+void Revthread::set_reverb(Revproc *reverb)
+{
+    _reverb = reverb;
+    _reverb->set_latency(_ilat);
+}
+
+// Called by the audio callback at the start of a cycle of nframes,
+// not more than size(), with the reverb thread idle. Passes the
+// input written in the previous cycle to the reverb thread and
+// switches send() to the other buffer. If the previous cycle had
+// a different size its input is dropped, and false is returned:
+// there is no reverb output for this cycle, and wait() must not
+// be called.
+//
+bool Revthread::trigger(int nframes, float gain)
+{
+    int n;
+
+    n = _nsend;
+    _nsend = nframes;
+    _iwr ^= 1;
+    if (n != nframes)
+        return false;
+    if (_ilat != nframes)
+    {
+        _ilat = nframes;
+        _reverb->set_latency(nframes);
+    }
+    _nframes = nframes;
+    _gain = gain;
+    _trig.post();
+    return true;
+}
+
+// Called by the audio callback, with the reverb thread idle, for
+// a cycle in which the reverb is run by the callback itself.
+//
+void Revthread::bypass(void)
+{
+    _nsend = 0;
+    if (_ilat)
+    {
+        _ilat = 0;
+        _reverb->set_latency(0);
+    }
+}
+
+// Called when the audio callback is no longer running.
+//
+void Revthread::stop(void)
+{
+    _stop = true;
+    _trig.post();
+    _done.wait();
+}
+
+void Revthread::thr_main(void)
+{
+    int i;
+    cpu_set_t cpus;
+    Denormal D;
+
+    if (_cpu >= 0)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(_cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus))
+            fprintf(stderr, "Warning: can't run reverb thread on CPU %d.\n", _cpu);
+    }
+
+    while (true)
+    {
+        _trig.wait();
+        if (_stop)
+            break;
+        for (i = 0; i < 4; i++)
+            memset(_out[i], 0, _nframes * sizeof(float));
+        _reverb->process(_nframes, _gain, _inp[_iwr ^ 1], _out[0], _out[1], _out[2], _out[3]);
+        _done.post();
+    }
+    _done.post();
+}
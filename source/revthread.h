@@ -0,0 +1,75 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+#ifndef __REVTHREAD_H
+#define __REVTHREAD_H
+
+#include <clthreads.h>
+#include "reverb.h"
+
+// Runs the reverb on a separate thread, one period behind the
+// audio callback. In each cycle the callback calls trigger() to
+// hand over the reverb input it wrote in the previous cycle, fills
+// send() with new input while the divisions are rendered, then
+// calls wait() and adds the output of the reverb to its own. The
+// buffers hold up to size() frames. The previous input is only
+// used if it has the same number of frames as the current cycle,
+// and the reverb latency is set to that number.
+//
+class Revthread : public P_thread
+{
+public:
+    Revthread(Revproc *reverb, int fsize, int cpu);
+    virtual ~Revthread(void);
+
+    enum
+    {
+        MAXFRAMES = 8192
+    };
+
+    int size(void) const { return _fsize; }
+    float *send(void) const { return _inp[_iwr]; }
+    const float *output(int i) const { return _out[i]; }
+    void set_reverb(Revproc *reverb);
+
+    bool trigger(int nframes, float gain);
+    void skip(int nframes) { _nsend = nframes; }
+    void bypass(void);
+    void wait(void) { _done.wait(); }
+    void stop(void);
+
+private:
+    virtual void thr_main(void);
+
+    Revproc *_reverb;
+    P_sema _trig;
+    P_sema _done;
+    volatile bool _stop;
+    int _cpu;
+    int _fsize;
+    int _nsend;
+    int _ilat;
+    int _nframes;
+    float _gain;
+    int _iwr;
+    float *_inp[2];
+    float *_out[4];
+};
+
+#endif
@@ -20,57 +20,98 @@
 
 #include <unistd.h>
 #include "slave.h"
+#include "convrev.h"
 
 void Slave::thr_main(void)
 {
     ITC_mesg *M;
+    int e;
 
-    while (get_event() != EV_EXIT)
+    while ((e = get_event()) != EV_EXIT)
     {
         M = get_message();
-        if (!M)
-            continue;
+        if (M)
+            proc_mesg(M, (e == FM_MODEL) ? 0 : e + 1);
+    }
+    send_event(EV_EXIT, 1);
+}
 
-        switch (M->type())
-        {
-        case MT_CALC_RANK:
+// Does the work for a message from the model. Also called by
+// the LV2 plugin from the host's worker thread, in which case
+// this thread is not started.
+//
+void Slave::proc_mesg(ITC_mesg *M, int k)
+{
+    switch (M->type())
+    {
+    case MT_CALC_RANK:
+    {
+        M_def_rank *X = (M_def_rank *)M;
+        send_event(to_model(k), new M_ifc_ifelm(MT_IFC_ELATT, X->_group, X->_ifelm));
+        Ranktab *T = _wstore.find(X->_synth, X->_fsamp, X->_fbase, X->_scale);
+        if (!T)
         {
-            M_def_rank *X = (M_def_rank *)M;
-            send_event(TO_MODEL, new M_ifc_ifelm(MT_IFC_ELATT, X->_group, X->_ifelm));
-            X->_rwave = new Rankwave(X->_synth->_n0, X->_synth->_n1);
-            X->_rwave->gen_waves(X->_synth, X->_fsamp, X->_fbase, X->_scale);
-            send_event(TO_AUDIO, M);
-            break;
+            T = _wstore.create(X->_synth, X->_fsamp, X->_fbase, X->_scale);
+            T->gen_waves();
         }
+        X->_rwave = new Rankwave(T);
+        send_event(to_audio(k), M);
+        break;
+    }
 
-        case MT_LOAD_RANK:
+    case MT_LOAD_RANK:
+    {
+        M_def_rank *X = (M_def_rank *)M;
+        send_event(to_model(k), new M_ifc_ifelm(MT_IFC_ELATT, X->_group, X->_ifelm));
+        Ranktab *T = _wstore.find(X->_synth, X->_fsamp, X->_fbase, X->_scale);
+        if (!T)
         {
-            M_def_rank *X = (M_def_rank *)M;
-            send_event(TO_MODEL, new M_ifc_ifelm(MT_IFC_ELATT, X->_group, X->_ifelm));
-            X->_rwave = new Rankwave(X->_synth->_n0, X->_synth->_n1);
-            if (X->_rwave->load(X->_path, X->_synth, X->_fsamp, X->_fbase, X->_scale))
-            {
-                X->_rwave->gen_waves(X->_synth, X->_fsamp, X->_fbase, X->_scale);
-            }
-            send_event(TO_AUDIO, M);
-            break;
+            T = _wstore.create(X->_synth, X->_fsamp, X->_fbase, X->_scale);
+            if (T->load(X->_path, X->_synth))
+                T->gen_waves();
         }
+        X->_rwave = new Rankwave(T);
+        send_event(to_audio(k), M);
+        break;
+    }
+
+    case MT_SAVE_RANK:
+    {
+        M_def_rank *X = (M_def_rank *)M;
+        X->_rwave->save(X->_path, X->_synth);
+        M->recover();
+        break;
+    }
 
-        case MT_SAVE_RANK:
+    case MT_LOAD_IR:
+    {
+        // An empty path selects the FDN reverb. If the
+        // IR can't be loaded the current one is kept.
+        M_load_ir *X = (M_load_ir *)M;
+        if (*X->_path)
         {
-            M_def_rank *X = (M_def_rank *)M;
-            X->_rwave->save(X->_path, X->_synth, X->_fsamp, X->_fbase, X->_scale);
-            M->recover();
-            break;
+            Convrev *C = new Convrev();
+            C->set_latency(X->_revlat);
+            if (C->load(X->_path, X->_fsamp, X->_fsize) || C->start(X->_policy, X->_relpri))
+            {
+                delete C;
+                M->recover();
+                break;
+            }
+            X->_revproc = C;
         }
+        send_event(to_audio(k), M);
+        break;
+    }
 
-        case MT_AUDIO_SYNC:
-            send_event(TO_AUDIO, M);
-            break;
+    case MT_NEW_DIVIS:
+        // Divisions added by a reload go the same way as
+        // their ranks, so they exist when these arrive.
+    case MT_AUDIO_SYNC:
+        send_event(to_audio(k), M);
+        break;
 
-        default:
-            M->recover();
-        }
+    default:
+        M->recover();
     }
-    send_event(EV_EXIT, 1);
 }
@@ -23,17 +23,32 @@
 
 #include <clthreads.h>
 #include "messages.h"
+#include "rankwave.h"
 
+// Computes and loads the wavetables for up to NINSTR instruments,
+// which share the tables of identical ranks. Instrument k sends to
+// input port fm_model(k) and is answered on output ports to_audio(k)
+// and to_model(k). Instrument 0 uses the usual ports.
+//
 class Slave : public A_thread
 {
 public:
+    enum { NINSTR = 8 };
+
     Slave(void) : A_thread("Slave") {}
     virtual ~Slave(void) {}
 
     void terminate(void) { put_event(EV_EXIT, 1); }
+    void proc_mesg(ITC_mesg *M, int k = 0);
+
+    static int fm_model(int k) { return k ? k - 1 : FM_MODEL; }
+    static int to_audio(int k) { return k ? 15 + k : TO_AUDIO; }
+    static int to_model(int k) { return k ? 23 + k : TO_MODEL; }
 
 private:
     virtual void thr_main(void);
+
+    Wavestore _wstore;
 };
 
 #endif
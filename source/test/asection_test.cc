@@ -0,0 +1,267 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+// Checks the block processed Asection against a sample by sample
+// implementation of the same early reflection network, as it was
+// before the diffusers and output mixing were fused. Both are fed
+// the same random bursts, with silence in between so that the
+// bypass of an idle section is tested as well.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../asection.h"
+
+#define N (MIXLEN * PERIOD)
+
+class Refdiff
+{
+public:
+    void init(int size, float c)
+    {
+        _size = size;
+        _data = new float[size];
+        memset(_data, 0, size * sizeof(float));
+        _i = 0;
+        _c = c;
+    }
+    void fini(void) { delete[] _data; }
+    float process(float x)
+    {
+        float w;
+
+        w = x - _c * _data[_i];
+        x = _data[_i] + _c * w;
+        _data[_i] = w;
+        if (++_i == _size)
+            _i = 0;
+        return x;
+    }
+
+private:
+    float *_data;
+    int _size;
+    int _i;
+    float _c;
+};
+
+class Refsect
+{
+public:
+    Refsect(float fsam, const Fparm *apar);
+    ~Refsect(void);
+
+    float *get_wptr(void) { return _base + _offs0; }
+    void set_size(float size);
+    void process(float vol, float *W, float *X, float *Y, float *R, float *D);
+
+private:
+    enum
+    {
+        AZIMUTH,
+        STWIDTH,
+        DIRECT,
+        REFLECT,
+        REVERB
+    };
+
+    int _offs0;
+    int _offs[16];
+    float _fsam;
+    float *_base;
+    float _sw;
+    float _sx;
+    float _sy;
+    Refdiff _dif0;
+    Refdiff _dif1;
+    Refdiff _dif2;
+    Refdiff _dif3;
+    const Fparm *_apar;
+};
+
+Refsect::Refsect(float fsam, const Fparm *apar) : _offs0(0), _fsam(fsam), _apar(apar)
+{
+    _base = new float[NCHANN * N];
+    memset(_base, 0, NCHANN * N * sizeof(float));
+    _sw = _sx = _sy = 0.0f;
+    _dif0.init((int)(fsam * 0.017f), 0.5f);
+    _dif1.init((int)(fsam * 0.029f), 0.5f);
+    _dif2.init((int)(fsam * 0.023f), 0.5f);
+    _dif3.init((int)(fsam * 0.013f), 0.5f);
+}
+
+Refsect::~Refsect(void)
+{
+    delete[] _base;
+    _dif0.fini();
+    _dif1.fini();
+    _dif2.fini();
+    _dif3.fini();
+}
+
+void Refsect::set_size(float time)
+{
+    int i, d;
+    float r;
+
+    r = (time * _fsam);
+    if (r > N - PERIOD)
+        r = N - PERIOD;
+    for (i = 0; i < 16; i++)
+    {
+        d = (int)(r * Asection::_refl[i]);
+        d = (_offs0 - d * PERIOD) & (N - 1);
+        _offs[i] = d + (i >> 2) * N;
+    }
+}
+
+void Refsect::process(float vol, float *W, float *X, float *Y, float *R, float *D)
+{
+    int i;
+    float s, d, g, gw, gr, gx1, gy1, gx2, gy2;
+    float *p, t0, t1, t2, t3;
+    float x[PERIOD];
+    float y[PERIOD];
+
+    gw = vol * _apar[DIRECT]._val;
+    g = 0.45f * _apar[STWIDTH]._val;
+    s = 0.5f + g * (1 - g);
+    d = g - 0.5f;
+    gx1 = gw * (s - d);
+    gy1 = gw * (s + d);
+    g = 0.25f * _apar[STWIDTH]._val;
+    s = 0.5f + g * (1 - g);
+    d = g - 0.5f;
+    gx2 = gw * (s - d);
+    gy2 = gw * (s + d);
+    p = _base + _offs0;
+    gr = 0.5f * _apar[REVERB]._val;
+    for (i = 0; i < PERIOD; i++)
+    {
+        t0 = p[0 * N];
+        t1 = p[1 * N];
+        t2 = p[2 * N];
+        t3 = p[3 * N];
+        p++;
+        s = t0 + t1 + t2 + t3;
+        R[i] += gr * s;
+        W[i] += gw * s;
+        D[i] = vol * s;
+        x[i] = gx1 * (t3 + t0) + gx2 * (t2 + t1);
+        y[i] = gy1 * (t3 - t0) + gy2 * (t2 - t1);
+    }
+
+    gr = vol * _apar[REFLECT]._val;
+    p = _base;
+    for (i = 0; i < PERIOD; i++)
+    {
+        t0 = _dif0.process(p[_offs[1]] + p[_offs[5]] + p[_offs[11]] + p[_offs[15]]);
+        t1 = _dif1.process(p[_offs[0]] + p[_offs[4]] + p[_offs[10]] + p[_offs[14]]);
+        t2 = _dif2.process(p[_offs[2]] + p[_offs[6]] + p[_offs[8]] + p[_offs[12]]);
+        t3 = _dif3.process(p[_offs[3]] + p[_offs[7]] + p[_offs[9]] + p[_offs[13]]);
+        p++;
+        s = t0 + t1 + t2 + t3;
+        _sw += 0.5f * (s - _sw);
+        _sx += 0.5f * (0.4f * (t0 + t3) + 0.6f * (t2 + t1) - _sx);
+        _sy += 0.5f * (0.9f * (t0 - t3) + 0.8f * (t2 - t1) - _sy);
+        W[i] += gr * _sw;
+        x[i] += gr * _sx;
+        y[i] += gr * _sy;
+    }
+
+    g = 6.283184f * _apar[AZIMUTH]._val;
+    gx1 = cosf(g);
+    gy1 = sinf(g);
+    for (i = 0; i < PERIOD; i++)
+    {
+        X[i] += gx1 * x[i] + gy1 * y[i];
+        Y[i] += gx1 * y[i] - gy1 * x[i];
+    }
+
+    _offs0 = (_offs0 + PERIOD) & (N - 1);
+    for (i = 0; i < 16; i++)
+        _offs[i] = ((_offs[i] + PERIOD) & (N - 1)) + (i >> 2) * N;
+    p = _base + _offs0;
+    memset(p + 0 * N, 0, PERIOD * sizeof(float));
+    memset(p + 1 * N, 0, PERIOD * sizeof(float));
+    memset(p + 2 * N, 0, PERIOD * sizeof(float));
+    memset(p + 3 * N, 0, PERIOD * sizeof(float));
+}
+
+// The outputs may differ by rounding, and by the tails below
+// SILENT that are cut off when the section becomes idle.
+#define TOLER 1e-6f
+#define NPERIOD 20000
+
+static float maxdiff(const float *a, const float *b, float m)
+{
+    for (int i = 0; i < PERIOD; i++)
+        m = fmaxf(m, fabsf(a[i] - b[i]));
+    return m;
+}
+
+int main(void)
+{
+    int i, j, k, n;
+    float e, v, *p, *q;
+    float A[5][PERIOD];
+    float B[5][PERIOD];
+
+    Asection S(48000.0f);
+    Refsect T(48000.0f, S.get_apar());
+    S.get_apar()[0]._val = 0.1f;
+    S.set_size(0.075f);
+    T.set_size(0.075f);
+    srand(1);
+    e = 0;
+    n = 0;
+    for (k = 0; k < NPERIOD; k++)
+    {
+        // Bursts of 200 periods every 3000, the section is idle
+        // for most of the time in between.
+        if ((k % 3000) < 200)
+        {
+            p = S.get_wptr();
+            q = T.get_wptr();
+            for (j = 0; j < NCHANN; j++)
+            {
+                for (i = 0; i < PERIOD; i++)
+                {
+                    v = 0.2f * (rand() / (float)RAND_MAX - 0.5f);
+                    p[j * N + i] += v;
+                    q[j * N + i] += v;
+                }
+            }
+            S.touch();
+        }
+        memset(A, 0, sizeof(A));
+        memset(B, 0, sizeof(B));
+        S.process(0.5f, A[0], A[1], A[2], A[3], A[4]);
+        T.process(0.5f, B[0], B[1], B[2], B[3], B[4]);
+        for (j = 0; j < 5; j++)
+            e = maxdiff(A[j], B[j], e);
+        if (!S.active())
+            n++;
+    }
+    printf("Asection: maximum difference %.3g, idle for %d periods, %s\n",
+           e, n, ((e < TOLER) && n) ? "ok" : "FAILED");
+    return ((e < TOLER) && n) ? 0 : 1;
+}
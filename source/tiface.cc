@@ -63,16 +63,14 @@ Tiface::Tiface(int ac, char *av[]) : _reader(this, FM_TXTIP),
                                      _stop(false),
                                      _init(true),
                                      _initdata(0),
-                                     _mididata(0)
+                                     _mididata(0),
+                                     _ifelms(0)
 {
-    int i;
-
-    for (i = 0; i < NGROUP; i++)
-        _ifelms[i] = 0;
 }
 
 Tiface::~Tiface(void)
 {
+    delete[] _ifelms;
 }
 
 void Tiface::stop(void)
@@ -175,6 +173,8 @@ void Tiface::handle_ifc_init(M_ifc_init *M)
     if (_initdata)
         _initdata->recover();
     _initdata = M;
+    delete[] _ifelms;
+    _ifelms = new uint32_t[M->_nword]();
 }
 
 void Tiface::handle_ifc_mcset(M_ifc_chconf *M)
@@ -196,17 +196,27 @@ void Tiface::handle_ifc_retune(M_ifc_retune *M)
 
 void Tiface::handle_ifc_grclr(M_ifc_ifelm *M)
 {
-    _ifelms[M->_group] = 0;
+    int i, n;
+    uint32_t *m;
+
+    m = _ifelms + _initdata->_groupd[M->_group]._iword;
+    n = _initdata->_groupd[M->_group]._nifelm;
+    for (i = 0; i < n; i += 32)
+        m[i >> 5] = 0;
 }
 
 void Tiface::handle_ifc_elclr(M_ifc_ifelm *M)
 {
-    _ifelms[M->_group] &= ~(1 << M->_ifelm);
+    uint32_t *m = _ifelms + _initdata->_groupd[M->_group]._iword;
+
+    m[M->_ifelm >> 5] &= ~(1u << (M->_ifelm & 31));
 }
 
 void Tiface::handle_ifc_elset(M_ifc_ifelm *M)
 {
-    _ifelms[M->_group] |= (1 << M->_ifelm);
+    uint32_t *m = _ifelms + _initdata->_groupd[M->_group]._iword;
+
+    m[M->_ifelm >> 5] |= 1u << (M->_ifelm & 31);
 }
 
 void Tiface::handle_ifc_elatt(M_ifc_ifelm *M)
@@ -272,7 +282,7 @@ void Tiface::print_divisd(void)
     int i, b, k, n;
 
     printf("Divisions:\n");
-    for (k = 0; k < NDIVIS; k++)
+    for (k = 0; k < _initdata->_ndivis; k++)
     {
         n = 0;
         if (_initdata->_divisd[k]._label[0])
@@ -311,7 +321,7 @@ void Tiface::print_midimap(void)
             printf(" %2d  ", c + 1);
             if (f & 1)
                 printf("keybd %-7s", _initdata->_keybdd[k]._label);
-            if (f & 2)
+            if ((f & 2) && (k < _initdata->_ndivis))
                 printf("divis %-7s", _initdata->_divisd[k]._label);
             if (f & 4)
                 printf("instr");
@@ -326,19 +336,18 @@ void Tiface::print_midimap(void)
 void Tiface::print_stops_short(int group)
 {
     int i, n;
-    uint32_t m;
+    uint32_t *m;
 
     rewrite_label(_initdata->_groupd[group]._label);
     printf("Stops in group %s\n", _tempstr);
-    m = _ifelms[group];
+    m = _ifelms + _initdata->_groupd[group]._iword;
     n = _initdata->_groupd[group]._nifelm;
     for (i = 0; i < n; i++)
     {
-        printf("  %c %-8s", (m & 1) ? '+' : '-',
+        printf("  %c %-8s", ((m[i >> 5] >> (i & 31)) & 1) ? '+' : '-',
                _initdata->_groupd[group]._ifelmd[i]._mnemo);
         if ((i % 5) == 4)
             printf("\n");
-        m >>= 1;
     }
     if (n % 5)
         printf("\n");
@@ -347,18 +356,17 @@ void Tiface::print_stops_short(int group)
 void Tiface::print_stops_long(int group)
 {
     int i, n;
-    uint32_t m;
+    uint32_t *m;
 
     rewrite_label(_initdata->_groupd[group]._label);
     printf("Stops in group %s\n", _tempstr);
-    m = _ifelms[group];
+    m = _ifelms + _initdata->_groupd[group]._iword;
     n = _initdata->_groupd[group]._nifelm;
     for (i = 0; i < n; i++)
     {
         rewrite_label(_initdata->_groupd[group]._ifelmd[i]._label);
-        printf("  %c %-7s %-1s\n", (m & 1) ? '+' : '-',
+        printf("  %c %-7s %-1s\n", ((m[i >> 5] >> (i & 31)) & 1) ? '+' : '-',
                _initdata->_groupd[group]._ifelmd[i]._mnemo, _tempstr);
-        m >>= 1;
     }
 }
 
@@ -411,6 +419,11 @@ void Tiface::parse_command(const char *p)
         send_event(TO_MODEL, new ITC_mesg(MT_IFC_SAVE));
         break;
 
+    case 'R':
+    case 'r':
+        send_event(TO_MODEL, new ITC_mesg(MT_IFC_RELOAD));
+        break;
+
     default:
         printf("Unknown command '%c'\n", c1);
     }
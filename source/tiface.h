@@ -75,7 +75,7 @@ private:
     bool _init;
     M_ifc_init *_initdata;
     M_ifc_chconf *_mididata;
-    uint32_t _ifelms[NGROUP];
+    uint32_t *_ifelms; // bitset of all stops
     char _tempstr[64];
 };
 
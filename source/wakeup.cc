@@ -0,0 +1,75 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include "wakeup.h"
+
+Wakeup::Wakeup(void) : _dest(0),
+                       _evid(0),
+                       _running(false),
+                       _stop(false)
+{
+}
+
+Wakeup::~Wakeup(void)
+{
+    stop();
+}
+
+// Starts passing posts on as event evid to dest, in a thread
+// with the given policy and priority if possible.
+//
+int Wakeup::start(Edest *dest, int evid, int policy, int priority)
+{
+    _dest = dest;
+    _evid = evid;
+    if (thr_start(policy, priority, 0))
+    {
+        fprintf(stderr, "Warning: can't run wakeup thread in RT mode.\n");
+        if (thr_start(SCHED_OTHER, 0, 0))
+            return 1;
+    }
+    _running = true;
+    return 0;
+}
+
+void Wakeup::stop(void)
+{
+    if (!_running)
+        return;
+    _stop = true;
+    _sema.post();
+    _done.wait();
+    _running = false;
+}
+
+void Wakeup::thr_main(void)
+{
+    while (true)
+    {
+        _sema.wait();
+        if (_stop)
+            break;
+        // Several posts need only one event.
+        while (!_sema.trywait())
+            ;
+        _dest->put_event(_evid, 1);
+    }
+    _done.post();
+}
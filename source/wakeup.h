@@ -0,0 +1,51 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2022-2024 riban <riban@zynthian.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+#ifndef __WAKEUP_H
+#define __WAKEUP_H
+
+#include <clthreads.h>
+
+// Lets the audio thread send an event to another thread. Sending
+// an ITC event takes a lock, which the audio thread must not do,
+// but posting a semaphore is safe. This thread waits on it and
+// passes the event on. Posts made before start() are kept.
+//
+class Wakeup : public P_thread
+{
+public:
+    Wakeup(void);
+    virtual ~Wakeup(void);
+
+    void post(void) { _sema.post(); }
+    int start(Edest *dest, int evid, int policy, int priority);
+    void stop(void);
+
+private:
+    virtual void thr_main(void);
+
+    Edest *_dest;
+    int _evid;
+    bool _running;
+    volatile bool _stop;
+    P_sema _sema;
+    P_sema _done;
+};
+
+#endif
@@ -47,6 +47,7 @@ Xiface::Xiface(int ac, char *av[])
     _aupar = 0;
     _dipar = 0;
     _editp = 0;
+    _initdata = 0;
 }
 
 Xiface::~Xiface(void)
@@ -55,6 +56,8 @@ Xiface::~Xiface(void)
     delete _audiowin;
     delete _instrwin;
     delete _editwin;
+    if (_initdata)
+        _initdata->recover();
     delete _xhan;
     delete _root;
     delete _disp;
@@ -124,6 +127,24 @@ void Xiface::handle_mesg(ITC_mesg *M)
     case MT_IFC_INIT:
     {
         M_ifc_init *X = (M_ifc_init *)M;
+        if (_ready)
+        {
+            // The instrument was reloaded.
+            delete _mainwin;
+            delete _midiwin;
+            delete _audiowin;
+            delete _instrwin;
+            delete _editwin;
+            if (_editp)
+                _editp->recover();
+            _editp = 0;
+            _ready = false;
+        }
+        // The windows keep pointers to the labels in X.
+        if (_initdata)
+            _initdata->recover();
+        _initdata = X;
+        M = 0;
         _mainwin = new Mainwin(_root, this, 100, 100, &_xresm);
         _midiwin = new Midiwin(_root, this, 120, 120, &_xresm);
         _audiowin = new Audiowin(_root, this, 140, 140, &_xresm);
@@ -86,6 +86,7 @@ private:
     M_ifc_aupar *_aupar;
     M_ifc_dipar *_dipar;
     M_ifc_edit *_editp;
+    M_ifc_init *_initdata;
 };
 
 #endif